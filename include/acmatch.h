@@ -0,0 +1,43 @@
+/* $Id$ */
+#ifndef INCLUDED_acmatch_h
+#define INCLUDED_acmatch_h
+
+/* An Aho-Corasick automaton over a set of literals, matched case
+ * insensitively.  Literals are added with an id, then the automaton is
+ * built once and can be scanned any number of times.  Scanning doesn't
+ * modify the automaton.
+ */
+struct acmatch_lit
+{
+	char *lit;
+	unsigned int id;
+	int next;			/* next literal ending in the same state */
+	rb_dlink_node ptr;
+};
+
+struct acmatch
+{
+	rb_dlink_list lits;
+	unsigned int count;
+
+	unsigned char classmap[256];	/* folded char -> class, 0 is "other" */
+	unsigned int nclass;
+
+	unsigned int nstates;
+	unsigned int *delta;		/* nstates * nclass transitions */
+	int *out;			/* first literal ending in each state */
+	unsigned int *dict;		/* next state down the fail chain with output */
+	struct acmatch_lit **table;	/* literals by index */
+};
+
+extern struct acmatch *acmatch_create(void);
+extern void acmatch_free(struct acmatch *);
+extern void acmatch_add(struct acmatch *, const char *lit, unsigned int id);
+extern void acmatch_build(struct acmatch *);
+extern void acmatch_scan(struct acmatch *, const char *text, size_t len,
+				unsigned int *marks, unsigned int mark);
+
+/* the longest literal every match of a regexp contains, for the above */
+extern char *regexp_literal(const char *regexp, unsigned int minlen);
+
+#endif
@@ -9,6 +9,14 @@
 
 #define MAX_CHANNEL_TABLE	16384
 
+/* initial size of the channel hashtab, it grows as needed */
+#define CHANNEL_HASH_SIZE	4096
+
+/* channels with at least this many users get a hash of their members,
+ * which is dropped again once they fall below half of it
+ */
+#define CHMEMBER_HASH_MIN	64
+
 extern rb_dlink_list channel_list;
 
 #define DIR_NONE -1
@@ -36,6 +44,9 @@ struct channel
 	rb_dlink_list users_unopped;	/* subset of users who are unopped */
 	rb_dlink_list services;
 
+	rb_dlink_list *member_hash;	/* users hashed by client, large channels only */
+	unsigned int member_hash_size;
+
 	rb_dlink_list bans;		/* +b */
 	rb_dlink_list excepts;		/* +e */
 	rb_dlink_list invites;		/* +I */
@@ -43,7 +54,9 @@ struct channel
 	struct chmode mode;
 
 	rb_dlink_node listptr;		/* node in channel_list */
-	rb_dlink_node nameptr;		/* node in channel hash */
+
+	rb_dlink_node splitnode;	/* see del_chmembers_split() */
+	unsigned int split_flags;
 
 #ifdef ENABLE_CHANFIX
 	void *cfptr;			/* chanfix pointer */
@@ -55,6 +68,7 @@ struct chmember
 	rb_dlink_node chnode;		/* node in struct channel */
 	rb_dlink_node choppednode;		/* node in struct channel for opped/unopped */
 	rb_dlink_node usernode;		/* node in struct client */
+	rb_dlink_node hashnode;		/* node in channels member_hash */
 
 	struct channel *chptr;
 	struct client *client_p;
@@ -76,6 +90,10 @@ struct chmember
 #define MODE_VOICED		0x0002
 #define MODE_DEOPPED		0x0004
 
+/* split_flags */
+#define CHANNEL_SPLIT_TOUCHED	0x0001
+#define CHANNEL_SPLIT_DEOPPED	0x0002
+
 #define is_opped(x)	((x)->flags & MODE_OPPED)
 #define is_voiced(x)	((x)->flags & MODE_VOICED)
 
@@ -102,6 +120,7 @@ extern const char *chmode_to_string_simple(struct chmode *mode);
 
 extern struct chmember *add_chmember(struct channel *chptr, struct client *target_p, int flags);
 extern void del_chmember(struct chmember *mptr);
+extern void del_chmembers_split(struct client *client_p, rb_dlink_list *users);
 extern struct chmember *find_chmember(struct channel *chptr, struct client *target_p);
 #define is_member(chptr, target_p) ((find_chmember(chptr, target_p)) ? 1 : 0)
 
@@ -11,6 +11,9 @@
 #define MAX_NAME_HASH 65536
 #define MAX_HOST_HASH 65536
 
+/* initial size of the client hashtabs, they grow as needed */
+#define CLIENT_HASH_SIZE 4096
+
 extern rb_dlink_list user_list;
 extern rb_dlink_list oper_list;
 extern rb_dlink_list server_list;
@@ -33,8 +36,6 @@ struct client
 	struct service *service;
 	struct client *uplink;		/* server this is connected to */
 
-	rb_dlink_node nameptr;		/* rb_dlink_node in name_table */
-	rb_dlink_node uidptr;
 	rb_dlink_node listnode;		/* in client/server/exited_list */
 	rb_dlink_node upnode;		/* in uplinks servers/clients list */
 };
@@ -208,6 +209,7 @@ extern struct client *find_client(const char *name);
 extern struct client *find_named_client(const char *name);
 extern struct client *find_user(const char *name, int search_uid);
 extern struct client *find_uid(const char *name);
+extern size_t count_uid_memory(void);
 extern struct client *find_server(const char *name);
 extern struct client *find_service(const char *name);
 struct host_entry *find_host(const char *name);
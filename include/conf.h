@@ -12,6 +12,8 @@ struct client_oper;
 
 #define MAX_EMAIL_PROGRAM_ARGS		10
 
+#define MAX_REGEXP_THREADS		64
+
 extern time_t first_time;
 
 struct _config_file
@@ -27,6 +29,9 @@ struct _config_file
 
 	int reconnect_time;
 	int ping_time;
+	int flush_latency;
+	int direct_parse;
+	char *capture_file;
 	int ratbox;
 	int allow_stats_o;
 	int allow_sslonly;
@@ -50,6 +55,8 @@ struct _config_file
 	char *db_name;
 	char *db_username;
 	char *db_password;
+	int db_write_behind;
+	int db_write_behind_queue;
 
 	int disable_email;
 	char *email_program[MAX_EMAIL_PROGRAM_ARGS+1];
@@ -127,6 +134,7 @@ struct _config_file
 	int bs_max_xline_matches;
 	int bs_max_resv_matches;
 	int bs_max_regexp_matches;
+	int bs_regexp_threads;
 
 	/* watchserv */
 	int ws_merge_into_operserv;
@@ -145,6 +153,7 @@ struct _config_file
 	int cf_min_clients;
 	int cf_client_needs_ident;
 	int cf_client_needs_dns;
+	int cf_memory_store;
 };
 
 struct conf_server
@@ -159,6 +168,8 @@ struct conf_server
         time_t last_connect;
 };
 
+struct match_mask;
+
 struct conf_oper
 {
         char *name;
@@ -166,6 +177,9 @@ struct conf_oper
         char *host;
         char *pass;
 	char *server;
+	struct match_mask *username_mask;	/* compiled username, host, server */
+	struct match_mask *host_mask;
+	struct match_mask *server_mask;
 	unsigned long flags;		/* general flags */
 	uint64_t sflags;	/* individual service flags */
 	int refcount;
@@ -270,7 +284,8 @@ extern void free_conf_server(struct conf_server *conf_p);
 extern struct conf_server *find_conf_server(const char *name);
 
 extern struct conf_oper *find_conf_oper(const char *username, const char *host,
-					const char *server, const char *oper_username);
+					const char *ip, const char *server,
+					const char *oper_username);
 
 void store_client_oper(struct client *);
 void free_client_oper(struct client_oper *);
@@ -0,0 +1,65 @@
+/* $Id$ */
+#ifndef INCLUDED_hashtab_h
+#define INCLUDED_hashtab_h
+
+/* An open addressing (robin hood) hash table of named entries.  The
+ * slots hold the full hash value and a pointer to the entry's name
+ * alongside the entry itself, so most lookups never touch the entries
+ * they skip over.  The table doubles in size as it fills.
+ *
+ * Probing never wraps around, so walking the slots from the top down
+ * is safe against deleting the entry the walk is currently on.
+ */
+struct hashtab_slot
+{
+	unsigned int hashv;
+	const char *key;		/* must stay valid whilst added */
+	void *data;
+};
+
+struct hashtab
+{
+	struct hashtab_slot *slots;
+	unsigned int size;		/* number of home slots, a power of two */
+	unsigned int alloc;		/* size plus the overflow slots */
+	unsigned int count;
+	int (*cmp)(const char *, const char *);
+};
+
+extern struct hashtab *hashtab_create(unsigned int size,
+				int (*cmp)(const char *, const char *));
+extern void hashtab_destroy(struct hashtab *);
+extern unsigned int hashtab_hash(const char *key);
+extern void hashtab_add(struct hashtab *, const char *key, void *data);
+extern void *hashtab_find(struct hashtab *, const char *key);
+extern int hashtab_del(struct hashtab *, const char *key, void *data);
+
+extern size_t hashtab_total_memory(void);
+
+extern unsigned int hashtab_walk_start(struct hashtab *, unsigned int start);
+extern unsigned int hashtab_walk_stop(struct hashtab *, unsigned int start,
+					unsigned int max);
+
+#define hashtab_count(table)	((table)->count)
+#define hashtab_memory(table)	(sizeof(struct hashtab) + \
+				 sizeof(struct hashtab_slot) * (table)->alloc)
+
+/* Walks every entry in the table, the current entry may be deleted but
+ * nothing may be added.
+ */
+#define HASHTAB_WALK(i, entry, table) for(i = (table)->alloc; i-- > 0; ) \
+					{ if(((entry) = (table)->slots[i].data) == NULL) continue;
+#define HASHTAB_WALK_END }
+
+/* Walks up to max slots of the table, carrying on from where the last
+ * walk using start left off.
+ */
+#define HASHTAB_WALK_POS(i, start, max, entry, table)				\
+	for(i = hashtab_walk_start(table, start);				\
+	    i-- > hashtab_walk_stop(table, start, max); )			\
+	{ if(((entry) = (table)->slots[i].data) == NULL) continue;
+#define HASHTAB_WALK_POS_END(start, max, table)				\
+	}									\
+	start = hashtab_walk_stop(table, start, max)
+
+#endif
@@ -25,7 +25,9 @@
 #define HOOK_CLIENT_NICKCHANGE		26	/* client changes nick */
 #define HOOK_CLIENT_EXIT		28	/* client quits */
 /* HOOK_CLIENT_EXIT_SPLIT is called prior to HOOK_CLIENT_EXIT, but both are
- * called for a client that splits
+ * called for a client that splits.  Neither is called for the users that
+ * go with an exiting server, their channels are dealt with in one batch
+ * and HOOK_SERVER_EXIT_OPLESS is called instead.
  */
 #define HOOK_CLIENT_EXIT_SPLIT		29	/* client quits due to a split */
 
@@ -38,6 +40,10 @@
 #define HOOK_PROTO_SQUIT_UNKNOWN	36	/* squit an unknown server */
 
 #define HOOK_DBSYNC			38	/* services about to terminate */
+#define HOOK_SERVER_EXIT_OPLESS		39	/* channels left opless by an
+						 * exiting servers users, arg2
+						 * is the list of them
+						 */
 #define HOOK_LAST_HOOK			40
 
 typedef int (*hook_func)(void *, void *);
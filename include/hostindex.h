@@ -0,0 +1,52 @@
+/* $Id$ */
+#ifndef INCLUDED_hostindex_h
+#define INCLUDED_hostindex_h
+
+/* An index of masks on their host part.  CIDR hosts go in a radix tree,
+ * literal hosts and *.domain masks in hashtabs, and anything wilder on a
+ * list.  A lookup gives each entry that could match a host to a callback,
+ * which checks the rest of the mask.
+ */
+#define HOSTINDEX_HOST		1	/* literal host */
+#define HOSTINDEX_SUFFIX	2	/* *.domain, matches below the domain */
+#define HOSTINDEX_CIDR		3	/* ip/len, host has already matched */
+#define HOSTINDEX_OTHER		4	/* needs matching in full */
+
+/* initial size of the host and domain tables, they grow as needed */
+#define HOSTINDEX_HASH_SIZE	64
+
+struct hostindex_entry
+{
+	void *data;
+	int type;
+	unsigned long seq;		/* order it was added in */
+
+	void *where;			/* bucket or radix node its on */
+	rb_dlink_node ptr;
+};
+
+struct hostindex_node;
+
+struct hostindex
+{
+	struct hashtab *hosts;
+	struct hashtab *suffixes;	/* by domain, without the "*." */
+	struct hostindex_node *radix;
+	rb_dlink_list other;
+
+	unsigned long seq;
+	unsigned int count;
+};
+
+/* returns nonzero if the entry matches */
+typedef int (*hostindex_cb)(struct hostindex_entry *, void *arg);
+
+extern struct hostindex *hostindex_create(void);
+extern void hostindex_free(struct hostindex *);
+extern struct hostindex_entry *hostindex_add(struct hostindex *,
+				const char *host, void *data);
+extern void hostindex_del(struct hostindex *, struct hostindex_entry *);
+extern void *hostindex_find(struct hostindex *, const char *host,
+				const char *ip, hostindex_cb, void *arg);
+
+#endif
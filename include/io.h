@@ -31,6 +31,9 @@ struct lconn
 
 	buf_head_t lb_recvq;
 	buf_head_t lb_sendq;
+
+	char *recvbuf;			/* server lines parsed in place, see read_server() */
+	int recvlen;
 };
 
 extern struct lconn *server_p;
@@ -74,6 +77,7 @@ extern rb_dlink_list connection_list;
 /* server flags */
 #define CONN_FLAGS_EOB		0x02000
 #define CONN_FLAGS_SENTBURST	0x04000
+#define CONN_FLAGS_FLUSH	0x08000
 /* CONTINUES ... */
 
 #define SetConnSentBurst(x)	((x)->flags |= CONN_FLAGS_SENTBURST)
@@ -92,16 +96,30 @@ extern rb_dlink_list connection_list;
 #define SetUserChat(x)		((x)->flags |= CONN_FLAGS_CHAT)
 #define ClearUserChat(x)	((x)->flags &= ~CONN_FLAGS_CHAT)
 
+/* output to the uplink is only written once per loop, unless it
+ * builds up more than this
+ */
+#define FLUSH_MAX_SENDQ		65536
+
+/* size of the buffer server lines are read and parsed in */
+#define RECVBUF_SIZE		65536
+
+extern unsigned long server_write_calls;
+extern unsigned long server_write_lines;
+extern unsigned long server_write_bytes;
+
 extern void add_server_events(void);
 extern void signoff_server(struct lconn *);
 extern void signoff_client(struct lconn *);
 extern void connect_to_server(void *unused);
+extern void replay_server(const char *path);
 extern void connect_to_client(struct client *client_p, struct conf_oper *oper_p,
 				const char *host, int port);
 extern void connect_from_client(struct client *client_p, struct conf_oper *oper_p,
 				const char *servicenick);
 
 extern void PRINTFLIKE(1, 2) sendto_server(const char *format, ...);
+extern void sendto_server_buf(const char *buf, size_t len, unsigned int lines);
 extern void PRINTFLIKE(2, 3) sendto_one(struct lconn *, const char *format, ...);
 extern void PRINTFLIKE(1, 2) sendto_all(const char *format, ...);
 extern void PRINTFLIKE(2, 3) sendto_all_chat(struct lconn *, const char *format, ...);
@@ -0,0 +1,44 @@
+/* $Id$ */
+#ifndef INCLUDED_latency_h
+#define INCLUDED_latency_h
+
+/* histogram buckets, bucket n counts calls taking under 2^n usec, the
+ * last counts everything slower
+ */
+#define LATENCY_BUCKETS		20
+
+#define LATENCY_SCOMMAND	0	/* server commands */
+#define LATENCY_SERVICE		1	/* service commands */
+#define LATENCY_UCOMMAND	2	/* dcc commands */
+#define LATENCY_HOOK		3	/* hook_call() by hook id */
+#define LATENCY_EVENT		4	/* event callbacks */
+#define LATENCY_LAST		5
+
+struct lconn;
+struct client;
+
+struct latency_stat
+{
+	char *name;
+	unsigned long count;
+	unsigned long long total;	/* usec */
+	unsigned long max;		/* usec */
+	unsigned long hist[LATENCY_BUCKETS];
+	rb_dlink_node node;
+};
+
+extern struct latency_stat *latency_find(int type, const char *name);
+
+extern void latency_start(struct timespec *start);
+extern void latency_stop(struct latency_stat *stat, struct timespec *start);
+
+extern void latency_reset(void);
+extern void latency_show(struct client *client_p, struct lconn *conn_p);
+
+/* event callbacks added through these are timed */
+extern struct ev_entry *latency_event_add(const char *name, EVH *func, void *arg,
+						time_t when);
+extern struct ev_entry *latency_event_addonce(const char *name, EVH *func, void *arg,
+						time_t when);
+
+#endif
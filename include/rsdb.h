@@ -2,6 +2,9 @@
 #ifndef INCLUDED_rsdb_h
 #define INCLUDED_rsdb_h
 
+#define RSDB_MAXCOLS	30
+#define RSDB_MAXPARAMS	10
+
 typedef int (*rsdb_callback) (int, const char **);
 
 typedef enum rsdb_transtype
@@ -19,6 +22,58 @@ struct rsdb_table
 	void *arg;
 };
 
+/* a result set read one row at a time, see rsdb_cursor_open() */
+struct rsdb_cursor
+{
+	const char *row[RSDB_MAXCOLS+1];
+	int col_count;
+	int pos;
+	void *arg;
+};
+
+typedef enum rsdb_paramtype
+{
+	RSDB_PARAM_NONE,
+	RSDB_PARAM_INT,
+	RSDB_PARAM_STR
+}
+rsdb_paramtype;
+
+struct rsdb_param
+{
+	rsdb_paramtype type;
+	long long intval;
+	char *strval;
+};
+
+/* a prepared statement.  The sql uses '?' for each parameter, these are
+ * numbered from 1 when binding.
+ */
+struct rsdb_stmt
+{
+	rb_dlink_node node;
+	char *sql;
+	int param_count;
+	struct rsdb_param param[RSDB_MAXPARAMS];
+	void *handle;			/* backend statement */
+	unsigned long exec_count;
+};
+
+struct rsdb_stats
+{
+	int write_behind;		/* write behind thread running */
+	unsigned long queue_len;	/* statements currently queued */
+	unsigned long queue_max;	/* size of the queue */
+	unsigned long queue_peak;	/* most statements ever queued */
+	unsigned long queued;		/* statements handed to the thread */
+	unsigned long executed;		/* statements the thread completed */
+	unsigned long stalls;		/* times we waited for a full queue */
+	unsigned long syncs;		/* times a read waited for the queue */
+	unsigned long busy_retries;	/* SQLITE_BUSY retries in the thread */
+	unsigned long latency_max;	/* usec from queue to completion */
+	unsigned long long latency_total;
+};
+
 void rsdb_init(void);
 void rsdb_shutdown(void);
 
@@ -32,6 +87,27 @@ void rsdb_exec_insert(unsigned int *insert_id, const char *table_name,
 void rsdb_exec_fetch(struct rsdb_table *data, const char *format, ...);
 void rsdb_exec_fetch_end(struct rsdb_table *data);
 
+void rsdb_cursor_open(struct rsdb_cursor *cursor, const char *format, ...);
+const char **rsdb_cursor_next(struct rsdb_cursor *cursor);
+void rsdb_cursor_close(struct rsdb_cursor *cursor);
+
 void rsdb_transaction(rsdb_transtype type);
 
+void rsdb_get_stats(struct rsdb_stats *stats);
+
+/* rsdb.c */
+extern rb_dlink_list rsdb_stmt_list;
+
+struct rsdb_stmt *rsdb_stmt_declare(const char *sql);
+void rsdb_stmt_bind_int(struct rsdb_stmt *stmt, int pos, long long value);
+void rsdb_stmt_bind_str(struct rsdb_stmt *stmt, int pos, const char *value);
+void rsdb_stmt_bind_time(struct rsdb_stmt *stmt, int pos, time_t value);
+void rsdb_stmt_exec(struct rsdb_stmt *stmt, rsdb_callback cb);
+void rsdb_stmt_free_all(void);
+
+/* provided by each backend for rsdb.c */
+void rsdb_stmt_prepare(struct rsdb_stmt *stmt);
+void rsdb_stmt_execute(struct rsdb_stmt *stmt, rsdb_callback cb);
+void rsdb_stmt_finalise(struct rsdb_stmt *stmt);
+
 #endif
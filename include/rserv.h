@@ -36,6 +36,8 @@ void count_memory(struct client *);
 /* cidr.c */
 int match_ips(const char *s1, const char *s2);
 int match_cidr(const char *s1, const char *s2);
+int parse_ip(const char *ip, unsigned char *addr);
+int parse_cidr(const char *mask, unsigned char *addr, unsigned int *bits);
 
 /* snprintf.c */
 int rs_snprintf(char *, const size_t, const char *, ...);
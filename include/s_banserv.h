@@ -8,6 +8,12 @@
 #include <pcre.h>
 #endif
 
+/* shortest literal worth checking for before running a regexp */
+#define REGEXP_LITERAL_MIN	3
+
+/* fewest users each thread of a regexp sweep is given */
+#define REGEXP_SWEEP_SLICE	1024
+
 extern rb_dlink_list regexp_list;
 extern struct ev_entry *banserv_autosync_ev;
 
@@ -28,6 +34,66 @@ struct regexp_ban
 	struct regexp_ban *parent;
 
 	pcre *regexp;
+	pcre_extra *extra;		/* from pcre_study() */
+	char *literal;			/* required literal, see regexp_literal() */
+};
+
+/* initial size of the operban hashtab, it grows as needed */
+#define OPERBAN_HASH_SIZE	1024
+
+/* a row of operbans, which are all held in memory and written through to
+ * the database as they change
+ */
+struct operban
+{
+	char *key;			/* type followed by the lowercased mask */
+	char *reason;
+	char *operreason;
+	char *oper;
+
+	time_t hold;
+	time_t create_time;
+	int remove;
+
+	unsigned int heap_pos;		/* in the expiry heap, 0 if not held */
+};
+
+#define OPERBAN_TYPE(x)		((x)->key[0])
+#define OPERBAN_MASK(x)		((x)->key + 1)
+
+/* syncs are rendered into a buffer of this size, which is queued to the
+ * server whenever it fills
+ */
+#define OPERBAN_SYNC_BUF	65536
+
+/* an operban rendered for syncing, less the target and hold which are
+ * filled in as it is sent
+ */
+struct operban_line
+{
+	time_t hold;
+	int remove;
+
+	size_t offset;			/* of " mask :reason" in the burst */
+	unsigned int len;
+	unsigned int unban_len;		/* of just " mask" */
+};
+
+/* the rendered lines for every operban of one type */
+struct operban_burst
+{
+	char type;
+	const char *command;
+
+	char *buf;
+	size_t len;
+	size_t size;
+
+	struct operban_line *lines;
+	unsigned int count;
+	unsigned int alloc;
+
+	int dirty;			/* needs rebuilding from operban_table */
 };
 
 #endif
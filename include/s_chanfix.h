@@ -98,6 +98,17 @@ struct chanfix_score_item
 /* The time to wait between consecutive chanfix attempts (seconds). */
 #define CF_CHANFIX_FREQ	300
 
+/* The time between the start of consecutive scoring sweeps (seconds). */
+#define CF_SCORE_FREQ	300
+
+/* Scoring sweeps are spread over CF_SCORE_FREQ in slices run this
+ * often (seconds). */
+#define CF_SCORE_TICK	5
+
+/* The maximum time a single scoring slice may run for, the rest of the
+ * sweep is left to the following slices (microseconds). */
+#define CF_SCORE_TICK_BUDGET	20000
+
 /* Time to wait before removing channel modes during an autofix.
  * Expressed in seconds. */
 #define CF_REMOVE_MODES_TIME	(20 * 60)
@@ -2,8 +2,18 @@
 #ifndef INCLUDED_s_chanserv_h
 #define INCLUDED_s_chanserv_h
 
+/* initial size of the chan_reg hashtab, it grows as needed */
+#define CHAN_REG_HASH_SIZE	4096
+
+/* registrations with at least this many bans get an index of them by
+ * host, which is dropped again once they fall below half of it
+ */
+#define BAN_INDEX_MIN		16
+
 struct user_reg;
 struct chmode;
+struct ban_index;
+struct ban_bucket;
 extern struct ev_entry *chanserv_enforcetopic_ev;
 extern struct ev_entry *chanserv_expireban_ev;
 /* Flags stored in the DB: 0xFFFF */
@@ -50,10 +60,13 @@ struct chan_reg
 	time_t last_time;
 	unsigned long bants;
 
-	rb_dlink_node node;
-
 	rb_dlink_list users;
 	rb_dlink_list bans;
+	struct ban_index *ban_index;	/* see find_ban_reg_match() */
+
+	/* set whilst joins wait for the end of burst, see h_chanserv_join() */
+	int burst_join;
+	rb_dlink_node burstnode;
 };
 
 struct member_reg
@@ -72,16 +85,22 @@ struct member_reg
 	rb_dlink_node channode;
 };
 
+struct match_mask;
+
 struct ban_reg
 {
 	char *mask;
+	struct match_mask *cmask;	/* compiled mask */
 	char *reason;
 	char *username;
 	int level;
 	time_t hold;
 	int marked;
+	unsigned long seq;		/* higher is newer */
 
+	struct ban_bucket *bucket;	/* NULL when on the wild list */
 	rb_dlink_node channode;
+	rb_dlink_node indexnode;
 };
 
 #define CHAN_SUSPEND_EXPIRED(x) ((x)->flags & CS_FLAGS_SUSPENDED && (x)->suspend_time && \
@@ -2,7 +2,8 @@
 #ifndef INCLUDED_nickserv_h
 #define INCLUDED_nickserv_h
 
-#define MAX_NICK_REG_HASH	65536
+/* initial size of the nick_reg hashtab, it grows as needed */
+#define NICK_REG_HASH_SIZE	4096
 
 struct client;
 struct user_reg;
@@ -14,7 +15,6 @@ struct nick_reg
 	time_t reg_time;
 	time_t last_time;
 	int flags;
-	rb_dlink_node node;
 	rb_dlink_node usernode;
 };
 
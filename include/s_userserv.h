@@ -2,7 +2,8 @@
 #ifndef INCLUDED_s_userserv_h
 #define INCLUDED_s_userserv_h
 
-#define MAX_USER_REG_HASH	65536
+/* initial size of the user_reg hashtab, it grows as needed */
+#define USER_REG_HASH_SIZE	4096
 
 struct client;
 
@@ -24,7 +25,6 @@ struct user_reg
 
 	unsigned int language;
 
-	rb_dlink_node node;
 	rb_dlink_list channels;
 	rb_dlink_list users;
 	rb_dlink_list nicks;
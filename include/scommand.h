@@ -5,6 +5,7 @@
 #define MAX_SCOMMAND_HASH 100
 
 struct client;
+struct latency_stat;
 
 typedef void (*scommand_func)(struct client *, const char *parv[], int parc);
 
@@ -14,6 +15,7 @@ struct scommand_handler
 	scommand_func func;
 	int flags;
 	rb_dlink_list hooks;
+	struct latency_stat *latency;
 };
 
 #define FLAGS_UNKNOWN	0x0001
@@ -7,6 +7,7 @@ struct channel;
 struct lconn;
 struct ucommand_handler;
 struct cachefile;
+struct latency_stat;
 
 #define SCMD_WALK(i, svc) do { int m = svc->service->command_size / sizeof(struct service_command); \
 				for(i = 0; i < m; i++)
@@ -23,6 +24,7 @@ struct service_command
 	int userreg;
 	int operonly;
 	uint64_t operflags;
+	struct latency_stat *latency;
 };
 
 struct service_handler
@@ -44,9 +46,15 @@ struct service_handler
         void (*stats)(struct lconn *, const char **, int);
 };
 
+struct match_mask;
+struct hostindex_entry;
+
 struct service_ignore
 {
 	char *mask;
+	struct match_mask *cmask;	/* compiled mask */
+	struct match_mask *umask;	/* nick!user part, if its on a cidr */
+	struct hostindex_entry *hentry;
 	char *reason;
 	char *oper;
 
@@ -64,6 +72,9 @@ extern void rehash_help(void);
 
 void init_services(void);
 
+extern void add_ignore(struct service_ignore *ignore_p);
+extern void free_ignore(struct service_ignore *ignore_p);
+
 extern struct client *add_service();
 extern struct client *find_service_id(const char *name);
 extern void introduce_service(struct client *client_p);
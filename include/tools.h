@@ -17,6 +17,13 @@ time_t get_temp_time(const char *duration);
 extern const char *lcase(const char *);
 extern const char *ucase(const char *);
 
+/* slots in the direct command tables, the builtin server commands all
+ * get one to themselves at this size
+ */
+#define COMMAND_SLOTS	1024
+
+extern unsigned int command_slot(const char *command);
+
 extern const unsigned char ToLowerTab[];
 #define ToLower(c) (ToLowerTab[(unsigned char)(c)])
 extern const unsigned char ToUpperTab[];
@@ -54,6 +61,44 @@ extern const unsigned int CharAttrs[];
 #define IsEol(c) (CharAttrs[(unsigned char)(c)] & EOL_C)
 
 extern int match(const char *mask, const char *name);
+
+/* masks that are matched over and over can be compiled once, which
+ * sorts them by where their wildcards are and folds their case, so most
+ * can be matched with a memcmp() or two.
+ */
+#define MASK_NONE	0	/* empty, matches nothing */
+#define MASK_ANY	1	/* * */
+#define MASK_EXACT	2	/* abc */
+#define MASK_PREFIX	3	/* abc* */
+#define MASK_SUFFIX	4	/* *abc */
+#define MASK_INFIX	5	/* *abc* */
+#define MASK_GENERAL	6	/* a*b*c etc */
+
+struct match_mask
+{
+	char *mask;		/* collapsed and folded */
+	int type;
+	int qmark;		/* contains ?'s */
+	const char *lit;	/* the literal, or for MASK_GENERAL the last segment */
+	unsigned int len;	/* length of lit */
+	unsigned int minlen;	/* shortest name that can match */
+};
+
+/* a name folded once, to match against several compiled masks */
+#define MATCH_NAMELEN	512
+
+struct match_name
+{
+	char name[MATCH_NAMELEN];
+	unsigned int len;
+	const char *orig;	/* set if it was too long to fold */
+};
+
+extern struct match_mask *compile_mask(const char *mask);
+extern void free_mask(struct match_mask *);
+extern void fold_name(struct match_name *, const char *name);
+extern int match_mask_name(struct match_mask *, struct match_name *);
+extern int match_mask(struct match_mask *, const char *name);
 extern int irccmp(const char *s1, const char *s2);
 extern int ircncmp(const char *s1, const char *s2, int n);
 
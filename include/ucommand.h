@@ -7,6 +7,7 @@
 struct lconn;
 struct cachefile;
 struct client;
+struct latency_stat;
 
 extern rb_dlink_list ucommand_list;
 
@@ -18,6 +19,7 @@ struct ucommand_handler
 	unsigned int sflags;	/* services flags required */
 	int minpara;
         struct cachefile **helpfile;
+	struct latency_stat *latency;
 };
 
 extern void init_ucommand(void);
@@ -0,0 +1,479 @@
+/* src/acmatch.c
+ *   Contains code for matching many literals at once.
+ *
+ * Copyright (C) 2003-2012 ircd-ratbox development team
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1.Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * 2.Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * 3.The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id$
+ */
+#include "stdinc.h"
+#include "rserv.h"
+#include "tools.h"
+#include "acmatch.h"
+
+/* acmatch_create()
+ *   creates an empty automaton
+ */
+struct acmatch *
+acmatch_create(void)
+{
+	return rb_malloc(sizeof(struct acmatch));
+}
+
+/* acmatch_free()
+ *   frees an automaton and its literals
+ */
+void
+acmatch_free(struct acmatch *ac)
+{
+	struct acmatch_lit *lit_p;
+	rb_dlink_node *ptr, *next_ptr;
+
+	if(ac == NULL)
+		return;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, ac->lits.head)
+	{
+		lit_p = ptr->data;
+
+		rb_free(lit_p->lit);
+		rb_free(lit_p);
+	}
+
+	rb_free(ac->delta);
+	rb_free(ac->out);
+	rb_free(ac->dict);
+	rb_free(ac->table);
+	rb_free(ac);
+}
+
+/* acmatch_add()
+ *   adds a literal to an automaton that hasn't been built yet
+ *
+ * inputs	- automaton, non empty literal, id to mark when its found
+ * outputs	-
+ */
+void
+acmatch_add(struct acmatch *ac, const char *lit, unsigned int id)
+{
+	struct acmatch_lit *lit_p;
+	char *s;
+
+	if(EmptyString(lit))
+		return;
+
+	lit_p = rb_malloc(sizeof(struct acmatch_lit));
+	lit_p->lit = rb_strdup(lit);
+	lit_p->id = id;
+
+	for(s = lit_p->lit; *s; s++)
+		*s = ToLower(*s);
+
+	rb_dlinkAddTail(lit_p, &lit_p->ptr, &ac->lits);
+	ac->count++;
+}
+
+/* acmatch_build()
+ *   builds the automaton from the literals added
+ *
+ * Chars that appear in no literal share a single class, so the
+ * transition table is only as wide as the literals alphabet.  The
+ * transitions are filled in from the fail links, so scanning never
+ * has to follow them.
+ */
+void
+acmatch_build(struct acmatch *ac)
+{
+	struct acmatch_lit *lit_p;
+	rb_dlink_node *ptr;
+	const unsigned char *s;
+	unsigned int *fail;
+	unsigned int *queue;
+	unsigned int maxstates = 1;
+	unsigned int state, next, head, tail;
+	unsigned int i, c;
+	int k;
+
+	memset(ac->classmap, 0, sizeof(ac->classmap));
+	ac->nclass = 1;
+
+	RB_DLINK_FOREACH(ptr, ac->lits.head)
+	{
+		lit_p = ptr->data;
+
+		for(s = (const unsigned char *) lit_p->lit; *s; s++)
+		{
+			if(ac->classmap[*s] == 0)
+				ac->classmap[*s] = ac->nclass++;
+
+			maxstates++;
+		}
+	}
+
+	/* the literals are folded already, so fold the rest onto them */
+	for(c = 0; c < 256; c++)
+		ac->classmap[c] = ac->classmap[(unsigned char) ToLower(c)];
+
+	ac->delta = rb_malloc(sizeof(unsigned int) * maxstates * ac->nclass);
+	ac->out = rb_malloc(sizeof(int) * maxstates);
+	ac->dict = rb_malloc(sizeof(unsigned int) * maxstates);
+	ac->table = rb_malloc(sizeof(struct acmatch_lit *) * (ac->count + 1));
+
+	for(i = 0; i < maxstates; i++)
+		ac->out[i] = -1;
+
+	/* build the trie, state 0 is the root and nothing leads back to it
+	 * yet, so 0 means no transition
+	 */
+	ac->nstates = 1;
+	k = 0;
+
+	RB_DLINK_FOREACH(ptr, ac->lits.head)
+	{
+		lit_p = ptr->data;
+		state = 0;
+
+		for(s = (const unsigned char *) lit_p->lit; *s; s++)
+		{
+			i = state * ac->nclass + ac->classmap[*s];
+
+			if(ac->delta[i] == 0)
+				ac->delta[i] = ac->nstates++;
+
+			state = ac->delta[i];
+		}
+
+		lit_p->next = ac->out[state];
+		ac->out[state] = k;
+		ac->table[k++] = lit_p;
+	}
+
+	/* then breadth first, fill in the fail transitions and dictionary
+	 * links from the shallower states
+	 */
+	fail = rb_malloc(sizeof(unsigned int) * ac->nstates);
+	queue = rb_malloc(sizeof(unsigned int) * ac->nstates);
+	head = tail = 0;
+
+	for(c = 0; c < ac->nclass; c++)
+	{
+		if((next = ac->delta[c]) != 0)
+			queue[tail++] = next;
+	}
+
+	while(head < tail)
+	{
+		state = queue[head++];
+
+		for(c = 0; c < ac->nclass; c++)
+		{
+			i = state * ac->nclass + c;
+
+			if((next = ac->delta[i]) == 0)
+			{
+				ac->delta[i] = ac->delta[fail[state] * ac->nclass + c];
+				continue;
+			}
+
+			fail[next] = ac->delta[fail[state] * ac->nclass + c];
+			ac->dict[next] = (ac->out[fail[next]] != -1) ?
+						fail[next] : ac->dict[fail[next]];
+			queue[tail++] = next;
+		}
+	}
+
+	rb_free(fail);
+	rb_free(queue);
+}
+
+/* acmatch_scan()
+ *   scans text for the literals of an automaton
+ *
+ * inputs	- built automaton, text and its length, array indexed by
+ *		  literal id, value to set for the literals found
+ * outputs	-
+ */
+void
+acmatch_scan(struct acmatch *ac, const char *text, size_t len,
+		unsigned int *marks, unsigned int mark)
+{
+	const unsigned char *s = (const unsigned char *) text;
+	unsigned int state = 0;
+	unsigned int t;
+	int k;
+
+	if(ac->count == 0)
+		return;
+
+	while(len--)
+	{
+		state = ac->delta[state * ac->nclass + ac->classmap[*s++]];
+
+		for(t = (ac->out[state] != -1) ? state : ac->dict[state]; t; t = ac->dict[t])
+		{
+			for(k = ac->out[t]; k != -1; k = ac->table[k]->next)
+				marks[ac->table[k]->id] = mark;
+		}
+	}
+}
+
+/* regexp_skip_class()
+ *   skips over a [] character class
+ *
+ * inputs	- pointer to the '['
+ * outputs	- pointer after the ']', or NULL if theres no end to it
+ */
+static const char *
+regexp_skip_class(const char *p)
+{
+	const char *q;
+
+	p++;
+
+	if(*p == '^')
+		p++;
+
+	/* a ']' first is part of the class */
+	if(*p == ']')
+		p++;
+
+	while(*p && *p != ']')
+	{
+		if(*p == '\\' && p[1] != '\0')
+		{
+			p += 2;
+			continue;
+		}
+
+		/* [:alpha:] etc, otherwise the '[' is just a char */
+		if(*p == '[' && p[1] == ':')
+		{
+			q = p + 2;
+
+			if(*q == '^')
+				q++;
+
+			while(IsAlpha(*q))
+				q++;
+
+			if(*q == ':' && q[1] == ']')
+			{
+				p = q + 2;
+				continue;
+			}
+		}
+
+		p++;
+	}
+
+	return (*p == ']') ? p + 1 : NULL;
+}
+
+/* regexp_skip_group()
+ *   skips over a () group, and everything nested inside it
+ *
+ * inputs	- pointer to the '('
+ * outputs	- pointer after the ')', or NULL if theres no end to it
+ */
+static const char *
+regexp_skip_group(const char *p)
+{
+	int depth = 0;
+
+	while(*p)
+	{
+		if(*p == '\\')
+		{
+			if(p[1] == '\0')
+				return NULL;
+
+			p += 2;
+			continue;
+		}
+
+		if(*p == '[')
+		{
+			if((p = regexp_skip_class(p)) == NULL)
+				return NULL;
+
+			continue;
+		}
+
+		if(*p == '(')
+			depth++;
+		else if(*p == ')' && --depth == 0)
+			return p + 1;
+
+		p++;
+	}
+
+	return NULL;
+}
+
+/* regexp_literal()
+ *   finds the longest run of literal characters every match of a regexp
+ *   must contain.  Only the top level of the regexp is looked at, and
+ *   anything it doesn't understand means there is no literal, so the
+ *   regexp is always run.
+ *
+ * inputs	- regexp, shortest literal worth checking for first
+ * outputs	- literal to be freed, or NULL if there isn't one that long
+ */
+char *
+regexp_literal(const char *regexp, unsigned int minlen)
+{
+	char best[BUFSIZE];
+	char run[BUFSIZE];
+	const char *p;
+	const char *q;
+	size_t bestlen = 0;
+	size_t runlen = 0;
+
+	if(strlen(regexp) >= BUFSIZE)
+		return NULL;
+
+	/* things that change what the rest of the pattern means: quoting,
+	 * comments, verbs and extended mode
+	 */
+	if(strstr(regexp, "\\Q") || strstr(regexp, "(?#") || strstr(regexp, "(*"))
+		return NULL;
+
+	for(p = regexp; (p = strstr(p, "(?")) != NULL; p += 2)
+	{
+		for(q = p + 2; IsAlpha(*q) || *q == '-'; q++)
+		{
+			if(*q == 'x')
+				return NULL;
+		}
+	}
+
+	p = regexp;
+
+	while(*p)
+	{
+		switch(*p)
+		{
+		/* alternation means nothing is required */
+		case '|':
+		case ')':
+			return NULL;
+
+		/* the last literal is optional */
+		case '*':
+		case '?':
+		case '{':
+			if(runlen)
+				runlen--;
+
+			/* fall through */
+
+		/* the last literal is required, but what follows may not
+		 * come straight after it
+		 */
+		case '+':
+		case '.':
+		case '^':
+		case '$':
+			if(runlen > bestlen)
+			{
+				memcpy(best, run, runlen);
+				bestlen = runlen;
+			}
+
+			runlen = 0;
+
+			if(*p == '{' && IsDigit(p[1]) && (q = strchr(p, '}')) != NULL)
+				p = q;
+
+			p++;
+			continue;
+
+		case '[':
+		case '(':
+			if(runlen > bestlen)
+			{
+				memcpy(best, run, runlen);
+				bestlen = runlen;
+			}
+
+			runlen = 0;
+
+			if(*p == '[')
+				p = regexp_skip_class(p);
+			else
+				p = regexp_skip_group(p);
+
+			if(p == NULL)
+				return NULL;
+
+			continue;
+
+		case '\\':
+			/* \d, \s etc are fine, other letter escapes may
+			 * be anything
+			 */
+			if(IsAlNum(p[1]))
+			{
+				if(strchr("dDwWsSbBAZzG", p[1]) == NULL)
+					return NULL;
+
+				if(runlen > bestlen)
+				{
+					memcpy(best, run, runlen);
+					bestlen = runlen;
+				}
+
+				runlen = 0;
+				p += 2;
+				continue;
+			}
+
+			if(p[1] == '\0')
+				return NULL;
+
+			p++;
+			break;
+
+		default:
+			break;
+		}
+
+		run[runlen++] = ToLower(*p);
+		p++;
+	}
+
+	if(runlen > bestlen)
+	{
+		memcpy(best, run, runlen);
+		bestlen = runlen;
+	}
+
+	if(bestlen < minlen)
+		return NULL;
+
+	best[bestlen] = '\0';
+	return rb_strdup(best);
+}
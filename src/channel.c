@@ -43,8 +43,9 @@
 #include "hook.h"
 #include "modebuild.h"
 #include "tools.h"
+#include "hashtab.h"
 
-static rb_dlink_list channel_table[MAX_CHANNEL_TABLE];
+static struct hashtab *channel_table;
 rb_dlink_list channel_list;
 
 static rb_bh *channel_heap;
@@ -91,6 +92,8 @@ init_channel(void)
         channel_heap = rb_bh_create(sizeof(struct channel), HEAP_CHANNEL, "Channel");
         chmember_heap = rb_bh_create(sizeof(struct chmember), HEAP_CHMEMBER, "Channel Member");
 
+	channel_table = hashtab_create(CHANNEL_HASH_SIZE, irccmp);
+
 	add_scommand_handler(&join_command);
 	add_scommand_handler(&kick_command);
 	add_scommand_handler(&part_command);
@@ -140,8 +143,7 @@ valid_chname(const char *name)
 void
 add_channel(struct channel *chptr)
 {
-	unsigned int hashv = hash_channel(chptr->name);
-	rb_dlinkAdd(chptr, &chptr->nameptr, &channel_table[hashv]);
+	hashtab_add(channel_table, chptr->name, chptr);
 	rb_dlinkAdd(chptr, &chptr->listptr, &channel_list);
 }
 
@@ -154,8 +156,7 @@ add_channel(struct channel *chptr)
 void
 del_channel(struct channel *chptr)
 {
-	unsigned int hashv = hash_channel(chptr->name);
-	rb_dlinkDelete(&chptr->nameptr, &channel_table[hashv]);
+	hashtab_del(channel_table, chptr->name, chptr);
 	rb_dlinkDelete(&chptr->listptr, &channel_list);
 }
 
@@ -168,19 +169,7 @@ del_channel(struct channel *chptr)
 struct channel *
 find_channel(const char *name)
 {
-	struct channel *chptr;
-	rb_dlink_node *ptr;
-	unsigned int hashv = hash_channel(name);
-
-	RB_DLINK_FOREACH(ptr, channel_table[hashv].head)
-	{
-		chptr = ptr->data;
-
-		if(!irccmp(chptr->name, name))
-			return chptr;
-	}
-
-	return NULL;
+	return hashtab_find(channel_table, name);
 }
 
 /* free_channel()
@@ -199,9 +188,49 @@ free_channel(struct channel *chptr)
 
 	del_channel(chptr);
 
+	rb_free(chptr->member_hash);
+
 	rb_bh_free(channel_heap, chptr);
 }
 
+static unsigned int
+hash_chmember(struct channel *chptr, struct client *target_p)
+{
+	unsigned long h = (unsigned long) target_p;
+
+	return ((h >> 4) * 2654435761U) & (chptr->member_hash_size - 1);
+}
+
+/* build_member_hash()
+ *   (re)builds the hash of a channels members
+ *
+ * inputs	- channel, number of buckets (a power of two), or 0 to
+ *		  remove the hash
+ * outputs	-
+ */
+static void
+build_member_hash(struct channel *chptr, unsigned int size)
+{
+	struct chmember *mptr;
+	rb_dlink_node *ptr;
+
+	rb_free(chptr->member_hash);
+	chptr->member_hash = NULL;
+	chptr->member_hash_size = size;
+
+	if(size == 0)
+		return;
+
+	chptr->member_hash = rb_malloc(sizeof(rb_dlink_list) * size);
+
+	RB_DLINK_FOREACH(ptr, chptr->users.head)
+	{
+		mptr = ptr->data;
+		rb_dlinkAdd(mptr, &mptr->hashnode,
+			&chptr->member_hash[hash_chmember(chptr, mptr->client_p)]);
+	}
+}
+
 /* add_chmember()
  *   adds a given client to a given channel with given flags
  *
@@ -227,6 +256,18 @@ add_chmember(struct channel *chptr, struct client *target_p, int flags)
 	else
 		rb_dlinkAdd(mptr, &mptr->choppednode, &chptr->users_unopped);
 
+	/* keep the member hash at no more than one member per bucket */
+	if(chptr->member_hash != NULL)
+	{
+		if(rb_dlink_list_length(&chptr->users) > chptr->member_hash_size)
+			build_member_hash(chptr, chptr->member_hash_size * 2);
+		else
+			rb_dlinkAdd(mptr, &mptr->hashnode,
+				&chptr->member_hash[hash_chmember(chptr, target_p)]);
+	}
+	else if(rb_dlink_list_length(&chptr->users) >= CHMEMBER_HASH_MIN)
+		build_member_hash(chptr, CHMEMBER_HASH_MIN * 2);
+
 	return mptr;
 }
 
@@ -251,6 +292,15 @@ del_chmember(struct chmember *mptr)
 	rb_dlinkDelete(&mptr->chnode, &chptr->users);
 	rb_dlinkDelete(&mptr->usernode, &client_p->user->channels);
 
+	if(chptr->member_hash != NULL)
+	{
+		if(rb_dlink_list_length(&chptr->users) < CHMEMBER_HASH_MIN / 2)
+			build_member_hash(chptr, 0);
+		else
+			rb_dlinkDelete(&mptr->hashnode,
+				&chptr->member_hash[hash_chmember(chptr, client_p)]);
+	}
+
 	if(is_opped(mptr))
 	{
 		rb_dlinkDelete(&mptr->choppednode, &chptr->users_opped);
@@ -267,6 +317,103 @@ del_chmember(struct chmember *mptr)
 	rb_bh_free(chmember_heap, mptr);
 }
 
+/* del_chmembers_split()
+ *   removes every channel membership of an exiting servers users.  The
+ *   channels they were in are only looked at once they're all gone, so
+ *   each is destroyed, rehashed or found opless once, rather than as
+ *   each user leaves.  HOOK_CHANNEL_OPLESS is replaced by a single
+ *   HOOK_SERVER_EXIT_OPLESS with every channel that lost its last op.
+ *
+ * inputs	- server exiting, list of its users
+ * outputs	-
+ */
+void
+del_chmembers_split(struct client *client_p, rb_dlink_list *users)
+{
+	rb_dlink_list touched = { NULL, NULL, 0 };
+	rb_dlink_list opless = { NULL, NULL, 0 };
+	struct channel *chptr;
+	struct chmember *mptr;
+	struct client *target_p;
+	rb_dlink_node *ptr;
+	rb_dlink_node *mnode;
+	rb_dlink_node *next_ptr;
+
+	RB_DLINK_FOREACH(ptr, users->head)
+	{
+		target_p = ptr->data;
+
+		RB_DLINK_FOREACH_SAFE(mnode, next_ptr, target_p->user->channels.head)
+		{
+			mptr = mnode->data;
+			chptr = mptr->chptr;
+
+			if(!(chptr->split_flags & CHANNEL_SPLIT_TOUCHED))
+			{
+				chptr->split_flags = CHANNEL_SPLIT_TOUCHED;
+				rb_dlinkAdd(chptr, &chptr->splitnode, &touched);
+			}
+
+			rb_dlinkDelete(&mptr->chnode, &chptr->users);
+
+			if(chptr->member_hash != NULL)
+				rb_dlinkDelete(&mptr->hashnode,
+					&chptr->member_hash[hash_chmember(chptr, target_p)]);
+
+			if(is_opped(mptr))
+			{
+				rb_dlinkDelete(&mptr->choppednode, &chptr->users_opped);
+				chptr->split_flags |= CHANNEL_SPLIT_DEOPPED;
+			}
+			else
+				rb_dlinkDelete(&mptr->choppednode, &chptr->users_unopped);
+
+			rb_bh_free(chmember_heap, mptr);
+		}
+
+		target_p->user->channels.head = target_p->user->channels.tail = NULL;
+		target_p->user->channels.length = 0;
+	}
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, touched.head)
+	{
+		chptr = ptr->data;
+
+		if(rb_dlink_list_length(&chptr->users) == 0 &&
+		   rb_dlink_list_length(&chptr->services) == 0)
+		{
+			rb_dlinkDelete(ptr, &touched);
+			free_channel(chptr);
+			continue;
+		}
+
+		if(chptr->member_hash != NULL &&
+		   rb_dlink_list_length(&chptr->users) < CHMEMBER_HASH_MIN / 2)
+			build_member_hash(chptr, 0);
+
+		if((chptr->split_flags & CHANNEL_SPLIT_DEOPPED) &&
+		   rb_dlink_list_length(&chptr->users_opped) == 0)
+			rb_dlinkMoveNode(ptr, &touched, &opless);
+		else
+		{
+			rb_dlinkDelete(ptr, &touched);
+			chptr->split_flags = 0;
+		}
+	}
+
+	if(rb_dlink_list_length(&opless) == 0)
+		return;
+
+	hook_call(HOOK_SERVER_EXIT_OPLESS, client_p, &opless);
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, opless.head)
+	{
+		chptr = ptr->data;
+		rb_dlinkDelete(ptr, &opless);
+		chptr->split_flags = 0;
+	}
+}
+
 /* find_chmember()
  *   hunts for a chmember struct for the given user in given channel
  *
@@ -279,6 +426,18 @@ find_chmember(struct channel *chptr, struct client *target_p)
 	struct chmember *mptr;
 	rb_dlink_node *ptr;
 
+	if(chptr->member_hash != NULL)
+	{
+		RB_DLINK_FOREACH(ptr, chptr->member_hash[hash_chmember(chptr, target_p)].head)
+		{
+			mptr = ptr->data;
+			if(mptr->client_p == target_p)
+				return mptr;
+		}
+
+		return NULL;
+	}
+
 	if (rb_dlink_list_length(&chptr->users) < rb_dlink_list_length(&target_p->user->channels))
 	{
 		RB_DLINK_FOREACH(ptr, chptr->users.head)
@@ -375,3 +375,69 @@ match_cidr(const char *s1, const char *s2)
 		return 1;
 }
 
+
+/* parse_ip()
+ *
+ * Input - address, buffer of IN6ADDRSZ bytes
+ * Output - 1 if the address was parsed, IPv4 addresses are stored mapped
+ *          into IPv6 (::ffff:a.b.c.d) so both can be compared bitwise
+ */
+int
+parse_ip(const char *ip, unsigned char *addr)
+{
+	if (EmptyString(ip))
+		return 0;
+
+	if (strchr(ip, ':'))
+		return inet_pton6(ip, addr);
+
+	if (!inet_pton4(ip, addr + 12))
+		return 0;
+
+	memset(addr, 0, 10);
+	addr[10] = addr[11] = 0xff;
+	return 1;
+}
+
+/* parse_cidr()
+ *
+ * Input - ip/len mask, buffer of IN6ADDRSZ bytes, where to put the length
+ * Output - 1 if the mask was parsed, as for parse_ip() with the bits
+ *          past the length cleared and IPv4 lengths offset by 96
+ */
+int
+parse_cidr(const char *mask, unsigned char *addr, unsigned int *bits)
+{
+	char ipmask[BUFSIZE];
+	char *len;
+	int cidrlen;
+	int i;
+
+	rb_strlcpy(ipmask, mask, sizeof ipmask);
+
+	len = strrchr(ipmask, '/');
+	if (len == NULL)
+		return 0;
+
+	*len++ = '\0';
+
+	if (!IsDigit(*len))
+		return 0;
+
+	/* /0 never matches in match_ips(), so dont treat it as a cidr */
+	cidrlen = atoi(len);
+	if (cidrlen == 0 || cidrlen > (strchr(ipmask, ':') ? 128 : 32))
+		return 0;
+
+	if (!parse_ip(ipmask, addr))
+		return 0;
+
+	if (!strchr(ipmask, ':'))
+		cidrlen += 96;
+
+	for (i = cidrlen; i < IN6ADDRSZ * 8; i++)
+		addr[i / 8] &= ~(0x80 >> (i % 8));
+
+	*bits = cidrlen;
+	return 1;
+}
@@ -45,11 +45,46 @@
 #include "s_userserv.h"
 #include "conf.h"
 #include "tools.h"
+#include "hashtab.h"
+#include "latency.h"
 
-static rb_dlink_list name_table[MAX_NAME_HASH];
-static rb_dlink_list uid_table[MAX_NAME_HASH];
+static struct hashtab *name_table;
 static rb_dlink_list host_table[MAX_HOST_HASH];
 
+/* UIDs are indexed directly rather than hashed.  Each SID has a slot in
+ * uid_table, holding the server itself and a three level radix of its
+ * users, indexed two characters of the UID suffix at a time.
+ */
+#define UID_CHARS	36
+#define UID_PAGE	(UID_CHARS * UID_CHARS)
+#define MAX_SID_SLOT	(10 * UID_PAGE)
+
+#define UID_NONE	0
+#define UID_SID		1
+#define UID_USER	2
+
+struct uid_leaf
+{
+	struct client *client[UID_PAGE];
+	unsigned int count;
+};
+
+struct uid_mid
+{
+	struct uid_leaf *leaf[UID_PAGE];
+	unsigned int count;
+};
+
+struct uid_sid
+{
+	struct client *server;
+	struct uid_mid *mid[UID_PAGE];
+	unsigned int count;
+};
+
+static struct uid_sid *uid_table[MAX_SID_SLOT];
+static size_t uid_memory;
+
 rb_dlink_list user_list;
 rb_dlink_list oper_list;
 rb_dlink_list server_list;
@@ -89,7 +124,9 @@ init_client(void)
         server_heap = rb_bh_create(sizeof(struct server), HEAP_SERVER, "Server");
 	host_heap = rb_bh_create(sizeof(struct host_entry), HEAP_HOST, "Hostname");
 
-	rb_event_add("cleanup_host_table", cleanup_host_table, NULL, 3600);
+	name_table = hashtab_create(CLIENT_HASH_SIZE, irccmp);
+
+	latency_event_add("cleanup_host_table", cleanup_host_table, NULL, 3600);
 
 	add_scommand_handler(&kill_command);
 	add_scommand_handler(&nick_command);
@@ -132,6 +169,208 @@ hash_host(const char *p)
 	return (h & (MAX_HOST_HASH - 1));
 }
 
+static int
+uid_value(char c)
+{
+	if(c >= 'A' && c <= 'Z')
+		return c - 'A';
+	else if(c >= 'a' && c <= 'z')
+		return c - 'a';
+	else if(c >= '0' && c <= '9')
+		return c - '0' + 26;
+
+	return -1;
+}
+
+static int
+uid_pair(const char *p)
+{
+	int hi = uid_value(p[0]);
+	int lo = uid_value(p[1]);
+
+	if(hi < 0 || lo < 0)
+		return -1;
+
+	return hi * UID_CHARS + lo;
+}
+
+/* uid_index()
+ *   works out where a SID or UID lives in uid_table
+ *
+ * inputs	- uid, array of 4 indexes to fill in: the SID slot, then
+ *		  the three levels of the radix
+ * outputs	- UID_SID, UID_USER, or UID_NONE if its neither
+ */
+static int
+uid_index(const char *uid, int *idx)
+{
+	int i;
+
+	if(!IsDigit(uid[0]) || (idx[0] = uid_pair(uid + 1)) < 0)
+		return UID_NONE;
+
+	idx[0] += (uid[0] - '0') * UID_PAGE;
+
+	if(uid[3] == '\0')
+		return UID_SID;
+
+	for(i = 1; i < 4; i++)
+	{
+		if(uid[i*2+1] == '\0' || (idx[i] = uid_pair(uid + i*2 + 1)) < 0)
+			return UID_NONE;
+	}
+
+	if(uid[UIDLEN] != '\0')
+		return UID_NONE;
+
+	return UID_USER;
+}
+
+static void
+add_uid(struct client *target_p)
+{
+	struct uid_sid *sid_p;
+	struct uid_mid *mid_p;
+	struct uid_leaf *leaf_p;
+	int idx[4];
+	int type;
+
+	if((type = uid_index(target_p->uid, idx)) == UID_NONE)
+		return;
+
+	if((sid_p = uid_table[idx[0]]) == NULL)
+	{
+		sid_p = uid_table[idx[0]] = rb_malloc(sizeof(struct uid_sid));
+		uid_memory += sizeof(struct uid_sid);
+	}
+
+	if(type == UID_SID)
+	{
+		sid_p->server = target_p;
+		return;
+	}
+
+	if((mid_p = sid_p->mid[idx[1]]) == NULL)
+	{
+		mid_p = sid_p->mid[idx[1]] = rb_malloc(sizeof(struct uid_mid));
+		uid_memory += sizeof(struct uid_mid);
+		sid_p->count++;
+	}
+
+	if((leaf_p = mid_p->leaf[idx[2]]) == NULL)
+	{
+		leaf_p = mid_p->leaf[idx[2]] = rb_malloc(sizeof(struct uid_leaf));
+		uid_memory += sizeof(struct uid_leaf);
+		mid_p->count++;
+	}
+
+	if(leaf_p->client[idx[3]] == NULL)
+		leaf_p->count++;
+
+	leaf_p->client[idx[3]] = target_p;
+}
+
+static void
+del_uid(struct client *target_p)
+{
+	struct uid_sid *sid_p;
+	struct uid_mid *mid_p;
+	struct uid_leaf *leaf_p;
+	int idx[4];
+	int type;
+
+	if((type = uid_index(target_p->uid, idx)) == UID_NONE ||
+	   (sid_p = uid_table[idx[0]]) == NULL)
+		return;
+
+	if(type == UID_SID)
+	{
+		if(sid_p->server == target_p)
+			sid_p->server = NULL;
+	}
+	else
+	{
+		if((mid_p = sid_p->mid[idx[1]]) == NULL ||
+		   (leaf_p = mid_p->leaf[idx[2]]) == NULL ||
+		   leaf_p->client[idx[3]] != target_p)
+			return;
+
+		leaf_p->client[idx[3]] = NULL;
+
+		if(--leaf_p->count == 0)
+		{
+			rb_free(leaf_p);
+			mid_p->leaf[idx[2]] = NULL;
+			uid_memory -= sizeof(struct uid_leaf);
+
+			if(--mid_p->count == 0)
+			{
+				rb_free(mid_p);
+				sid_p->mid[idx[1]] = NULL;
+				uid_memory -= sizeof(struct uid_mid);
+				sid_p->count--;
+			}
+		}
+	}
+
+	if(sid_p->server == NULL && sid_p->count == 0)
+	{
+		rb_free(sid_p);
+		uid_table[idx[0]] = NULL;
+		uid_memory -= sizeof(struct uid_sid);
+	}
+}
+
+/* drop_uid_server()
+ *   drops a servers slot from uid_table, along with all its users, so
+ *   they needn't be removed one at a time as it splits
+ */
+static void
+drop_uid_server(struct client *target_p)
+{
+	struct uid_sid *sid_p;
+	struct uid_mid *mid_p;
+	int idx[4];
+	int i, j;
+
+	if(uid_index(target_p->uid, idx) != UID_SID ||
+	   (sid_p = uid_table[idx[0]]) == NULL || sid_p->server != target_p)
+		return;
+
+	for(i = 0; i < UID_PAGE && sid_p->count; i++)
+	{
+		if((mid_p = sid_p->mid[i]) == NULL)
+			continue;
+
+		for(j = 0; j < UID_PAGE && mid_p->count; j++)
+		{
+			if(mid_p->leaf[j] == NULL)
+				continue;
+
+			rb_free(mid_p->leaf[j]);
+			uid_memory -= sizeof(struct uid_leaf);
+			mid_p->count--;
+		}
+
+		rb_free(mid_p);
+		uid_memory -= sizeof(struct uid_mid);
+		sid_p->count--;
+	}
+
+	rb_free(sid_p);
+	uid_table[idx[0]] = NULL;
+	uid_memory -= sizeof(struct uid_sid);
+}
+
+/* count_uid_memory()
+ *   returns the memory used by uid_table
+ */
+size_t
+count_uid_memory(void)
+{
+	return sizeof(uid_table) + uid_memory;
+}
+
 /* add_client()
  *   adds a client to the hashtable
  *
@@ -141,14 +380,10 @@ hash_host(const char *p)
 void
 add_client(struct client *target_p)
 {
-	unsigned int hashv = hash_name(target_p->name);
-	rb_dlinkAdd(target_p, &target_p->nameptr, &name_table[hashv]);
+	hashtab_add(name_table, target_p->name, target_p);
 
 	if(!EmptyString(target_p->uid))
-	{
-		hashv = hash_name(target_p->uid);
-		rb_dlinkAdd(target_p, &target_p->uidptr, &uid_table[hashv]);
-	}
+		add_uid(target_p);
 }
 
 /* del_client()
@@ -160,14 +395,10 @@ add_client(struct client *target_p)
 void
 del_client(struct client *target_p)
 {
-	unsigned int hashv = hash_name(target_p->name);
-	rb_dlinkDelete(&target_p->nameptr, &name_table[hashv]);
+	hashtab_del(name_table, target_p->name, target_p);
 
 	if(!EmptyString(target_p->uid))
-	{
-		hashv = hash_name(target_p->uid);
-		rb_dlinkDelete(&target_p->uidptr, &uid_table[hashv]);
-	}
+		del_uid(target_p);
 }
 
 /* find_client()
@@ -180,8 +411,6 @@ struct client *
 find_client(const char *name)
 {
 	struct client *target_p;
-	rb_dlink_node *ptr;
-	unsigned int hashv;
 
 	if(IsDigit(*name))
 	{
@@ -194,52 +423,41 @@ find_client(const char *name)
 	/* search nicks even if its a uid, as it may be possible for a uid
 	 * to be a nick in the future
 	 */
-	hashv = hash_name(name);
-
-	RB_DLINK_FOREACH(ptr, name_table[hashv].head)
-	{
-		target_p = ptr->data;
-
-		if(!irccmp(target_p->name, name))
-			return target_p;
-	}
-
-	return NULL;
+	return hashtab_find(name_table, name);
 }
 
 struct client *
 find_named_client(const char *name)
 {
-	struct client *target_p;
-	rb_dlink_node *ptr;
-	unsigned int hashv; 
-
-	hashv = hash_name(name);
-
-	RB_DLINK_FOREACH(ptr, name_table[hashv].head)
-	{
-		target_p = ptr->data;
-
-		if(!irccmp(target_p->name, name))
-			return target_p;
-	}
-
-	return NULL;
+	return hashtab_find(name_table, name);
 }
 
 struct client *
 find_uid(const char *name)
 {
-	struct client *target_p;
-	rb_dlink_node *ptr;
-	unsigned int hashv = hash_name(name);
+	struct uid_sid *sid_p;
+	struct uid_mid *mid_p;
+	struct uid_leaf *leaf_p;
+	int idx[4];
 
-	RB_DLINK_FOREACH(ptr, uid_table[hashv].head)
+	switch(uid_index(name, idx))
 	{
-		target_p = ptr->data;
+		case UID_SID:
+			if((sid_p = uid_table[idx[0]]) == NULL)
+				return NULL;
 
-		if(!irccmp(target_p->uid, name))
-			return target_p;
+			return sid_p->server;
+
+		case UID_USER:
+			if((sid_p = uid_table[idx[0]]) == NULL ||
+			   (mid_p = sid_p->mid[idx[1]]) == NULL ||
+			   (leaf_p = mid_p->leaf[idx[2]]) == NULL)
+				return NULL;
+
+			return leaf_p->client[idx[3]];
+
+		default:
+			break;
 	}
 
 	return NULL;
@@ -451,6 +669,67 @@ exit_user(struct client *target_p, int split)
 	rb_dlinkDelete(&target_p->upnode, &target_p->uplink->server->users);
 }
 
+/* exit_server_users()
+ *   exits all the users on a server in one batch.  HOOK_CLIENT_EXIT_SPLIT
+ *   and HOOK_CLIENT_EXIT aren't called for each, the channels they leave
+ *   opless are given to HOOK_SERVER_EXIT_OPLESS instead.
+ *
+ * inputs       - server whose users to exit, caused by split or not
+ * outputs      -
+ */
+static void
+exit_server_users(struct client *client_p, int split)
+{
+	struct client *target_p;
+	rb_dlink_list *users = &client_p->server->users;
+	rb_dlink_node *ptr;
+
+	if(rb_dlink_list_length(users) == 0)
+		return;
+
+	RB_DLINK_FOREACH(ptr, users->head)
+	{
+		target_p = ptr->data;
+
+		SetDead(target_p);
+
+		if(split && config_file.split_oper_time > 0 && target_p->user->oper)
+			store_client_oper(target_p);
+
+#ifdef ENABLE_USERSERV
+		if(target_p->user->user_reg)
+			rb_dlinkFindDestroy(target_p, &target_p->user->user_reg->users);
+#endif
+
+		if(target_p->user->oper)
+		{
+			rb_dlinkFindDestroy(target_p, &oper_list);
+			deallocate_conf_oper(target_p->user->oper);
+		}
+	}
+
+	del_chmembers_split(client_p, users);
+
+	/* they're freed along with everything else in exited_list.  Their
+	 * uids are left for drop_uid_server() to remove in one go, unless
+	 * the server has no sid to drop them by.
+	 */
+	RB_DLINK_FOREACH(ptr, users->head)
+	{
+		target_p = ptr->data;
+
+		rb_dlinkMoveNode(&target_p->listnode, &user_list, &exited_list);
+
+		if(EmptyString(client_p->uid))
+			del_client(target_p);
+		else
+			hashtab_del(name_table, target_p->name, target_p);
+	}
+
+	users->head = users->tail = NULL;
+	users->length = 0;
+}
+
 /* exit_server()
  *   exits a server, removing their dependencies
  *
@@ -471,12 +750,14 @@ exit_server(struct client *target_p, int split)
 	/* Early warning that a server is squit'ing. */
 	hook_call(HOOK_SERVER_EXIT_WARNING, target_p, NULL);
 
-	/* first exit each of this servers users */
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, target_p->server->users.head)
-	{
-		hook_call(HOOK_CLIENT_EXIT_SPLIT, ptr->data, NULL);
-		exit_client(ptr->data, split);
-	}
+	/* first exit all of this servers users */
+	exit_server_users(target_p, split);
+
+	/* then drop them from uid_table in one go, rather than as each is
+	 * exited.  This is left until now so find_uid() still works from
+	 * the hooks exit_server_users() calls.
+	 */
+	drop_uid_server(target_p);
 
         /* then exit each of their servers.. */
 	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, target_p->server->servers.head)
@@ -38,12 +38,18 @@
 #include "client.h"
 #include "service.h"
 #include "io.h"
+#include "hashtab.h"
+#include "hostindex.h"
 #include "log.h"
 
 struct _config_file config_file;
 rb_dlink_list conf_server_list;
 rb_dlink_list conf_oper_list;
 
+/* conf_oper_list indexed on host, rebuilt when first needed after a parse */
+static struct hostindex *conf_oper_index;
+static int conf_oper_index_dirty = 1;
+
 rb_dlink_list client_oper_list;
 
 time_t first_time;
@@ -64,6 +70,8 @@ set_default_conf(void)
 
 	config_file.ping_time = 300;
 	config_file.reconnect_time = 300;
+	config_file.flush_latency = 50;
+	config_file.direct_parse = 1;
 
 	config_file.ratbox = 1;
 	config_file.allow_stats_o = 1;
@@ -81,6 +89,9 @@ set_default_conf(void)
 
 	config_file.split_oper_time = 600;
 
+	config_file.db_write_behind = 0;
+	config_file.db_write_behind_queue = 4096;
+
 	config_file.disable_email = 1;
 	config_file.email_number = 15;
 	config_file.email_duration = 60;
@@ -139,6 +150,7 @@ set_default_conf(void)
 	config_file.bs_max_xline_matches = 200;
 	config_file.bs_max_resv_matches = 200;
 	config_file.bs_max_regexp_matches = 200;
+	config_file.bs_regexp_threads = 1;
 
 	rb_free(config_file.nwarn_string);
 	config_file.nwarn_string = rb_strdup("This nickname is registered, you may "
@@ -165,6 +177,7 @@ set_default_conf(void)
 	config_file.cf_min_clients = 4;
 	config_file.cf_client_needs_ident = 1;
 	config_file.cf_client_needs_dns = 0;
+	config_file.cf_memory_store = 0;
 }
 
 static void
@@ -191,9 +204,20 @@ validate_conf(void)
 	if(config_file.reconnect_time <= 0)
 		config_file.reconnect_time = 300;
 
+	if(config_file.flush_latency < 0)
+		config_file.flush_latency = 0;
+
 	if(config_file.pending_time <= 0)
 		config_file.pending_time = 1800;
 
+	if(config_file.db_write_behind_queue < 16)
+		config_file.db_write_behind_queue = 16;
+
+	if(config_file.bs_regexp_threads < 1)
+		config_file.bs_regexp_threads = 1;
+	else if(config_file.bs_regexp_threads > MAX_REGEXP_THREADS)
+		config_file.bs_regexp_threads = MAX_REGEXP_THREADS;
+
 	if(config_file.max_matches >= 250)
 		config_file.max_matches = 250;
 	else if(config_file.max_matches <= 0)
@@ -234,6 +258,10 @@ clear_old_conf(void)
 		config_file.email_program[i] = NULL;
 	}
 
+	/* so it can be turned off by removing it */
+	rb_free(config_file.capture_file);
+	config_file.capture_file = NULL;
+
 	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, conf_oper_list.head)
 	{
 		oper_p = ptr->data;
@@ -329,6 +357,9 @@ conf_parse(int cold)
 
 	if(!cold)
 		clear_old_conf_final();
+
+	/* opers may have been added or removed */
+	conf_oper_index_dirty = 1;
 }
 
 void
@@ -353,6 +384,9 @@ free_conf_oper(struct conf_oper *conf_p)
 	rb_free(conf_p->username);
 	rb_free(conf_p->host);
 	rb_free(conf_p->server);
+	free_mask(conf_p->username_mask);
+	free_mask(conf_p->host_mask);
+	free_mask(conf_p->server_mask);
 	rb_free(conf_p);
 }
 
@@ -392,28 +426,77 @@ find_conf_server(const char *name)
         return NULL;
 }
 
-struct conf_oper *
-find_conf_oper(const char *username, const char *host, const char *server,
-		const char *oper_username)
+struct oper_match
 {
-        struct conf_oper *oper_p;
-        rb_dlink_node *ptr;
+	struct match_name uname;
+	struct match_name hname;
+	struct match_name sname;
+	const char *oper_username;
+};
 
-        RB_DLINK_FOREACH(ptr, conf_oper_list.head)
-        {
-                oper_p = ptr->data;
+static int
+oper_match(struct hostindex_entry *entry, void *arg)
+{
+	struct conf_oper *oper_p = entry->data;
+	struct oper_match *om = arg;
 
-		if(ConfDead(oper_p))
-			continue;
+	if(!match_mask_name(oper_p->username_mask, &om->uname))
+		return 0;
 
-                if(match(oper_p->username, username) &&
-                   match(oper_p->host, host) &&
-		   (EmptyString(oper_p->server) || match(oper_p->server, server)) &&
-		   (EmptyString(oper_username) || !irccmp(oper_p->name, oper_username)))
-                        return oper_p;
-        }
+	/* the index has already matched a cidr host */
+	if(entry->type != HOSTINDEX_CIDR &&
+	   !match_mask_name(oper_p->host_mask, &om->hname))
+		return 0;
 
-        return NULL;
+	if(!EmptyString(oper_p->server) &&
+	   !match_mask_name(oper_p->server_mask, &om->sname))
+		return 0;
+
+	if(!EmptyString(om->oper_username) && irccmp(oper_p->name, om->oper_username))
+		return 0;
+
+	return 1;
+}
+
+/* build_conf_oper_index()
+ *   indexes the live oper blocks on their host, in the order theyre in
+ *   conf_oper_list so the first that matches still wins
+ */
+static void
+build_conf_oper_index(void)
+{
+	struct conf_oper *oper_p;
+	rb_dlink_node *ptr;
+
+	hostindex_free(conf_oper_index);
+	conf_oper_index = hostindex_create();
+
+	RB_DLINK_FOREACH(ptr, conf_oper_list.head)
+	{
+		oper_p = ptr->data;
+
+		if(!ConfDead(oper_p))
+			hostindex_add(conf_oper_index, oper_p->host, oper_p);
+	}
+
+	conf_oper_index_dirty = 0;
+}
+
+struct conf_oper *
+find_conf_oper(const char *username, const char *host, const char *ip,
+		const char *server, const char *oper_username)
+{
+	struct oper_match om;
+
+	if(conf_oper_index_dirty)
+		build_conf_oper_index();
+
+	fold_name(&om.uname, username);
+	fold_name(&om.hname, host);
+	fold_name(&om.sname, server);
+	om.oper_username = oper_username;
+
+	return hostindex_find(conf_oper_index, host, ip, oper_match, &om);
 }
 
 /* store_client_oper()
@@ -37,6 +37,7 @@
 #include "dbhook.h"
 #include "log.h"
 #include "event.h"
+#include "latency.h"
 
 static rb_dlink_list rsdb_hook_list;
 static rb_dlink_list dbh_schedule_list;
@@ -61,7 +62,7 @@ rsdb_hook_add(const char *table, const char *hook_value,
 
 	rb_dlinkAdd(dbh, &dbh->ptr, &rsdb_hook_list);
 
-	dbh->ev = rb_event_add(hook_value, rsdb_hook_call, dbh, frequency);
+	dbh->ev = latency_event_add(hook_value, rsdb_hook_call, dbh, frequency);
 
 	return dbh;
 }
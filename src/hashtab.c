@@ -0,0 +1,302 @@
+/* src/hashtab.c
+ *   Contains code for the open addressing hash tables.
+ *
+ * Copyright (C) 2003-2012 ircd-ratbox development team
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1.Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * 2.Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * 3.The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id$
+ */
+#include "stdinc.h"
+#include "rserv.h"
+#include "tools.h"
+#include "hashtab.h"
+
+/* overflow slots after the last home slot, so probes never wrap */
+#define HASHTAB_OVERFLOW(size)	((size) / 8 + 16)
+
+#define HOME_SLOT(table, hashv)	((hashv) & ((table)->size - 1))
+
+static size_t hashtab_total;
+
+/* hashtab_create()
+ *   creates a hash table
+ *
+ * inputs	- initial number of slots (a power of two), function
+ *		  to compare keys with
+ * outputs	- the new table
+ */
+struct hashtab *
+hashtab_create(unsigned int size, int (*cmp)(const char *, const char *))
+{
+	struct hashtab *table = rb_malloc(sizeof(struct hashtab));
+
+	table->size = size;
+	table->alloc = size + HASHTAB_OVERFLOW(size);
+	table->slots = rb_malloc(sizeof(struct hashtab_slot) * table->alloc);
+	table->cmp = cmp;
+
+	hashtab_total += hashtab_memory(table);
+
+	return table;
+}
+
+/* hashtab_destroy()
+ *   frees a hash table, the entries themselves are left alone
+ */
+void
+hashtab_destroy(struct hashtab *table)
+{
+	hashtab_total -= hashtab_memory(table);
+
+	rb_free(table->slots);
+	rb_free(table);
+}
+
+/* hashtab_hash()
+ *   hashes a key, case insensitively
+ *
+ * inputs	- key to hash
+ * outputs	- full 32 bit hash value (FNV-1a)
+ */
+unsigned int
+hashtab_hash(const char *key)
+{
+	unsigned int h = 2166136261U;
+
+	while(*key)
+	{
+		h ^= (unsigned char) ToLower(*key++);
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+/* hashtab_insert()
+ *   places an entry in the slots, displacing entries nearer their home
+ *   slot than it is from its own
+ *
+ * inputs	- table, slot contents to insert
+ * outputs	- 1 on success, 0 if it ran off the end of the slots
+ */
+static int
+hashtab_insert(struct hashtab *table, struct hashtab_slot *entry)
+{
+	struct hashtab_slot cur = *entry;
+	struct hashtab_slot tmp;
+	struct hashtab_slot *slot;
+	unsigned int i, dist, slot_dist;
+
+	for(i = HOME_SLOT(table, cur.hashv), dist = 0; i < table->alloc; i++, dist++)
+	{
+		slot = &table->slots[i];
+
+		if(slot->data == NULL)
+		{
+			*slot = cur;
+			return 1;
+		}
+
+		slot_dist = i - HOME_SLOT(table, slot->hashv);
+
+		if(slot_dist < dist)
+		{
+			tmp = *slot;
+			*slot = cur;
+			cur = tmp;
+			dist = slot_dist;
+		}
+	}
+
+	/* whatever we were left holding has to be put back by the caller */
+	*entry = cur;
+	return 0;
+}
+
+/* hashtab_grow()
+ *   doubles the size of a table, moving over its entries
+ */
+static void
+hashtab_grow(struct hashtab *table)
+{
+	struct hashtab_slot *old_slots = table->slots;
+	unsigned int old_alloc = table->alloc;
+	unsigned int i;
+
+	hashtab_total -= hashtab_memory(table);
+
+	table->size *= 2;
+	table->alloc = table->size + HASHTAB_OVERFLOW(table->size);
+	table->slots = rb_malloc(sizeof(struct hashtab_slot) * table->alloc);
+
+	for(i = 0; i < old_alloc; i++)
+	{
+		if(old_slots[i].data == NULL)
+			continue;
+
+		/* the overflow area grows with the table, so this would
+		 * need a quite spectacular run of collisions
+		 */
+		if(!hashtab_insert(table, &old_slots[i]))
+			die(1, "hashtab: unable to grow table");
+	}
+
+	rb_free(old_slots);
+
+	hashtab_total += hashtab_memory(table);
+}
+
+/* hashtab_add()
+ *   adds an entry to a table
+ *
+ * inputs	- table, key of the entry, entry to add
+ * outputs	-
+ */
+void
+hashtab_add(struct hashtab *table, const char *key, void *data)
+{
+	struct hashtab_slot entry;
+
+	/* keep it no more than three quarters full */
+	if((table->count + 1) > table->size - table->size / 4)
+		hashtab_grow(table);
+
+	entry.hashv = hashtab_hash(key);
+	entry.key = key;
+	entry.data = data;
+
+	while(!hashtab_insert(table, &entry))
+		hashtab_grow(table);
+
+	table->count++;
+}
+
+/* hashtab_find()
+ *   finds an entry in a table
+ *
+ * inputs	- table, key to find
+ * outputs	- entry, or NULL if not found
+ */
+void *
+hashtab_find(struct hashtab *table, const char *key)
+{
+	struct hashtab_slot *slot;
+	unsigned int hashv = hashtab_hash(key);
+	unsigned int i, dist;
+
+	for(i = HOME_SLOT(table, hashv), dist = 0; i < table->alloc; i++, dist++)
+	{
+		slot = &table->slots[i];
+
+		/* nothing further along can have a home slot this far back */
+		if(slot->data == NULL || i - HOME_SLOT(table, slot->hashv) < dist)
+			return NULL;
+
+		if(slot->hashv == hashv && !table->cmp(slot->key, key))
+			return slot->data;
+	}
+
+	return NULL;
+}
+
+/* hashtab_del()
+ *   removes an entry from a table
+ *
+ * inputs	- table, key the entry was added with, entry to remove
+ * outputs	- 1 if the entry was removed, 0 if it wasn't there
+ */
+int
+hashtab_del(struct hashtab *table, const char *key, void *data)
+{
+	struct hashtab_slot *slot;
+	unsigned int hashv = hashtab_hash(key);
+	unsigned int i, dist;
+
+	for(i = HOME_SLOT(table, hashv), dist = 0; i < table->alloc; i++, dist++)
+	{
+		slot = &table->slots[i];
+
+		if(slot->data == NULL || i - HOME_SLOT(table, slot->hashv) < dist)
+			return 0;
+
+		if(slot->data == data)
+			break;
+	}
+
+	if(i >= table->alloc)
+		return 0;
+
+	/* shift the rest of the run back a slot, this only ever moves
+	 * entries to lower slots.
+	 */
+	for(i++; i < table->alloc; i++)
+	{
+		slot = &table->slots[i];
+
+		if(slot->data == NULL || HOME_SLOT(table, slot->hashv) == i)
+			break;
+
+		table->slots[i-1] = *slot;
+	}
+
+	memset(&table->slots[i-1], 0, sizeof(struct hashtab_slot));
+	table->count--;
+
+	return 1;
+}
+
+/* hashtab_walk_start()
+ *   returns the slot a HASHTAB_WALK_POS walk starts below
+ */
+unsigned int
+hashtab_walk_start(struct hashtab *table, unsigned int start)
+{
+	if(start == 0 || start > table->alloc)
+		return table->alloc;
+
+	return start;
+}
+
+/* hashtab_walk_stop()
+ *   returns the slot a HASHTAB_WALK_POS walk stops at, 0 once the walk
+ *   reaches the bottom of the table
+ */
+unsigned int
+hashtab_walk_stop(struct hashtab *table, unsigned int start, unsigned int max)
+{
+	unsigned int pos = hashtab_walk_start(table, start);
+
+	return (pos > max) ? pos - max : 0;
+}
+
+/* hashtab_total_memory()
+ *   returns the memory used by the slots of every table
+ */
+size_t
+hashtab_total_memory(void)
+{
+	return hashtab_total;
+}
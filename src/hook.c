@@ -33,8 +33,38 @@
 #include "stdinc.h"
 #include "rserv.h"
 #include "hook.h"
+#include "latency.h"
 
 static rb_dlink_list hooks[HOOK_LAST_HOOK];
+static struct latency_stat *hook_latency[HOOK_LAST_HOOK];
+
+static const char *hook_names[HOOK_LAST_HOOK] = {
+	[HOOK_DCC_AUTH]			= "dcc_auth",
+	[HOOK_DCC_EXIT]			= "dcc_exit",
+	[HOOK_CHANNEL_JOIN]		= "channel_join",
+	[HOOK_CHANNEL_SJOIN_LOWERTS]	= "channel_sjoin_lowerts",
+	[HOOK_CHANNEL_MODE_OP]		= "channel_mode_op",
+	[HOOK_CHANNEL_MODE_VOICE]	= "channel_mode_voice",
+	[HOOK_CHANNEL_MODE_BAN]		= "channel_mode_ban",
+	[HOOK_CHANNEL_MODE_SIMPLE]	= "channel_mode_simple",
+	[HOOK_CHANNEL_OPLESS]		= "channel_opless",
+	[HOOK_CHANNEL_DESTROY]		= "channel_destroy",
+	[HOOK_CHANNEL_TOPIC]		= "channel_topic",
+	[HOOK_EOB_UPLINK]		= "eob_uplink",
+	[HOOK_EOB_SERVER]		= "eob_server",
+	[HOOK_CLIENT_CONNECT]		= "client_connect",
+	[HOOK_CLIENT_CONNECT_BURST]	= "client_connect_burst",
+	[HOOK_CLIENT_NICKCHANGE]	= "client_nickchange",
+	[HOOK_CLIENT_EXIT]		= "client_exit",
+	[HOOK_CLIENT_EXIT_SPLIT]	= "client_exit_split",
+	[HOOK_SERVER_EXIT]		= "server_exit",
+	[HOOK_SERVER_EXIT_WARNING]	= "server_exit_warning",
+	[HOOK_USERSERV_LOGIN]		= "userserv_login",
+	[HOOK_USERSERV_LOGIN_BURST]	= "userserv_login_burst",
+	[HOOK_PROTO_SQUIT_UNKNOWN]	= "proto_squit_unknown",
+	[HOOK_DBSYNC]			= "dbsync",
+	[HOOK_SERVER_EXIT_OPLESS]	= "server_exit_opless",
+};
 
 void
 hook_add(hook_func func, int hook)
@@ -42,6 +72,10 @@ hook_add(hook_func func, int hook)
 	if(hook >= HOOK_LAST_HOOK)
 		return;
 
+	if(hook_latency[hook] == NULL)
+		hook_latency[hook] = latency_find(LATENCY_HOOK,
+				hook_names[hook] ? hook_names[hook] : "unknown");
+
 	rb_dlinkAddTailAlloc(func, &hooks[hook]);
 }
 
@@ -50,16 +84,25 @@ hook_call(int hook, void *arg, void *arg2)
 {
 	hook_func func;
 	rb_dlink_node *ptr;
+	struct timespec start;
+	int retval = 0;
 
-	if(hook >= HOOK_LAST_HOOK)
+	if(hook >= HOOK_LAST_HOOK || hooks[hook].head == NULL)
 		return 0;
 
+	latency_start(&start);
+
 	RB_DLINK_FOREACH(ptr, hooks[hook].head)
 	{
 		func = ptr->data;
 		if((*func)(arg, arg2) < 0)
-			return -1;
+		{
+			retval = -1;
+			break;
+		}
 	}
 
-	return 0;
+	latency_stop(hook_latency[hook], &start);
+
+	return retval;
 }
@@ -0,0 +1,489 @@
+/* src/hostindex.c
+ *   Contains code for indexing masks on their host.
+ *
+ * Copyright (C) 2003-2012 ircd-ratbox development team
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1.Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * 2.Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * 3.The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id$
+ */
+#include "stdinc.h"
+#include "rserv.h"
+#include "tools.h"
+#include "hashtab.h"
+#include "hostindex.h"
+
+#define HOSTINDEX_BITS		128
+
+/* the entries on a literal host, or on a domain */
+struct hostindex_bucket
+{
+	char *key;
+	int suffix;			/* in the suffixes table */
+	rb_dlink_list entries;
+};
+
+/* a node of the radix tree.  Nodes only branch where two prefixes
+ * differ, so those without entries are just there to branch.
+ */
+struct hostindex_node
+{
+	unsigned char addr[16];
+	unsigned int bits;
+	struct hostindex_node *child[2];
+	rb_dlink_list entries;
+};
+
+static inline int
+bit_at(const unsigned char *addr, unsigned int bit)
+{
+	return (addr[bit / 8] >> (7 - (bit % 8))) & 1;
+}
+
+/* common_bits()
+ *   counts how many leading bits two addresses share, up to max
+ */
+static unsigned int
+common_bits(const unsigned char *a, const unsigned char *b, unsigned int max)
+{
+	unsigned char diff;
+	unsigned int i;
+
+	for(i = 0; i < max; i += 8)
+	{
+		if((diff = a[i / 8] ^ b[i / 8]) == 0)
+			continue;
+
+		while(!(diff & 0x80))
+		{
+			diff <<= 1;
+			i++;
+		}
+
+		break;
+	}
+
+	return i < max ? i : max;
+}
+
+static struct hostindex_node *
+make_node(const unsigned char *addr, unsigned int bits)
+{
+	struct hostindex_node *node = rb_malloc(sizeof(struct hostindex_node));
+	unsigned int i;
+
+	memcpy(node->addr, addr, sizeof(node->addr));
+	node->bits = bits;
+
+	for(i = bits; i < HOSTINDEX_BITS; i++)
+		node->addr[i / 8] &= ~(0x80 >> (i % 8));
+
+	return node;
+}
+
+/* radix_add()
+ *   finds the node for a prefix, creating it if needed
+ */
+static struct hostindex_node *
+radix_add(struct hostindex *index_p, const unsigned char *addr, unsigned int bits)
+{
+	struct hostindex_node **pp = &index_p->radix;
+	struct hostindex_node *node;
+	struct hostindex_node *glue;
+	unsigned int common;
+
+	while((node = *pp) != NULL)
+	{
+		common = common_bits(node->addr, addr,
+				node->bits < bits ? node->bits : bits);
+
+		/* we branch off above this node, so something has to go
+		 * in its place with it underneath
+		 */
+		if(common < node->bits)
+		{
+			glue = make_node(addr, common);
+			glue->child[bit_at(node->addr, common)] = node;
+			*pp = glue;
+
+			if(common == bits)
+				return glue;
+
+			pp = &glue->child[bit_at(addr, common)];
+			break;
+		}
+
+		if(node->bits == bits)
+			return node;
+
+		pp = &node->child[bit_at(addr, node->bits)];
+	}
+
+	*pp = make_node(addr, bits);
+	return *pp;
+}
+
+/* radix_del()
+ *   removes a node thats no longer got any entries, and the node above it
+ *   if that was only there to branch to it
+ */
+static void
+radix_del(struct hostindex *index_p, struct hostindex_node *node)
+{
+	struct hostindex_node **pp = &index_p->radix;
+	struct hostindex_node **parent = NULL;
+
+	while(*pp != node)
+	{
+		parent = pp;
+		pp = &(*pp)->child[bit_at(node->addr, (*pp)->bits)];
+	}
+
+	if(node->child[0] != NULL && node->child[1] != NULL)
+		return;
+
+	*pp = node->child[0] != NULL ? node->child[0] : node->child[1];
+	rb_free(node);
+
+	if(parent == NULL)
+		return;
+
+	node = *parent;
+
+	if(rb_dlink_list_length(&node->entries) == 0 &&
+	   (node->child[0] == NULL || node->child[1] == NULL))
+	{
+		*parent = node->child[0] != NULL ? node->child[0] : node->child[1];
+		rb_free(node);
+	}
+}
+
+static void
+radix_free(struct hostindex_node *node)
+{
+	rb_dlink_node *ptr, *next_ptr;
+
+	if(node == NULL)
+		return;
+
+	radix_free(node->child[0]);
+	radix_free(node->child[1]);
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, node->entries.head)
+	{
+		rb_free(ptr->data);
+	}
+
+	rb_free(node);
+}
+
+static void
+free_buckets(struct hashtab *table)
+{
+	struct hostindex_bucket *bucket;
+	rb_dlink_node *ptr, *next_ptr;
+	unsigned int i;
+
+	HASHTAB_WALK(i, bucket, table)
+	{
+		RB_DLINK_FOREACH_SAFE(ptr, next_ptr, bucket->entries.head)
+		{
+			rb_free(ptr->data);
+		}
+
+		rb_free(bucket->key);
+		rb_free(bucket);
+	}
+	HASHTAB_WALK_END
+
+	hashtab_destroy(table);
+}
+
+struct hostindex *
+hostindex_create(void)
+{
+	struct hostindex *index_p = rb_malloc(sizeof(struct hostindex));
+
+	index_p->hosts = hashtab_create(HOSTINDEX_HASH_SIZE, irccmp);
+	index_p->suffixes = hashtab_create(HOSTINDEX_HASH_SIZE, irccmp);
+	return index_p;
+}
+
+void
+hostindex_free(struct hostindex *index_p)
+{
+	rb_dlink_node *ptr, *next_ptr;
+
+	if(index_p == NULL)
+		return;
+
+	free_buckets(index_p->hosts);
+	free_buckets(index_p->suffixes);
+	radix_free(index_p->radix);
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, index_p->other.head)
+	{
+		rb_free(ptr->data);
+	}
+
+	rb_free(index_p);
+}
+
+/* host_key()
+ *   finds what a host mask is indexed under
+ *
+ * inputs	- host mask, set to whether its a *.domain mask
+ * outputs	- host or domain from the mask, or NULL if its too wild
+ *		  to index
+ */
+static const char *
+host_key(const char *host, int *suffix)
+{
+	const char *s;
+
+	*suffix = 0;
+
+	if(host[0] == '*' && host[1] == '.')
+	{
+		host += 2;
+		*suffix = 1;
+	}
+
+	if(EmptyString(host))
+		return NULL;
+
+	for(s = host; *s; s++)
+	{
+		if(*s == '*' || *s == '?' || *s == '@')
+			return NULL;
+	}
+
+	return host;
+}
+
+/* hostindex_add()
+ *   adds a mask to the index on its host
+ *
+ * inputs	- index, host part of the mask or NULL, data for the entry
+ * outputs	- entry, to be removed with hostindex_del()
+ */
+struct hostindex_entry *
+hostindex_add(struct hostindex *index_p, const char *host, void *data)
+{
+	struct hostindex_entry *entry = rb_malloc(sizeof(struct hostindex_entry));
+	struct hostindex_bucket *bucket;
+	struct hostindex_node *node;
+	struct hashtab *table;
+	unsigned char addr[16];
+	unsigned int bits;
+	const char *key;
+	int suffix;
+
+	entry->data = data;
+	entry->seq = index_p->seq++;
+	index_p->count++;
+
+	if(EmptyString(host))
+	{
+		entry->type = HOSTINDEX_OTHER;
+		rb_dlinkAddTail(entry, &entry->ptr, &index_p->other);
+		return entry;
+	}
+
+	if(strchr(host, '/') != NULL && parse_cidr(host, addr, &bits))
+	{
+		node = radix_add(index_p, addr, bits);
+
+		entry->type = HOSTINDEX_CIDR;
+		entry->where = node;
+		rb_dlinkAddTail(entry, &entry->ptr, &node->entries);
+		return entry;
+	}
+
+	if((key = host_key(host, &suffix)) == NULL)
+	{
+		entry->type = HOSTINDEX_OTHER;
+		rb_dlinkAddTail(entry, &entry->ptr, &index_p->other);
+		return entry;
+	}
+
+	table = suffix ? index_p->suffixes : index_p->hosts;
+
+	if((bucket = hashtab_find(table, key)) == NULL)
+	{
+		bucket = rb_malloc(sizeof(struct hostindex_bucket));
+		bucket->key = rb_strdup(key);
+		bucket->suffix = suffix;
+		hashtab_add(table, bucket->key, bucket);
+	}
+
+	entry->type = suffix ? HOSTINDEX_SUFFIX : HOSTINDEX_HOST;
+	entry->where = bucket;
+	rb_dlinkAddTail(entry, &entry->ptr, &bucket->entries);
+	return entry;
+}
+
+void
+hostindex_del(struct hostindex *index_p, struct hostindex_entry *entry)
+{
+	struct hostindex_bucket *bucket;
+	struct hostindex_node *node;
+
+	index_p->count--;
+
+	switch(entry->type)
+	{
+	case HOSTINDEX_HOST:
+	case HOSTINDEX_SUFFIX:
+		bucket = entry->where;
+		rb_dlinkDelete(&entry->ptr, &bucket->entries);
+
+		if(rb_dlink_list_length(&bucket->entries) == 0)
+		{
+			hashtab_del(bucket->suffix ? index_p->suffixes : index_p->hosts,
+					bucket->key, bucket);
+			rb_free(bucket->key);
+			rb_free(bucket);
+		}
+		break;
+
+	case HOSTINDEX_CIDR:
+		node = entry->where;
+		rb_dlinkDelete(&entry->ptr, &node->entries);
+
+		if(rb_dlink_list_length(&node->entries) == 0)
+			radix_del(index_p, node);
+		break;
+
+	default:
+		rb_dlinkDelete(&entry->ptr, &index_p->other);
+		break;
+	}
+
+	rb_free(entry);
+}
+
+/* list_match()
+ *   checks a list of entries, for any added before the one found so far
+ */
+static struct hostindex_entry *
+list_match(rb_dlink_list *list, struct hostindex_entry *found,
+		hostindex_cb callback, void *arg)
+{
+	struct hostindex_entry *entry;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		entry = ptr->data;
+
+		/* theyre in the order they were added */
+		if(found != NULL && entry->seq > found->seq)
+			break;
+
+		if((*callback)(entry, arg))
+			return entry;
+	}
+
+	return found;
+}
+
+static struct hostindex_entry *
+radix_match(struct hostindex *index_p, const unsigned char *addr,
+		struct hostindex_entry *found, hostindex_cb callback, void *arg)
+{
+	struct hostindex_node *node = index_p->radix;
+
+	while(node != NULL)
+	{
+		if(common_bits(node->addr, addr, node->bits) < node->bits)
+			break;
+
+		found = list_match(&node->entries, found, callback, arg);
+
+		if(node->bits == HOSTINDEX_BITS)
+			break;
+
+		node = node->child[bit_at(addr, node->bits)];
+	}
+
+	return found;
+}
+
+/* hostindex_find()
+ *   finds the first entry added that matches a host
+ *
+ * inputs	- index, host, ip or NULL, callback to check the rest of each
+ *		  entry, argument to pass it
+ * outputs	- data for the first matching entry, or NULL
+ */
+void *
+hostindex_find(struct hostindex *index_p, const char *host, const char *ip,
+		hostindex_cb callback, void *arg)
+{
+	struct hostindex_entry *found;
+	struct hostindex_bucket *bucket;
+	unsigned char addr[16];
+	unsigned char hostaddr[16];
+	const char *s;
+	int have_addr = 0;
+
+	if(index_p == NULL || index_p->count == 0)
+		return NULL;
+
+	found = list_match(&index_p->other, NULL, callback, arg);
+
+	if(!EmptyString(host))
+	{
+		if((bucket = hashtab_find(index_p->hosts, host)) != NULL)
+			found = list_match(&bucket->entries, found, callback, arg);
+
+		/* *.domain masks on each domain the host is in */
+		for(s = host; (s = strchr(s, '.')) != NULL; )
+		{
+			s++;
+
+			if((bucket = hashtab_find(index_p->suffixes, s)) != NULL)
+				found = list_match(&bucket->entries, found,
+							callback, arg);
+		}
+	}
+
+	if(index_p->radix != NULL)
+	{
+		if(parse_ip(ip, addr))
+		{
+			found = radix_match(index_p, addr, found, callback, arg);
+			have_addr = 1;
+		}
+
+		/* hosts that didnt resolve are their ip */
+		if(parse_ip(host, hostaddr) &&
+		   (!have_addr || memcmp(addr, hostaddr, sizeof(addr))))
+			found = radix_match(index_p, hostaddr, found, callback, arg);
+	}
+
+	return found != NULL ? found->data : NULL;
+}
@@ -35,6 +35,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <sys/resource.h>
 
 #include "stdinc.h"
 #include "scommand.h"
@@ -52,6 +53,7 @@
 #include "serno.h"
 #include "watch.h"
 #include "tools.h"
+#include "latency.h"
 
 #define IO_HOST	0
 #define IO_IP	1
@@ -59,6 +61,38 @@
 rb_dlink_list connection_list;
 struct lconn *server_p;
 
+unsigned long server_write_calls;
+unsigned long server_write_lines;
+unsigned long server_write_bytes;
+
+/* when the oldest line waiting to be flushed to our uplink was sent */
+static struct timeval flush_start;
+
+/* lines read from our uplink are written here, see capture_line() */
+#define CAPTURE_HEADER	"# ratbox-services capture "
+static FILE *capture_fp;
+
+/* service commands whose arguments from arg on are secret, and are left
+ * out of the capture file.  A NULL service is any of them.
+ */
+static struct capture_secret
+{
+	const char *service;
+	const char *command;
+	const char *subcommand;
+	int arg;
+} capture_secrets[] = {
+	{ NULL,		"OLOGIN",	NULL,		2 },
+	{ NULL,		"OPERLOGIN",	NULL,		2 },
+	{ "USERSERV",	"REGISTER",	NULL,		2 },
+	{ "USERSERV",	"LOGIN",	NULL,		2 },
+	{ "USERSERV",	"RESETPASS",	NULL,		2 },
+	{ "USERSERV",	"SET",		"PASSWORD",	2 },
+	{ "USERSERV",	"USERREGISTER",	NULL,		2 },
+	{ "USERSERV",	"USERSETPASS",	NULL,		2 },
+	{ NULL,		NULL,		NULL,		0 }
+};
+
 time_t last_connect_time;
 time_t current_time;
 
@@ -73,7 +107,9 @@ static void read_server(rb_fde_t *F, void *data);
 static void read_client(rb_fde_t *F, void *data);
 static void write_sendq(rb_fde_t *F, void *data);
 static void parse_server(char *buf, int len);
+static void parse_server_direct(char *buf, int len);
 static void parse_client(struct lconn *conn_p, char *buf, int len);
+static void capture_line(const char *buf, int len);
 #ifdef HAVE_GETADDRINFO
 static struct addrinfo *gethostinfo(char const *host, int port);
 #endif
@@ -151,6 +187,7 @@ static void check_server_status(void *data)
 			exit_client(server_p->client_p, 0);
 		rb_free(server_p->name);
 		rb_free(server_p->sid);
+		rb_free(server_p->recvbuf);
 		rb_free(server_p);
 		server_p = NULL;
 	}
@@ -185,8 +222,8 @@ static void cleanup_exited_clients(void *data)
 
 void add_server_events(void)
 {
-	rb_event_add("check_server_status", check_server_status, NULL, 5);
-	rb_event_add("cleanup_exited_clients", cleanup_exited_clients, NULL, 60);
+	latency_event_add("check_server_status", check_server_status, NULL, 5);
+	latency_event_add("cleanup_exited_clients", cleanup_exited_clients, NULL, 60);
 }
 
 
@@ -456,6 +493,28 @@ signon_server(struct lconn *conn_p)
 	sendto_all("Connection to server %s established",
                    conn_p->name);
 
+	if(!EmptyString(config_file.capture_file))
+	{
+		int fd;
+
+		/* it may hold what users say to services, so only we
+		 * can read it
+		 */
+		if((fd = open(config_file.capture_file, O_WRONLY|O_CREAT|O_TRUNC, 0600)) >= 0)
+		{
+			fchmod(fd, 0600);
+
+			if((capture_fp = fdopen(fd, "w")) == NULL)
+				close(fd);
+		}
+
+		if(capture_fp != NULL)
+			fprintf(capture_fp, CAPTURE_HEADER "%s\n", conn_p->name);
+		else
+			mlog("Unable to open capture file %s: %s",
+				config_file.capture_file, strerror(errno));
+	}
+
 	sendto_server("CAPAB :QS TB EX IE ENCAP SERVICES");
 	sendto_server("SERVER %s 1 :%s", MYNAME, config_file.gecos);
 	read_server(conn_p->F, conn_p);
@@ -542,9 +601,19 @@ signoff_server(struct lconn *conn_p)
 	if(ConnDead(conn_p))
 		return;
 
+	/* get out whatever we were holding back, ERROR etc */
+	if(conn_p->flags & CONN_FLAGS_FLUSH)
+		send_queued(conn_p);
+
 	/* Mark it as dead right away to avoid infinite calls! -- jilles */
 	SetConnDead(conn_p);
 
+	if(capture_fp != NULL && conn_p == server_p)
+	{
+		fclose(capture_fp);
+		capture_fp = NULL;
+	}
+
 	/* clear any introduced status */
 	RB_DLINK_FOREACH(ptr, service_list.head)
 	{
@@ -556,7 +625,7 @@ signoff_server(struct lconn *conn_p)
 
 	if(conn_p == server_p)
 	{
-		rb_event_addonce("connect_to_server", connect_to_server, NULL, 
+		latency_event_addonce("connect_to_server", connect_to_server, NULL, 
 				config_file.reconnect_time);
 
 		if(server_p->client_p != NULL)
@@ -623,6 +692,88 @@ read_any(struct lconn *conn_p, int server)
 
 
 
+/* read_server_direct()
+ *   reads data from the server straight into its recvbuf, and parses
+ *   each complete line where it sits
+ *
+ * inputs	- connection entry to read from
+ * outputs	-
+ */
+static void
+read_server_direct(struct lconn *conn_p)
+{
+	char *line;
+	char *end;
+	char *s;
+	int length;
+	unsigned long total_read = 0;
+
+	while(1)
+	{
+		length = rb_read(conn_p->F, conn_p->recvbuf + conn_p->recvlen,
+				RECVBUF_SIZE - conn_p->recvlen);
+
+		if(length < 0)
+		{
+			if(rb_ignore_errno(errno))
+				rb_setselect(conn_p->F, RB_SELECT_READ, read_server, conn_p);
+			else
+			{
+				mlog("Connection to server %s lost: (Read error: %s)", conn_p->name, rb_strerror(errno));
+				sendto_all("Connect to server %s lost: (Read error: %s)", conn_p->name, rb_strerror(errno));
+				signoff_server(conn_p);
+			}
+
+			break;
+		}
+
+		if(length == 0)
+		{
+			mlog("Connection to server %s lost", conn_p->name);
+			sendto_all("Connection to server %s lost", conn_p->name);
+			signoff_server(conn_p);
+			break;
+		}
+
+		total_read += length;
+		conn_p->recvlen += length;
+
+		line = conn_p->recvbuf;
+		end = conn_p->recvbuf + conn_p->recvlen;
+
+		while((s = memchr(line, '\n', end - line)) != NULL)
+		{
+			if(capture_fp != NULL)
+				capture_line(line, s - line);
+
+			parse_server_direct(line, s - line);
+
+			if(ConnDead(conn_p))
+				return;
+
+			line = s + 1;
+		}
+
+		conn_p->recvlen = end - line;
+
+		/* a full buffer without a newline is no server line, ditch it */
+		if(conn_p->recvlen == RECVBUF_SIZE)
+		{
+			mlog("Discarding %d bytes from server %s with no line ending",
+				RECVBUF_SIZE, conn_p->name);
+			conn_p->recvlen = 0;
+		}
+		else if(conn_p->recvlen && line != conn_p->recvbuf)
+			memmove(conn_p->recvbuf, line, conn_p->recvlen);
+	}
+
+	if(total_read > 0)
+	{
+		conn_p->last_time = rb_time();
+		ClearConnSentPing(conn_p);
+	}
+}
+
 /* read_server()
  *   reads some data from the server, exiting it on read error
  *
@@ -634,6 +785,20 @@ read_server(rb_fde_t *F, void *data)
 {
 	struct lconn *conn_p = data;
 	int len;
+
+	/* only switch over whilst the linebuf is empty, ie on a fresh
+	 * connection
+	 */
+	if(conn_p->recvbuf == NULL && config_file.direct_parse &&
+	   rb_linebuf_len(&conn_p->lb_recvq) == 0)
+		conn_p->recvbuf = rb_malloc(RECVBUF_SIZE);
+
+	if(conn_p->recvbuf != NULL)
+	{
+		read_server_direct(conn_p);
+		return;
+	}
+
 	read_any(conn_p, 1);
 
 	if(IsDead(conn_p))
@@ -644,6 +809,9 @@ read_server(rb_fde_t *F, void *data)
 		len = rb_linebuf_get(&conn_p->lb_recvq, readbuf, sizeof(readbuf), LINEBUF_COMPLETE, LINEBUF_PARSED);
 		if(len <= 0 || IsDead(conn_p))
 			return;
+
+		if(capture_fp != NULL)
+			capture_line(readbuf, len);
 		
 		parse_server(readbuf, len);
 		if(IsDead(conn_p))
@@ -651,6 +819,248 @@ read_server(rb_fde_t *F, void *data)
 	}	
 }
 
+/* capture_find_secret()
+ *   finds where the secret arguments of a PRIVMSG to a service start,
+ *   see capture_secrets
+ *
+ * inputs	- line, length of line
+ * outputs	- offset of the first secret argument, or -1 if there isnt one
+ */
+static int
+capture_find_secret(const char *buf, int len)
+{
+	char line[BUFSIZE];
+	char *parv[MAXPARA+1];
+	struct client *target_p = NULL;
+	struct capture_secret *secret_p;
+	rb_dlink_node *ptr;
+	char *target;
+	char *text;
+	char *p;
+	int parc;
+
+	if(len >= (int) sizeof(line))
+		return -1;
+
+	memcpy(line, buf, len);
+	line[len] = '\0';
+
+	p = line;
+
+	if(*p == ':' && (p = strchr(p, ' ')) != NULL)
+		p++;
+
+	if(p == NULL || strncasecmp(p, "PRIVMSG ", 8))
+		return -1;
+
+	target = p + 8;
+
+	if((p = strchr(target, ' ')) == NULL)
+		return -1;
+
+	*p++ = '\0';
+	text = (*p == ':') ? p + 1 : p;
+
+	/* username@server messaged, as c_message() */
+	if((p = strchr(target, '@')) != NULL)
+	{
+		*p = '\0';
+
+		RB_DLINK_FOREACH(ptr, service_list.head)
+		{
+			if(!irccmp(target, ((struct client *) ptr->data)->service->username))
+			{
+				target_p = ptr->data;
+				break;
+			}
+		}
+	}
+	else
+		target_p = find_service(target);
+
+	if(target_p == NULL)
+		return -1;
+
+	/* split the text up in place, remembering where each word starts */
+	for(parc = 0, p = text; parc < MAXPARA; parc++)
+	{
+		while(*p == ' ')
+			p++;
+
+		if(*p == '\0')
+			break;
+
+		parv[parc] = p;
+
+		if((p = strchr(p, ' ')) == NULL)
+		{
+			parc++;
+			break;
+		}
+
+		*p++ = '\0';
+	}
+
+	if(parc < 2)
+		return -1;
+
+	for(secret_p = capture_secrets; secret_p->command != NULL; secret_p++)
+	{
+		if(secret_p->service != NULL &&
+		   irccmp(secret_p->service, target_p->service->id))
+			continue;
+
+		if(strcasecmp(secret_p->command, parv[0]))
+			continue;
+
+		if(secret_p->subcommand != NULL &&
+		   strcasecmp(secret_p->subcommand, parv[1]))
+			continue;
+
+		if(secret_p->arg >= parc)
+			return -1;
+
+		return parv[secret_p->arg] - line;
+	}
+
+	return -1;
+}
+
+/* capture_line()
+ *   writes a line read from our uplink to the capture file, along with
+ *   the time it was read.  The password on PASS, and passwords given to
+ *   services, are left out.
+ *
+ * inputs	- line, length of line
+ * outputs	-
+ */
+static void
+capture_line(const char *buf, int len)
+{
+	struct timeval now;
+	const char *s;
+	int secret;
+
+	while(len > 0 && (buf[len-1] == '\r' || buf[len-1] == '\n'))
+		len--;
+
+	gettimeofday(&now, NULL);
+	fprintf(capture_fp, "%lu.%06lu ",
+		(unsigned long) now.tv_sec, (unsigned long) now.tv_usec);
+
+	if(len > 5 && !strncasecmp(buf, "PASS ", 5))
+	{
+		fputs("PASS *", capture_fp);
+
+		if((s = memchr(buf + 5, ' ', len - 5)) == NULL)
+			s = buf + len;
+
+		len -= s - buf;
+		buf = s;
+	}
+	else if((secret = capture_find_secret(buf, len)) >= 0)
+	{
+		fprintf(capture_fp, "%.*s*\n", secret, buf);
+		return;
+	}
+
+	fprintf(capture_fp, "%.*s\n", len, buf);
+}
+
+/* replay_server()
+ *   replays a capture file as though it was read from our uplink, as
+ *   fast as it can, then prints how long it took.  Whatever we send
+ *   back goes to /dev/null.
+ *
+ * inputs	- path to capture file
+ * outputs	-
+ */
+void
+replay_server(const char *path)
+{
+	struct lconn *conn_p;
+	struct timeval start, end;
+	struct rusage ru;
+	FILE *fp;
+	char *s;
+	unsigned long lines = 0;
+	double secs;
+	int len;
+	int fd;
+
+	if((fp = fopen(path, "r")) == NULL)
+	{
+		fprintf(stderr, "Unable to open capture file %s: %s\n",
+			path, strerror(errno));
+		exit(1);
+	}
+
+	if(fgets(readbuf, sizeof(readbuf), fp) == NULL ||
+	   strncmp(readbuf, CAPTURE_HEADER, strlen(CAPTURE_HEADER)))
+	{
+		fprintf(stderr, "%s is not a capture file\n", path);
+		exit(1);
+	}
+
+	if((s = strchr(readbuf, '\n')) != NULL)
+		*s = '\0';
+
+	if((fd = open("/dev/null", O_WRONLY)) < 0)
+	{
+		fprintf(stderr, "Unable to open /dev/null: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	/* the capture has the PASS password starred out */
+	conn_p = rb_malloc(sizeof(struct lconn));
+	conn_p->name = rb_strdup(readbuf + strlen(CAPTURE_HEADER));
+	conn_p->pass = rb_strdup("*");
+	conn_p->first_time = conn_p->last_time = rb_time();
+	conn_p->F = rb_open(fd, RB_FD_FILE, "capture replay");
+	SetConnHandshake(conn_p);
+	server_p = conn_p;
+
+	/* nothing would ever fire the write select */
+	config_file.flush_latency = 0;
+
+	latency_reset();
+	gettimeofday(&start, NULL);
+
+	while(fgets(readbuf, sizeof(readbuf), fp) != NULL)
+	{
+		/* skip the timestamp */
+		if(readbuf[0] == '#' || (s = strchr(readbuf, ' ')) == NULL)
+			continue;
+
+		s++;
+		len = strlen(s);
+
+		if(len > 0 && s[len-1] == '\n')
+			len--;
+
+		lines++;
+		parse_server_direct(s, len);
+
+		if(ConnDead(conn_p))
+		{
+			printf("Replay stopped at line %lu, connection closed\n", lines);
+			break;
+		}
+	}
+
+	gettimeofday(&end, NULL);
+	fclose(fp);
+
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+	getrusage(RUSAGE_SELF, &ru);
+
+	printf("Replayed %lu lines from %s in %.3f seconds (%.0f lines/sec)\n",
+		lines, conn_p->name, secs, secs > 0 ? lines / secs : 0.0);
+	printf("Peak RSS %ld KB\n", (long) ru.ru_maxrss);
+
+	latency_show(NULL, NULL);
+}
+
 /* read_client()
  *   reads some data from a client, exiting it on read errors
  *
@@ -747,6 +1157,85 @@ parse_server(char *buf, int len)
 	handle_scommand(source, command, (const char **) parv, parc);
 }
 
+/* parse_server_direct()
+ *   parses a line in place and calls the handler, splitting out the
+ *   source, command and parameters in a single pass.  The parameters
+ *   are split the same as rb_string_to_array() would.
+ *
+ * inputs	- line to parse, length of line (the byte after it, the
+ *		  newline, is overwritten)
+ * outputs	-
+ */
+static void
+parse_server_direct(char *buf, int len)
+{
+	static char *parv[MAXPARA + 1];
+	const char *command;
+	const char *source;
+	char *ch;
+	int parc = 0;
+
+	if(len >= BUFSIZE)
+		len = BUFSIZE - 1;
+
+	if(len > 0 && buf[len-1] == '\r')
+		len--;
+
+	buf[len] = '\0';
+
+	for(ch = buf; *ch == ' '; ch++)
+		;
+
+	source = server_p->name;
+
+	if(*ch == ':')
+	{
+		source = ++ch;
+
+		while(*ch && *ch != ' ')
+			ch++;
+
+		while(*ch == ' ')
+			*ch++ = '\0';
+	}
+
+	if(*ch == '\0')
+		return;
+
+	command = ch;
+
+	while(*ch && *ch != ' ')
+		ch++;
+
+	while(*ch == ' ')
+		*ch++ = '\0';
+
+	while(*ch)
+	{
+		/* the last parameter takes the rest of the line */
+		if(*ch == ':' || parc == MAXPARA - 1)
+		{
+			if(*ch == ':')
+				ch++;
+
+			parv[parc++] = ch;
+			break;
+		}
+
+		parv[parc++] = ch;
+
+		while(*ch && *ch != ' ')
+			ch++;
+
+		while(*ch == ' ')
+			*ch++ = '\0';
+	}
+
+	parv[parc] = NULL;
+
+	handle_scommand(source, command, (const char **) parv, parc);
+}
+
 /* parse_client()
  *   parses a given buffer and calls command handlers
  *
@@ -822,6 +1311,43 @@ parse_client(struct lconn *conn_p, char *buf, int len)
 
 
 
+/* server_queued()
+ *   called after lines are queued to our uplink, flushes them now or
+ *   once we get back to the event loop
+ */
+static void
+server_queued(void)
+{
+	if(config_file.flush_latency <= 0)
+	{
+		send_queued(server_p);
+		return;
+	}
+
+	/* hold the line back until we get back to the event loop, where
+	 * the write select fires and the whole lot is written in one go.
+	 * Long running handlers still flush every flush_latency ms.
+	 */
+	if(!(server_p->flags & CONN_FLAGS_FLUSH))
+	{
+		server_p->flags |= CONN_FLAGS_FLUSH;
+		gettimeofday(&flush_start, NULL);
+		rb_setselect(server_p->F, RB_SELECT_WRITE, write_sendq, server_p);
+	}
+	else if(rb_linebuf_len(&server_p->lb_sendq) >= FLUSH_MAX_SENDQ)
+		send_queued(server_p);
+	else
+	{
+		struct timeval now;
+
+		gettimeofday(&now, NULL);
+
+		if((now.tv_sec - flush_start.tv_sec) * 1000 +
+		   (now.tv_usec - flush_start.tv_usec) / 1000 >= config_file.flush_latency)
+			send_queued(server_p);
+	}
+}
+
 /* sendto_server()
  *   attempts to send the given data to our server
  *
@@ -841,7 +1367,28 @@ sendto_server(const char *format, ...)
 	va_end(args);
 	rb_linebuf_attach(&server_p->lb_sendq, &linebuf);
 	rb_linebuf_donebuf(&linebuf);
-	send_queued(server_p);
+
+	server_write_lines++;
+	server_queued();
+}
+
+/* sendto_server_buf()
+ *   queues a buffer of already formatted lines to our uplink
+ *
+ * inputs	- buffer of \r\n terminated lines, its length, number of lines
+ * outputs	-
+ */
+void
+sendto_server_buf(const char *buf, size_t len, unsigned int lines)
+{
+	if(server_p == NULL || ConnDead(server_p) || !len)
+		return;
+
+	/* raw keeps the line endings, so the lines go out as they are */
+	rb_linebuf_parse(&server_p->lb_sendq, (char *) buf, len, 1);
+
+	server_write_lines += lines;
+	server_queued();
 }
 
 /* sendto_one()
@@ -951,9 +1498,17 @@ static void
 send_queued(struct lconn *conn_p)
 {
 	int retlen;
+
+	conn_p->flags &= ~CONN_FLAGS_FLUSH;
+
+	/* rb_linebuf_flush() writes as many lines as it can with writev() */
 	while((retlen = rb_linebuf_flush(conn_p->F, &conn_p->lb_sendq)) > 0)
 	{
-		/* nothing to do here currently...update stats or something later? */	
+		if(conn_p == server_p)
+		{
+			server_write_calls++;
+			server_write_bytes += retlen;
+		}
 	}
 	
 	if(retlen == 0 || (retlen < 0 && !rb_ignore_errno(errno)))
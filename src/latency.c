@@ -0,0 +1,269 @@
+/* src/latency.c
+ *   Contains code for timing command handlers, hooks and events.
+ *
+ * Copyright (C) 2003-2012 ircd-ratbox development team
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1.Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * 2.Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * 3.The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id$
+ */
+#include "stdinc.h"
+#include "rserv.h"
+#include "tools.h"
+#include "conf.h"
+#include "io.h"
+#include "client.h"
+#include "latency.h"
+
+struct latency_event
+{
+	EVH *func;
+	void *arg;
+	struct latency_stat *stat;
+	rb_dlink_node node;
+};
+
+static rb_dlink_list latency_list[LATENCY_LAST];
+static rb_dlink_list latency_event_list;
+static time_t latency_reset_time;
+
+static const char *latency_type_names[LATENCY_LAST] = {
+	"Server commands",
+	"Service commands",
+	"DCC commands",
+	"Hooks",
+	"Events",
+};
+
+/* latency_find()
+ *   finds the stats for the given name, creating them if needed
+ *
+ * inputs	- LATENCY_ type, name
+ * outputs	- stats entry
+ */
+struct latency_stat *
+latency_find(int type, const char *name)
+{
+	struct latency_stat *stat;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, latency_list[type].head)
+	{
+		stat = ptr->data;
+
+		if(!strcasecmp(stat->name, name))
+			return stat;
+	}
+
+	stat = rb_malloc(sizeof(struct latency_stat));
+	stat->name = rb_strdup(name);
+	rb_dlinkAddTail(stat, &stat->node, &latency_list[type]);
+
+	if(!latency_reset_time)
+		latency_reset_time = rb_time();
+
+	return stat;
+}
+
+void
+latency_start(struct timespec *start)
+{
+	clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+/* latency_stop()
+ *   adds the time since latency_start() to the given stats
+ */
+void
+latency_stop(struct latency_stat *stat, struct timespec *start)
+{
+	struct timespec end;
+	unsigned long usec;
+	int bucket;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	usec = (end.tv_sec - start->tv_sec) * 1000000 +
+		(end.tv_nsec - start->tv_nsec) / 1000;
+
+	stat->count++;
+	stat->total += usec;
+
+	if(usec > stat->max)
+		stat->max = usec;
+
+	for(bucket = 0; bucket < LATENCY_BUCKETS - 1 && (usec >> bucket); bucket++)
+		;
+
+	stat->hist[bucket]++;
+}
+
+/* latency_reset()
+ *   zeroes every stats entry
+ */
+void
+latency_reset(void)
+{
+	struct latency_stat *stat;
+	rb_dlink_node *ptr;
+	int i;
+
+	for(i = 0; i < LATENCY_LAST; i++)
+	{
+		RB_DLINK_FOREACH(ptr, latency_list[i].head)
+		{
+			stat = ptr->data;
+
+			stat->count = 0;
+			stat->total = 0;
+			stat->max = 0;
+			memset(stat->hist, 0, sizeof(stat->hist));
+		}
+	}
+
+	latency_reset_time = rb_time();
+}
+
+static void
+latency_send(struct client *client_p, struct lconn *conn_p, const char *buf)
+{
+	if(client_p != NULL)
+		sendto_server(":%s 249 %s :%s", MYUID, UID(client_p), buf);
+	else if(conn_p != NULL)
+		sendto_one(conn_p, "%s", buf);
+	/* a capture replay */
+	else
+		printf("%s\n", buf);
+}
+
+/* latency_show()
+ *   shows the stats for everything that has been called since the
+ *   last reset, to either a client (STATS), a dcc connection or if
+ *   neither is given, stdout
+ */
+void
+latency_show(struct client *client_p, struct lconn *conn_p)
+{
+	struct latency_stat *stat;
+	rb_dlink_node *ptr;
+	char buf[BUFSIZE];
+	size_t len;
+	int i, j;
+
+	snprintf(buf, sizeof(buf), "Latency since %s ago (usec)",
+		get_duration(rb_time() - latency_reset_time));
+	latency_send(client_p, conn_p, buf);
+
+	for(i = 0; i < LATENCY_LAST; i++)
+	{
+		latency_send(client_p, conn_p, latency_type_names[i]);
+
+		RB_DLINK_FOREACH(ptr, latency_list[i].head)
+		{
+			stat = ptr->data;
+
+			if(stat->count == 0)
+				continue;
+
+			snprintf(buf, sizeof(buf),
+				"  %-24s calls %lu total %llu avg %lu max %lu",
+				stat->name, stat->count, stat->total,
+				(unsigned long) (stat->total / stat->count),
+				stat->max);
+			latency_send(client_p, conn_p, buf);
+
+			len = rb_strlcpy(buf, "   ", sizeof(buf));
+
+			for(j = 0; j < LATENCY_BUCKETS && len < sizeof(buf); j++)
+			{
+				if(stat->hist[j] == 0)
+					continue;
+
+				if(j == LATENCY_BUCKETS - 1)
+					len += snprintf(buf + len, sizeof(buf) - len,
+						" >=%lu:%lu", 1UL << (j - 1), stat->hist[j]);
+				else
+					len += snprintf(buf + len, sizeof(buf) - len,
+						" <%lu:%lu", 1UL << j, stat->hist[j]);
+			}
+
+			latency_send(client_p, conn_p, buf);
+		}
+	}
+}
+
+static void
+latency_event_call(void *data)
+{
+	struct latency_event *ev = data;
+	struct timespec start;
+
+	latency_start(&start);
+	(ev->func)(ev->arg);
+	latency_stop(ev->stat, &start);
+}
+
+/* find_latency_event()
+ *   finds the wrapper for an event callback, they are kept for reuse as
+ *   oneshot events are often added again and again.  The same callback
+ *   may be added under different names, which are timed apart.
+ */
+static struct latency_event *
+find_latency_event(const char *name, EVH *func, void *arg)
+{
+	struct latency_event *ev;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, latency_event_list.head)
+	{
+		ev = ptr->data;
+
+		if(ev->func == func && ev->arg == arg &&
+		   !strcasecmp(ev->stat->name, name))
+			return ev;
+	}
+
+	ev = rb_malloc(sizeof(struct latency_event));
+	ev->func = func;
+	ev->arg = arg;
+	ev->stat = latency_find(LATENCY_EVENT, name);
+	rb_dlinkAdd(ev, &ev->node, &latency_event_list);
+
+	return ev;
+}
+
+struct ev_entry *
+latency_event_add(const char *name, EVH *func, void *arg, time_t when)
+{
+	return rb_event_add(name, latency_event_call,
+				find_latency_event(name, func, arg), when);
+}
+
+struct ev_entry *
+latency_event_addonce(const char *name, EVH *func, void *arg, time_t when)
+{
+	return rb_event_addonce(name, latency_event_call,
+				find_latency_event(name, func, arg), when);
+}
@@ -108,6 +108,292 @@ match(const char *mask, const char *name)
 	return 0;
 }
 
+/* compile_mask()
+ *   compiles a mask for match_mask()
+ *
+ * inputs	- mask
+ * outputs	- compiled mask, to be freed with free_mask()
+ */
+struct match_mask *
+compile_mask(const char *mask)
+{
+	struct match_mask *cmask = rb_malloc(sizeof(struct match_mask));
+	char *p;
+	char *laststar = NULL;
+	unsigned int stars = 0;
+	unsigned int len;
+
+	cmask->mask = rb_strdup(EmptyString(mask) ? "" : mask);
+	collapse(cmask->mask);
+
+	for(p = cmask->mask; *p; p++)
+	{
+		*p = ToLower(*p);
+
+		if(*p == '*')
+		{
+			laststar = p;
+			stars++;
+			continue;
+		}
+
+		if(*p == '?')
+			cmask->qmark = 1;
+
+		cmask->minlen++;
+	}
+
+	len = p - cmask->mask;
+	p = cmask->mask;
+
+	if(len == 0)
+		cmask->type = MASK_NONE;
+	else if(stars == 0)
+	{
+		cmask->type = MASK_EXACT;
+		cmask->lit = p;
+		cmask->len = len;
+	}
+	else if(len == 1)
+		cmask->type = MASK_ANY;
+	else if(stars == 1 && p[len-1] == '*')
+	{
+		cmask->type = MASK_PREFIX;
+		cmask->lit = p;
+		cmask->len = len - 1;
+	}
+	else if(stars == 1 && p[0] == '*')
+	{
+		cmask->type = MASK_SUFFIX;
+		cmask->lit = p + 1;
+		cmask->len = len - 1;
+	}
+	else if(stars == 2 && p[0] == '*' && p[len-1] == '*')
+	{
+		cmask->type = MASK_INFIX;
+		cmask->lit = p + 1;
+		cmask->len = len - 2;
+	}
+	else
+	{
+		cmask->type = MASK_GENERAL;
+		cmask->lit = laststar + 1;
+		cmask->len = (p + len) - cmask->lit;
+	}
+
+	return cmask;
+}
+
+void
+free_mask(struct match_mask *cmask)
+{
+	if(cmask == NULL)
+		return;
+
+	rb_free(cmask->mask);
+	rb_free(cmask);
+}
+
+/* fold_name()
+ *   folds the case of a name, ready for match_mask_name().  A NULL name
+ *   is folded as an empty one.
+ */
+void
+fold_name(struct match_name *mname, const char *name)
+{
+	const char *s;
+	char *d = mname->name;
+
+	mname->orig = NULL;
+
+	if(name == NULL)
+		name = "";
+
+	for(s = name; *s; s++)
+	{
+		if(d == &mname->name[MATCH_NAMELEN-1])
+		{
+			/* leave this to match() */
+			mname->orig = name;
+			break;
+		}
+
+		*d++ = ToLower(*s);
+	}
+
+	*d = '\0';
+	mname->len = d - mname->name;
+}
+
+/* seg_equal()
+ *   compares a segment of a mask against the start of a name
+ */
+static inline int
+seg_equal(const char *name, const char *seg, unsigned int len, int qmark)
+{
+	unsigned int i;
+
+	if(!qmark)
+		return !memcmp(name, seg, len);
+
+	for(i = 0; i < len; i++)
+	{
+		if(seg[i] != name[i] && seg[i] != '?')
+			return 0;
+	}
+
+	return 1;
+}
+
+/* seg_find()
+ *   finds the first place a segment of a mask matches a name
+ *
+ * inputs	- name, end of name, segment, length of segment, if it has ?'s
+ * outputs	- where it matched, or NULL
+ */
+static const char *
+seg_find(const char *name, const char *end, const char *seg,
+		unsigned int len, int qmark)
+{
+	const char *last;
+
+	if((unsigned int) (end - name) < len)
+		return NULL;
+
+	last = end - len;
+
+	/* memchr() is plenty quick at finding the first character */
+	if(seg[0] != '?')
+	{
+		while(name <= last)
+		{
+			if((name = memchr(name, seg[0], last - name + 1)) == NULL)
+				return NULL;
+
+			if(seg_equal(name + 1, seg + 1, len - 1, qmark))
+				return name;
+
+			name++;
+		}
+
+		return NULL;
+	}
+
+	for(; name <= last; name++)
+	{
+		if(seg_equal(name, seg, len, qmark))
+			return name;
+	}
+
+	return NULL;
+}
+
+/* match_general()
+ *   matches a name against a mask with stars in its middle.  The first
+ *   and last segments are tied to the ends of the name, then each one
+ *   in between is matched at the first place it can be.  As every
+ *   segment is a fixed length, that leaves the most room for the rest.
+ */
+static int
+match_general(struct match_mask *cmask, const char *name, unsigned int len)
+{
+	const char *m = cmask->mask;
+	const char *laststar = cmask->lit - 1;
+	const char *end = name + len;
+	const char *s;
+	unsigned int seglen;
+
+	s = strchr(m, '*');
+	seglen = s - m;
+
+	if(!seg_equal(name, m, seglen, cmask->qmark))
+		return 0;
+
+	name += seglen;
+	m = s + 1;
+
+	if((unsigned int) (end - name) < cmask->len)
+		return 0;
+
+	end -= cmask->len;
+
+	if(!seg_equal(end, cmask->lit, cmask->len, cmask->qmark))
+		return 0;
+
+	while(m < laststar)
+	{
+		s = memchr(m, '*', laststar - m + 1);
+		seglen = s - m;
+
+		if((name = seg_find(name, end, m, seglen, cmask->qmark)) == NULL)
+			return 0;
+
+		name += seglen;
+		m = s + 1;
+	}
+
+	return 1;
+}
+
+/* match_mask_name()
+ *   matches a folded name against a compiled mask, the same as match()
+ *
+ * inputs	- compiled mask, folded name
+ * outputs	- 1 if it matches, else 0
+ */
+int
+match_mask_name(struct match_mask *cmask, struct match_name *mname)
+{
+	const char *name = mname->name;
+
+	if(mname->len == 0 || mname->len < cmask->minlen)
+		return 0;
+
+	if(mname->orig != NULL)
+		return match(cmask->mask, mname->orig);
+
+	switch(cmask->type)
+	{
+		case MASK_ANY:
+			return 1;
+
+		case MASK_EXACT:
+			return (mname->len == cmask->len &&
+				seg_equal(name, cmask->lit, cmask->len, cmask->qmark));
+
+		case MASK_PREFIX:
+			return seg_equal(name, cmask->lit, cmask->len, cmask->qmark);
+
+		case MASK_SUFFIX:
+			return seg_equal(name + mname->len - cmask->len, cmask->lit,
+					cmask->len, cmask->qmark);
+
+		case MASK_INFIX:
+			return (seg_find(name, name + mname->len, cmask->lit,
+					cmask->len, cmask->qmark) != NULL);
+
+		case MASK_GENERAL:
+			return match_general(cmask, name, mname->len);
+	}
+
+	return 0;
+}
+
+/* match_mask()
+ *   matches a name against a compiled mask, the same as match()
+ */
+int
+match_mask(struct match_mask *cmask, const char *name)
+{
+	struct match_name mname;
+
+	if(cmask->type == MASK_NONE || EmptyString(name))
+		return 0;
+
+	fold_name(&mname, name);
+	return match_mask_name(cmask, &mname);
+}
+
 /* collapse()
  *
  * collapses a string containing multiple *'s.
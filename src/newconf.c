@@ -824,6 +824,7 @@ conf_set_oper_user(void *data)
 		}
 
 		yy_tmpoper->server = rb_strdup(args_server->v.string);
+		yy_tmpoper->server_mask = compile_mask(yy_tmpoper->server);
 	}
 
 	if((args->type & CF_MTYPE) != CF_QSTRING)
@@ -835,6 +836,8 @@ conf_set_oper_user(void *data)
 	split_user_host(args->v.string, &username, &host);
 	yy_tmpoper->username = rb_strdup(username);
 	yy_tmpoper->host = rb_strdup(host);
+	yy_tmpoper->username_mask = compile_mask(username);
+	yy_tmpoper->host_mask = compile_mask(host);
 
         rb_dlinkAddTailAlloc(yy_tmpoper, &yy_oper_list);
 	yy_tmpoper = NULL;
@@ -1123,6 +1126,9 @@ static struct ConfEntry conf_serverinfo_table[] =
 	{ "dcc_high_port",	CF_INT,     NULL, 0, &config_file.dcc_high_port },
 	{ "reconnect_time",	CF_TIME,    NULL, 0, &config_file.reconnect_time },
 	{ "ping_time",		CF_TIME,    NULL, 0, &config_file.ping_time	},
+	{ "flush_latency",	CF_INT,     NULL, 0, &config_file.flush_latency },
+	{ "direct_parse",	CF_YESNO,   NULL, 0, &config_file.direct_parse },
+	{ "capture_file",	CF_QSTRING, NULL, 0, &config_file.capture_file },
 	{ "ratbox",		CF_YESNO,   NULL, 0, &config_file.ratbox	},
 	{ "allow_stats_o",	CF_YESNO,   NULL, 0, &config_file.allow_stats_o },
 	{ "allow_sslonly",	CF_YESNO,   NULL, 0, &config_file.allow_sslonly },
@@ -1150,6 +1156,8 @@ static struct ConfEntry conf_database_table[] =
 	{ "name",	CF_QSTRING,	NULL, 0, &config_file.db_name		},
 	{ "username",	CF_QSTRING,	NULL, 0, &config_file.db_username	},
 	{ "password",	CF_QSTRING,	NULL, 0, &config_file.db_password	},
+	{ "write_behind",	CF_YESNO, NULL, 0, &config_file.db_write_behind	},
+	{ "write_behind_queue",	CF_INT,	  NULL, 0, &config_file.db_write_behind_queue },
 	{ "\0", 0, NULL, 0, NULL }
 };
 
@@ -1293,6 +1301,7 @@ static struct ConfEntry conf_banserv_table[] =
 	{ "max_xline_matches",	CF_INT,  NULL, 0, &config_file.bs_max_xline_matches	},
 	{ "max_resv_matches",	CF_INT,  NULL, 0, &config_file.bs_max_resv_matches	},
 	{ "max_regexp_matches",	CF_INT,  NULL, 0, &config_file.bs_max_regexp_matches	},
+	{ "regexp_threads",	CF_INT,  NULL, 0, &config_file.bs_regexp_threads	},
 	{ "autosync_frequency",	CF_TIME, 	conf_set_banserv_autosync, 0, NULL },
 	{ "\0", 0, NULL, 0, NULL }
 };
@@ -1318,6 +1327,7 @@ static struct ConfEntry conf_chanfix_table[] =
 	{ "min_clients",	CF_INT,	NULL,	0,	&config_file.cf_min_clients		},
 	{ "client_needs_ident",	CF_YESNO,	NULL,	0,	&config_file.cf_client_needs_ident	},
 	{ "client_needs_dns",	CF_YESNO,	NULL,	0,	&config_file.cf_client_needs_dns	},
+	{ "memory_store",	CF_YESNO,	NULL,	0,	&config_file.cf_memory_store	},
 	{ "\0", 0, NULL, 0, NULL }
 };
 
@@ -0,0 +1,185 @@
+/* src/rsdb.c
+ *   Contains the backend independent prepared statement code.
+ *
+ * Copyright (C) 2012 ircd-ratbox development team
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1.Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * 2.Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * 3.The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id$
+ */
+#include "stdinc.h"
+#include "rsdb.h"
+#include "rserv.h"
+#include "log.h"
+
+rb_dlink_list rsdb_stmt_list;
+
+/* rsdb_stmt_declare()
+ * Finds or creates the prepared statement for the given sql, so each
+ * statement is only parsed by the database once.
+ *
+ * inputs	- sql, using '?' for each parameter
+ * outputs	- prepared statement, valid until rsdb_shutdown()
+ */
+struct rsdb_stmt *
+rsdb_stmt_declare(const char *sql)
+{
+	struct rsdb_stmt *stmt;
+	rb_dlink_node *ptr;
+	const char *p;
+	int quoted = 0;
+
+	RB_DLINK_FOREACH(ptr, rsdb_stmt_list.head)
+	{
+		stmt = ptr->data;
+
+		if(!strcmp(stmt->sql, sql))
+			return stmt;
+	}
+
+	stmt = rb_malloc(sizeof(struct rsdb_stmt));
+	stmt->sql = rb_strdup(sql);
+
+	for(p = sql; *p; p++)
+	{
+		if(*p == '\'')
+			quoted = !quoted;
+		else if(*p == '?' && !quoted)
+			stmt->param_count++;
+	}
+
+	if(stmt->param_count > RSDB_MAXPARAMS)
+	{
+		mlog("fatal error: too many parameters in sql statement: %s", sql);
+		die(0, "problem with compiling sql statement");
+	}
+
+	rsdb_stmt_prepare(stmt);
+	rb_dlinkAdd(stmt, &stmt->node, &rsdb_stmt_list);
+
+	return stmt;
+}
+
+static struct rsdb_param *
+rsdb_stmt_param(struct rsdb_stmt *stmt, int pos)
+{
+	struct rsdb_param *param;
+
+	if(pos < 1 || pos > stmt->param_count)
+	{
+		mlog("fatal error: invalid parameter %d for sql statement: %s",
+			pos, stmt->sql);
+		die(0, "problem with compiling sql statement");
+	}
+
+	param = &stmt->param[pos-1];
+
+	rb_free(param->strval);
+	param->strval = NULL;
+
+	return param;
+}
+
+void
+rsdb_stmt_bind_int(struct rsdb_stmt *stmt, int pos, long long value)
+{
+	struct rsdb_param *param = rsdb_stmt_param(stmt, pos);
+
+	param->type = RSDB_PARAM_INT;
+	param->intval = value;
+}
+
+void
+rsdb_stmt_bind_str(struct rsdb_stmt *stmt, int pos, const char *value)
+{
+	struct rsdb_param *param = rsdb_stmt_param(stmt, pos);
+
+	param->type = RSDB_PARAM_STR;
+	param->strval = rb_strdup(value);
+}
+
+void
+rsdb_stmt_bind_time(struct rsdb_stmt *stmt, int pos, time_t value)
+{
+	rsdb_stmt_bind_int(stmt, pos, (long long) value);
+}
+
+/* rsdb_stmt_exec()
+ * Executes a prepared statement with the currently bound parameters,
+ * which are then cleared ready for the next use.
+ *
+ * inputs	- statement, optional callback for each row
+ * outputs	-
+ */
+void
+rsdb_stmt_exec(struct rsdb_stmt *stmt, rsdb_callback cb)
+{
+	int i;
+
+	for(i = 0; i < stmt->param_count; i++)
+	{
+		if(stmt->param[i].type == RSDB_PARAM_NONE)
+		{
+			mlog("fatal error: unbound parameter %d for sql statement: %s",
+				i+1, stmt->sql);
+			die(0, "problem with compiling sql statement");
+		}
+	}
+
+	rsdb_stmt_execute(stmt, cb);
+	stmt->exec_count++;
+
+	for(i = 0; i < stmt->param_count; i++)
+	{
+		rb_free(stmt->param[i].strval);
+		stmt->param[i].strval = NULL;
+		stmt->param[i].type = RSDB_PARAM_NONE;
+	}
+}
+
+/* rsdb_stmt_free_all()
+ * Releases all prepared statements, called by the backends on shutdown.
+ */
+void
+rsdb_stmt_free_all(void)
+{
+	struct rsdb_stmt *stmt;
+	rb_dlink_node *ptr, *next_ptr;
+	int i;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, rsdb_stmt_list.head)
+	{
+		stmt = ptr->data;
+
+		rsdb_stmt_finalise(stmt);
+
+		for(i = 0; i < stmt->param_count; i++)
+			rb_free(stmt->param[i].strval);
+
+		rb_dlinkDelete(&stmt->node, &rsdb_stmt_list);
+		rb_free(stmt->sql);
+		rb_free(stmt);
+	}
+}
@@ -40,13 +40,13 @@
 #include "log.h"
 #include "tools.h"
 
-#define RSDB_MAXCOLS			30
 #define RSDB_MAX_RECONNECT_TIME		30
 
 MYSQL *rsdb_database;
 int rsdb_doing_transaction;
 
 static int rsdb_connect(int initial);
+static void rsdb_stmt_reprepare(void);
 
 /* rsdb_init()
  */
@@ -103,6 +103,7 @@ rsdb_connect(int initial)
 void
 rsdb_shutdown(void)
 {
+	rsdb_stmt_free_all();
 	mysql_close(rsdb_database);
 }
 
@@ -125,6 +126,22 @@ rsdb_try_reconnect(void)
 	die(0, "Unable to connect to mysql database: %s", mysql_error(rsdb_database));
 }
 
+/* rsdb_reconnect()
+ *   reconnects after the connection is lost.  Prepared statements belong
+ *   to the connection, so every one is declared again.
+ */
+static void
+rsdb_reconnect(void)
+{
+	/* try to reconnect immediately.. if that fails fall
+	 * into periodic reconnections
+	 */
+	if(rsdb_connect(0))
+		rsdb_try_reconnect();
+
+	rsdb_stmt_reprepare();
+}
+
 /* rsdb_handle_error()
  * Handles an error from the database
  *
@@ -151,12 +168,7 @@ rsdb_handle_error(MYSQL_RES **rsdb_result, const char *buf)
 
 		case CR_SERVER_GONE_ERROR:
 		case CR_SERVER_LOST:
-			/* try to reconnect immediately.. if that fails fall
-			 * into periodic reconnections
-			 */
-			if(rsdb_connect(0))
-				rsdb_try_reconnect();
-
+			rsdb_reconnect();
 			break;
 
 		default:
@@ -334,6 +346,89 @@ rsdb_exec_fetch_end(struct rsdb_table *table)
 	mysql_free_result((MYSQL_RES *) table->arg);
 }
 
+/* rsdb_cursor_open()
+ * Starts a query whose rows are then read one at a time with
+ * rsdb_cursor_next(), using mysql_use_result() so the result is never
+ * held in full.  Nothing else may use the database until the cursor is
+ * closed.
+ */
+void
+rsdb_cursor_open(struct rsdb_cursor *cursor, const char *format, ...)
+{
+	static char buf[BUFSIZE*4];
+	MYSQL_RES *rsdb_result;
+	va_list args;
+	int i;
+
+	va_start(args, format);
+	i = rs_vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+
+	if(i >= sizeof(buf))
+	{
+		mlog("fatal error: length problem compiling sql statement: %s", buf);
+		die(0, "length problem compiling sql statement");
+	}
+
+	if(mysql_query(rsdb_database, buf))
+		rsdb_handle_error(NULL, buf);
+
+	if((rsdb_result = mysql_use_result(rsdb_database)) == NULL)
+	{
+		mlog("fatal error: problem with db file: %s",
+			mysql_error(rsdb_database));
+		die(0, "problem with db file");
+	}
+
+	cursor->arg = rsdb_result;
+	cursor->pos = 0;
+	cursor->col_count = mysql_num_fields(rsdb_result);
+
+	if(cursor->col_count > RSDB_MAXCOLS)
+		die(0, "too many columns in result set -- contact the ratbox team");
+}
+
+const char **
+rsdb_cursor_next(struct rsdb_cursor *cursor)
+{
+	MYSQL_ROW row;
+	int i;
+
+	if(cursor->arg == NULL)
+		return NULL;
+
+	if((row = mysql_fetch_row((MYSQL_RES *) cursor->arg)) == NULL)
+	{
+		if(mysql_errno(rsdb_database))
+		{
+			mlog("fatal error: problem with db file: %s",
+				mysql_error(rsdb_database));
+			die(0, "problem with db file");
+		}
+
+		return NULL;
+	}
+
+	for(i = 0; i < cursor->col_count; i++)
+	{
+		cursor->row[i] = row[i];
+	}
+	cursor->row[i] = NULL;
+	cursor->pos++;
+
+	return cursor->row;
+}
+
+void
+rsdb_cursor_close(struct rsdb_cursor *cursor)
+{
+	/* this reads and discards any rows left */
+	if(cursor->arg != NULL)
+		mysql_free_result((MYSQL_RES *) cursor->arg);
+
+	cursor->arg = NULL;
+}
+
 void
 rsdb_transaction(rsdb_transtype type)
 {
@@ -349,3 +444,190 @@ rsdb_transaction(rsdb_transtype type)
 	}
 }
 
+void
+rsdb_get_stats(struct rsdb_stats *stats)
+{
+	memset(stats, 0, sizeof(struct rsdb_stats));
+}
+
+static MYSQL_STMT *
+rsdb_stmt_prepare_mysql(struct rsdb_stmt *stmt)
+{
+	MYSQL_STMT *handle;
+
+	if((handle = mysql_stmt_init(rsdb_database)) == NULL)
+		die(0, "Out of memory -- failed to initialise mysql statement");
+
+	if(mysql_stmt_prepare(handle, stmt->sql, strlen(stmt->sql)))
+	{
+		mlog("fatal error: problem preparing sql statement: %s: %s",
+			stmt->sql, mysql_stmt_error(handle));
+		die(0, "problem with compiling sql statement");
+	}
+
+	return handle;
+}
+
+/* rsdb_stmt_reprepare()
+ * Prepared statements belong to the connection, so after reconnecting
+ * they all need to be declared again.
+ */
+static void
+rsdb_stmt_reprepare(void)
+{
+	struct rsdb_stmt *stmt;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, rsdb_stmt_list.head)
+	{
+		stmt = ptr->data;
+
+		mysql_stmt_close((MYSQL_STMT *) stmt->handle);
+		stmt->handle = rsdb_stmt_prepare_mysql(stmt);
+	}
+}
+
+void
+rsdb_stmt_prepare(struct rsdb_stmt *stmt)
+{
+	stmt->handle = rsdb_stmt_prepare_mysql(stmt);
+}
+
+static int
+rsdb_stmt_execute_mysql(struct rsdb_stmt *stmt)
+{
+	MYSQL_BIND bind[RSDB_MAXPARAMS];
+	MYSQL_STMT *handle = stmt->handle;
+	int i;
+
+	memset(bind, 0, sizeof(bind));
+
+	for(i = 0; i < stmt->param_count; i++)
+	{
+		if(stmt->param[i].type == RSDB_PARAM_INT)
+		{
+			bind[i].buffer_type = MYSQL_TYPE_LONGLONG;
+			bind[i].buffer = &stmt->param[i].intval;
+		}
+		else
+		{
+			bind[i].buffer_type = MYSQL_TYPE_STRING;
+			bind[i].buffer = stmt->param[i].strval;
+			bind[i].buffer_length = strlen(stmt->param[i].strval);
+		}
+	}
+
+	if(mysql_stmt_bind_param(handle, bind))
+		return -1;
+
+	return mysql_stmt_execute(handle);
+}
+
+void
+rsdb_stmt_execute(struct rsdb_stmt *stmt, rsdb_callback cb)
+{
+	static char coldata_buf[RSDB_MAXCOLS][BUFSIZE*2];
+	static const char *coldata[RSDB_MAXCOLS+1];
+	MYSQL_BIND bind[RSDB_MAXCOLS];
+	unsigned long length[RSDB_MAXCOLS];
+	my_bool is_null[RSDB_MAXCOLS];
+	MYSQL_STMT *handle;
+	MYSQL_RES *metadata;
+	unsigned int field_count;
+	int i, ret;
+
+	if(rsdb_stmt_execute_mysql(stmt))
+	{
+		switch(mysql_stmt_errno((MYSQL_STMT *) stmt->handle))
+		{
+			case CR_SERVER_GONE_ERROR:
+			case CR_SERVER_LOST:
+				if(rsdb_doing_transaction)
+					break;
+
+				/* reconnect and try once more */
+				rsdb_reconnect();
+
+				if(!rsdb_stmt_execute_mysql(stmt))
+					goto executed;
+
+				break;
+
+			default:
+				break;
+		}
+
+		mlog("fatal error: problem with db file: %s",
+			mysql_stmt_error((MYSQL_STMT *) stmt->handle));
+		die(0, "problem with db file");
+	}
+
+executed:
+	handle = stmt->handle;
+	field_count = mysql_stmt_field_count(handle);
+
+	if(field_count > RSDB_MAXCOLS)
+		die(0, "too many columns in result set -- contact the ratbox team");
+
+	if(!field_count || !cb)
+	{
+		mysql_stmt_free_result(handle);
+		return;
+	}
+
+	if((metadata = mysql_stmt_result_metadata(handle)) == NULL)
+	{
+		mlog("fatal error: problem with db file: %s", mysql_stmt_error(handle));
+		die(0, "problem with db file");
+	}
+
+	memset(bind, 0, sizeof(bind));
+
+	for(i = 0; i < field_count; i++)
+	{
+		bind[i].buffer_type = MYSQL_TYPE_STRING;
+		bind[i].buffer = coldata_buf[i];
+		bind[i].buffer_length = sizeof(coldata_buf[i]) - 1;
+		bind[i].length = &length[i];
+		bind[i].is_null = &is_null[i];
+	}
+
+	if(mysql_stmt_bind_result(handle, bind) || mysql_stmt_store_result(handle))
+	{
+		mlog("fatal error: problem with db file: %s", mysql_stmt_error(handle));
+		die(0, "problem with db file");
+	}
+
+	while((ret = mysql_stmt_fetch(handle)) == 0 || ret == MYSQL_DATA_TRUNCATED)
+	{
+		for(i = 0; i < field_count; i++)
+		{
+			if(is_null[i])
+			{
+				coldata[i] = NULL;
+				continue;
+			}
+
+			if(length[i] >= sizeof(coldata_buf[i]))
+				length[i] = sizeof(coldata_buf[i]) - 1;
+
+			coldata_buf[i][length[i]] = '\0';
+			coldata[i] = coldata_buf[i];
+		}
+		coldata[i] = NULL;
+
+		(cb)((int) field_count, coldata);
+	}
+
+	mysql_free_result(metadata);
+	mysql_stmt_free_result(handle);
+}
+
+void
+rsdb_stmt_finalise(struct rsdb_stmt *stmt)
+{
+	if(stmt->handle != NULL)
+		mysql_stmt_close((MYSQL_STMT *) stmt->handle);
+
+	stmt->handle = NULL;
+}
@@ -39,13 +39,13 @@
 #include "log.h"
 #include "tools.h"
 
-#define RSDB_MAXCOLS			30
 #define RSDB_MAX_RECONNECT_TIME		30
 
 PGconn *rsdb_database;
 int rsdb_doing_transaction;
 
 static int rsdb_connect(int initial);
+static void rsdb_stmt_reprepare(void);
 
 /* rsdb_init()
  */
@@ -100,6 +100,7 @@ rsdb_connect(int initial)
 void
 rsdb_shutdown(void)
 {
+	rsdb_stmt_free_all();
 	PQfinish(rsdb_database);
 }
 
@@ -123,6 +124,21 @@ rsdb_try_reconnect(void)
 	die(0, "Unable to connect to postgresql database: %s", PQerrorMessage(rsdb_database));
 }
 
+/* rsdb_reconnect()
+ *   reconnects after the connection is lost.  Prepared statements belong
+ *   to the connection, so every one is declared again.
+ */
+static void
+rsdb_reconnect(void)
+{
+	PQreset(rsdb_database);
+
+	if(PQstatus(rsdb_database) != CONNECTION_OK)
+		rsdb_try_reconnect();
+
+	rsdb_stmt_reprepare();
+}
+
 /* rsdb_handle_connerror()
  * Handles a connection error from the database
  *
@@ -145,11 +161,7 @@ rsdb_handle_connerror(PGresult **rsdb_result, const char *buf)
 	switch(PQstatus(rsdb_database))
 	{
 		case CONNECTION_BAD:
-			PQreset(rsdb_database);
-
-			if(PQstatus(rsdb_database) != CONNECTION_OK)
-				rsdb_try_reconnect();
-
+			rsdb_reconnect();
 			break;
 
 		default:
@@ -355,6 +367,111 @@ rsdb_exec_fetch_end(struct rsdb_table *table)
 	PQclear(table->arg);
 }
 
+/* rsdb_cursor_open()
+ * Starts a query whose rows are then read one at a time with
+ * rsdb_cursor_next(), using libpq's single row mode so the result is
+ * never held in full.  Nothing else may use the database until the
+ * cursor is closed.
+ */
+void
+rsdb_cursor_open(struct rsdb_cursor *cursor, const char *format, ...)
+{
+	static char buf[BUFSIZE*4];
+	va_list args;
+	int i;
+
+	va_start(args, format);
+	i = rs_vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+
+	if(i >= sizeof(buf))
+	{
+		mlog("fatal error: length problem compiling sql statement: %s", buf);
+		die(0, "length problem compiling sql statement");
+	}
+
+	if(!PQsendQuery(rsdb_database, buf))
+	{
+		rsdb_handle_connerror(NULL, NULL);
+
+		if(!PQsendQuery(rsdb_database, buf))
+		{
+			mlog("fatal error: problem with db file: %s",
+				PQerrorMessage(rsdb_database));
+			die(0, "problem with db file");
+		}
+	}
+
+	/* if this fails we just get the rows in one result */
+	PQsetSingleRowMode(rsdb_database);
+
+	cursor->arg = NULL;
+	cursor->pos = 0;
+	cursor->col_count = 0;
+}
+
+const char **
+rsdb_cursor_next(struct rsdb_cursor *cursor)
+{
+	PGresult *rsdb_result = cursor->arg;
+	int i;
+
+	while(rsdb_result == NULL || cursor->pos >= PQntuples(rsdb_result))
+	{
+		if(rsdb_result != NULL)
+			PQclear(rsdb_result);
+
+		cursor->arg = rsdb_result = PQgetResult(rsdb_database);
+		cursor->pos = 0;
+
+		if(rsdb_result == NULL)
+			return NULL;
+
+		switch(PQresultStatus(rsdb_result))
+		{
+			case PGRES_SINGLE_TUPLE:
+			case PGRES_TUPLES_OK:
+			case PGRES_COMMAND_OK:
+				break;
+
+			default:
+				mlog("fatal error: problem with db file: %s",
+					PQresultErrorMessage(rsdb_result));
+				die(0, "problem with db file");
+				break;
+		}
+
+		cursor->col_count = PQnfields(rsdb_result);
+
+		if(cursor->col_count > RSDB_MAXCOLS)
+			die(0, "too many columns in result set -- contact the ratbox team");
+	}
+
+	for(i = 0; i < cursor->col_count; i++)
+	{
+		cursor->row[i] = PQgetvalue(rsdb_result, cursor->pos, i);
+	}
+	cursor->row[i] = NULL;
+	cursor->pos++;
+
+	return cursor->row;
+}
+
+void
+rsdb_cursor_close(struct rsdb_cursor *cursor)
+{
+	PGresult *rsdb_result;
+
+	if(cursor->arg != NULL)
+		PQclear(cursor->arg);
+
+	cursor->arg = NULL;
+
+	/* the connection cant be used again until every result is read */
+	while((rsdb_result = PQgetResult(rsdb_database)) != NULL)
+		PQclear(rsdb_result);
+}
+
 void
 rsdb_transaction(rsdb_transtype type)
 {
@@ -370,3 +487,179 @@ rsdb_transaction(rsdb_transtype type)
 	}
 }
 
+void
+rsdb_get_stats(struct rsdb_stats *stats)
+{
+	memset(stats, 0, sizeof(struct rsdb_stats));
+}
+
+/* rsdb_stmt_prepare_pg()
+ * Prepares a statement on the server, converting its '?' parameters to
+ * the $n postgresql expects.
+ */
+static PGresult *
+rsdb_stmt_prepare_pg(struct rsdb_stmt *stmt)
+{
+	char buf[BUFSIZE*4];
+	const char *p;
+	char *s = buf;
+	int quoted = 0;
+	int param = 0;
+
+	for(p = stmt->sql; *p && s < (buf + sizeof(buf) - 4); p++)
+	{
+		if(*p == '\'')
+			quoted = !quoted;
+
+		if(*p == '?' && !quoted)
+			s += rb_snprintf(s, 4, "$%d", ++param);
+		else
+			*s++ = *p;
+	}
+
+	if(*p)
+	{
+		mlog("fatal error: length problem compiling sql statement: %s", stmt->sql);
+		die(0, "length problem compiling sql statement");
+	}
+
+	*s = '\0';
+
+	return PQprepare(rsdb_database, (const char *) stmt->handle, buf, 
+			stmt->param_count, NULL);
+}
+
+/* rsdb_stmt_reprepare()
+ * Prepared statements belong to the connection, so after reconnecting
+ * they all need to be declared again.
+ */
+static void
+rsdb_stmt_reprepare(void)
+{
+	PGresult *rsdb_result;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, rsdb_stmt_list.head)
+	{
+		rsdb_result = rsdb_stmt_prepare_pg(ptr->data);
+
+		if(rsdb_result == NULL || PQresultStatus(rsdb_result) != PGRES_COMMAND_OK)
+		{
+			mlog("fatal error: problem preparing sql statement: %s",
+				PQerrorMessage(rsdb_database));
+			die(0, "problem with compiling sql statement");
+		}
+
+		PQclear(rsdb_result);
+	}
+}
+
+void
+rsdb_stmt_prepare(struct rsdb_stmt *stmt)
+{
+	static int stmt_id = 0;
+	PGresult *rsdb_result;
+	char name[20];
+
+	rb_snprintf(name, sizeof(name), "rsdb_stmt_%d", ++stmt_id);
+	stmt->handle = rb_strdup(name);
+
+	if((rsdb_result = rsdb_stmt_prepare_pg(stmt)) == NULL)
+	{
+		rsdb_handle_connerror(&rsdb_result, NULL);
+		rsdb_result = rsdb_stmt_prepare_pg(stmt);
+	}
+
+	if(rsdb_result == NULL || PQresultStatus(rsdb_result) != PGRES_COMMAND_OK)
+	{
+		mlog("fatal error: problem preparing sql statement: %s: %s",
+			stmt->sql, rsdb_result ? PQresultErrorMessage(rsdb_result) :
+			PQerrorMessage(rsdb_database));
+		die(0, "problem with compiling sql statement");
+	}
+
+	PQclear(rsdb_result);
+}
+
+void
+rsdb_stmt_execute(struct rsdb_stmt *stmt, rsdb_callback cb)
+{
+	static const char *coldata[RSDB_MAXCOLS+1];
+	char intbuf[RSDB_MAXPARAMS][24];
+	const char *values[RSDB_MAXPARAMS];
+	PGresult *rsdb_result;
+	unsigned int field_count, row_count;
+	int cur_row;
+	int i;
+
+	for(i = 0; i < stmt->param_count; i++)
+	{
+		if(stmt->param[i].type == RSDB_PARAM_INT)
+		{
+			rb_snprintf(intbuf[i], sizeof(intbuf[i]), "%lld", stmt->param[i].intval);
+			values[i] = intbuf[i];
+		}
+		else
+			values[i] = stmt->param[i].strval;
+	}
+
+	if((rsdb_result = PQexecPrepared(rsdb_database, (const char *) stmt->handle,
+					stmt->param_count, values, NULL, NULL, 0)) == NULL)
+	{
+		rsdb_handle_connerror(&rsdb_result, NULL);
+
+		if((rsdb_result = PQexecPrepared(rsdb_database, (const char *) stmt->handle,
+						stmt->param_count, values, NULL, NULL, 0)) == NULL)
+		{
+			mlog("fatal error: problem with db file: %s",
+				PQerrorMessage(rsdb_database));
+			die(0, "problem with db file");
+		}
+	}
+
+	switch(PQresultStatus(rsdb_result))
+	{
+		case PGRES_FATAL_ERROR:
+		case PGRES_BAD_RESPONSE:
+		case PGRES_EMPTY_QUERY:
+			mlog("fatal error: problem with db file: %s",
+				PQresultErrorMessage(rsdb_result));
+			die(0, "problem with db file");
+			break;
+		default:
+			break;
+	}
+
+	field_count = PQnfields(rsdb_result);
+	row_count = PQntuples(rsdb_result);
+
+	if(field_count > RSDB_MAXCOLS)
+		die(0, "too many columns in result set -- contact the ratbox team");
+
+	if(!field_count || !row_count || !cb)
+	{
+		PQclear(rsdb_result);
+		return;
+	}
+
+	for(cur_row = 0; cur_row < row_count; cur_row++)
+	{
+		for(i = 0; i < field_count; i++)
+		{
+			coldata[i] = PQgetvalue(rsdb_result, cur_row, i);
+		}
+		coldata[i] = NULL;
+
+		(cb)((int) field_count, coldata);
+	}
+
+	PQclear(rsdb_result);
+}
+
+void
+rsdb_stmt_finalise(struct rsdb_stmt *stmt)
+{
+	/* the server drops them when we disconnect */
+	rb_free(stmt->handle);
+	stmt->handle = NULL;
+}
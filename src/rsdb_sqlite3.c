@@ -33,7 +33,14 @@
 #include "stdinc.h"
 #include "rsdb.h"
 #include "rserv.h"
+#include "conf.h"
 #include "log.h"
+#include "latency.h"
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#include <signal.h>
+#endif
 
 /* build sqlite, so use local version */
 #ifdef SQLITE_BUILD
@@ -42,8 +49,63 @@
 #include <sqlite3.h>
 #endif
 
+/* how many times the write behind thread will retry a locked database,
+ * and how long it waits between tries (usec).  This only stalls the
+ * database thread, so we can afford to be far more patient than the
+ * main loop.
+ */
+#define RSDB_WB_BUSY_RETRIES	600
+#define RSDB_WB_BUSY_WAIT	100000
+
+/* sqlite3_prepare_v2() reports errors from sqlite3_step() directly and
+ * handles schema changes itself, older versions need us to do it.
+ */
+#if SQLITE_VERSION_NUMBER >= 3003009
+#define rsdb_sqlite3_prepare	sqlite3_prepare_v2
+#else
+#define rsdb_sqlite3_prepare	sqlite3_prepare
+#endif
+
 struct sqlite3 *rserv_db;
 
+static struct rsdb_stats rsdb_stats;
+
+/* open cursors hold the database handle, so nothing can be written
+ * behind until they are closed
+ */
+static int rsdb_cursor_count;
+
+static void rsdb_exec_sql(rsdb_callback cb, const char *buf);
+static int rsdb_stmt_run(struct rsdb_stmt *stmt, struct rsdb_param *param,
+			rsdb_callback cb, int max_busy, unsigned int busy_wait,
+			int *busy_count);
+
+#ifdef HAVE_LIBPTHREAD
+struct rsdb_wb_entry
+{
+	char *sql;
+	struct rsdb_stmt *stmt;
+	struct rsdb_param *param;
+	struct timeval queued;
+};
+
+static pthread_t rsdb_wb_thread;
+static pthread_mutex_t rsdb_wb_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rsdb_wb_cond_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t rsdb_wb_cond_done = PTHREAD_COND_INITIALIZER;
+
+static struct rsdb_wb_entry *rsdb_wb_queue;
+static unsigned int rsdb_wb_head;
+static unsigned int rsdb_wb_count;
+static int rsdb_wb_busy;
+static int rsdb_wb_exit;
+static char *rsdb_wb_error;
+
+static void rsdb_wb_sync(void);
+static void rsdb_wb_check(void *unused);
+static void *rsdb_wb_main(void *unused);
+#endif
+
 /* rsdb_init()
  */
 void
@@ -53,11 +115,54 @@ rsdb_init(void)
 	{
 		die(0, "Failed to open db file: %s", sqlite3_errmsg(rserv_db));
 	}
+
+	if(!config_file.db_write_behind)
+		return;
+
+#ifdef HAVE_LIBPTHREAD
+#if SQLITE_VERSION_NUMBER >= 3005000
+	if(!sqlite3_threadsafe())
+	{
+		mlog("Warning: sqlite3 was not built threadsafe, ignoring database::write_behind");
+		return;
+	}
+#endif
+
+	rsdb_stats.queue_max = config_file.db_write_behind_queue;
+	rsdb_wb_queue = rb_malloc(sizeof(struct rsdb_wb_entry) * rsdb_stats.queue_max);
+
+	if(pthread_create(&rsdb_wb_thread, NULL, rsdb_wb_main, NULL))
+		die(0, "Failed to start database write behind thread: %s",
+			strerror(errno));
+
+	rsdb_stats.write_behind = 1;
+	latency_event_add("rsdb_wb_check", rsdb_wb_check, NULL, 1);
+#else
+	mlog("Warning: no thread support, ignoring database::write_behind");
+#endif
 }
 
 void
 rsdb_shutdown(void)
 {
+#ifdef HAVE_LIBPTHREAD
+	if(rsdb_stats.write_behind)
+	{
+		/* flush whatever is still queued, then stop the thread */
+		rsdb_wb_sync();
+
+		pthread_mutex_lock(&rsdb_wb_lock);
+		rsdb_wb_exit = 1;
+		pthread_cond_signal(&rsdb_wb_cond_work);
+		pthread_mutex_unlock(&rsdb_wb_lock);
+
+		pthread_join(rsdb_wb_thread, NULL);
+		rsdb_stats.write_behind = 0;
+	}
+#endif
+
+	rsdb_stmt_free_all();
+
 	if(rserv_db)
 		sqlite3_close(rserv_db);
 }
@@ -92,26 +197,215 @@ rsdb_callback_func(void *cbfunc, int argc, char **argv, char **colnames)
 	return 0;
 }
 
-void
-rsdb_exec(rsdb_callback cb, const char *format, ...)
+#ifdef HAVE_LIBPTHREAD
+/* rsdb_wb_fatal()
+ * Called from the main thread when the write behind thread has hit an
+ * error it cannot recover from.
+ */
+static void
+rsdb_wb_fatal(void)
 {
-	static char errmsg_busy[] = "Database file locked";
-	static char buf[BUFSIZE*4];
-	va_list args;
-	char *errmsg;
-	int errcount = 0;
+	mlog("fatal error: problem with db file: %s", rsdb_wb_error);
+
+	/* the thread has stopped, so dont wait on it during die() */
+	rsdb_stats.write_behind = 0;
+	die(0, "problem with db file");
+}
+
+static void
+rsdb_wb_check(void *unused)
+{
+	if(rsdb_wb_error != NULL)
+		rsdb_wb_fatal();
+}
+
+/* rsdb_wb_add()
+ * Hands a statement to the write behind thread, waiting for space in
+ * the queue if it is full.  Either a plain sql string, or a prepared
+ * statement whose bound parameters are taken over by the queue.
+ */
+static void
+rsdb_wb_add(const char *buf, struct rsdb_stmt *stmt)
+{
+	struct rsdb_wb_entry *entry;
 	int i;
 
-	va_start(args, format);
-	i = rs_vsnprintf(buf, sizeof(buf), format, args);
-	va_end(args);
+	pthread_mutex_lock(&rsdb_wb_lock);
 
-	if(i >= sizeof(buf))
+	if(rsdb_wb_count >= rsdb_stats.queue_max && rsdb_wb_error == NULL)
 	{
-		mlog("fatal error: length problem with compiling sql");
-		die(0, "problem with compiling sql statement");
+		rsdb_stats.stalls++;
+
+		while(rsdb_wb_count >= rsdb_stats.queue_max && rsdb_wb_error == NULL)
+			pthread_cond_wait(&rsdb_wb_cond_done, &rsdb_wb_lock);
+	}
+
+	if(rsdb_wb_error != NULL)
+	{
+		pthread_mutex_unlock(&rsdb_wb_lock);
+		rsdb_wb_fatal();
+		return;
+	}
+
+	entry = &rsdb_wb_queue[(rsdb_wb_head + rsdb_wb_count) % rsdb_stats.queue_max];
+	gettimeofday(&entry->queued, NULL);
+
+	if(stmt != NULL)
+	{
+		entry->sql = NULL;
+		entry->stmt = stmt;
+		entry->param = rb_malloc(sizeof(struct rsdb_param) * (stmt->param_count + 1));
+		memcpy(entry->param, stmt->param, sizeof(struct rsdb_param) * stmt->param_count);
+
+		/* the strings belong to the queue now */
+		for(i = 0; i < stmt->param_count; i++)
+			stmt->param[i].strval = NULL;
+	}
+	else
+	{
+		entry->sql = rb_strdup(buf);
+		entry->stmt = NULL;
+		entry->param = NULL;
 	}
 
+	rsdb_wb_count++;
+	rsdb_stats.queued++;
+
+	if(rsdb_wb_count > rsdb_stats.queue_peak)
+		rsdb_stats.queue_peak = rsdb_wb_count;
+
+	pthread_cond_signal(&rsdb_wb_cond_work);
+	pthread_mutex_unlock(&rsdb_wb_lock);
+}
+
+/* rsdb_wb_sync()
+ * Waits until the write behind thread has finished everything queued,
+ * so the main thread can use the database handle and see its own
+ * writes.
+ */
+static void
+rsdb_wb_sync(void)
+{
+	if(!rsdb_stats.write_behind)
+		return;
+
+	pthread_mutex_lock(&rsdb_wb_lock);
+
+	if(rsdb_wb_count || rsdb_wb_busy)
+	{
+		rsdb_stats.syncs++;
+
+		while((rsdb_wb_count || rsdb_wb_busy) && rsdb_wb_error == NULL)
+			pthread_cond_wait(&rsdb_wb_cond_done, &rsdb_wb_lock);
+	}
+
+	pthread_mutex_unlock(&rsdb_wb_lock);
+
+	if(rsdb_wb_error != NULL)
+		rsdb_wb_fatal();
+}
+
+static void *
+rsdb_wb_main(void *unused)
+{
+	struct rsdb_wb_entry entry;
+	struct timeval now;
+	sigset_t sigs;
+	char *errmsg;
+	unsigned long latency;
+	int errcount;
+	int i, j;
+
+	/* signals are for the main thread */
+	sigfillset(&sigs);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	pthread_mutex_lock(&rsdb_wb_lock);
+
+	while(1)
+	{
+		while(!rsdb_wb_count && !rsdb_wb_exit)
+			pthread_cond_wait(&rsdb_wb_cond_work, &rsdb_wb_lock);
+
+		if(!rsdb_wb_count)
+			break;
+
+		entry = rsdb_wb_queue[rsdb_wb_head];
+		rsdb_wb_head = (rsdb_wb_head + 1) % rsdb_stats.queue_max;
+		rsdb_wb_count--;
+		rsdb_wb_busy = 1;
+
+		pthread_mutex_unlock(&rsdb_wb_lock);
+
+		errcount = 0;
+		errmsg = NULL;
+
+		if(entry.stmt != NULL)
+		{
+			i = rsdb_stmt_run(entry.stmt, entry.param, NULL,
+					RSDB_WB_BUSY_RETRIES, RSDB_WB_BUSY_WAIT, &errcount);
+
+			for(j = 0; j < entry.stmt->param_count; j++)
+				rb_free(entry.param[j].strval);
+
+			rb_free(entry.param);
+		}
+		else
+		{
+			while((i = sqlite3_exec(rserv_db, entry.sql, NULL, NULL, &errmsg)) == SQLITE_BUSY &&
+			      errcount < RSDB_WB_BUSY_RETRIES)
+			{
+				sqlite3_free(errmsg);
+				errmsg = NULL;
+				errcount++;
+				rb_sleep(0, RSDB_WB_BUSY_WAIT);
+			}
+		}
+
+		gettimeofday(&now, NULL);
+		latency = (now.tv_sec - entry.queued.tv_sec) * 1000000 +
+			(now.tv_usec - entry.queued.tv_usec);
+
+		pthread_mutex_lock(&rsdb_wb_lock);
+
+		rsdb_wb_busy = 0;
+		rsdb_stats.executed++;
+		rsdb_stats.busy_retries += errcount;
+		rsdb_stats.latency_total += latency;
+
+		if(latency > rsdb_stats.latency_max)
+			rsdb_stats.latency_max = latency;
+
+		rb_free(entry.sql);
+
+		if(i != SQLITE_OK)
+		{
+			/* we cant die() from here, leave it to the main
+			 * thread and stop touching the database
+			 */
+			rsdb_wb_error = rb_strdup(i == SQLITE_BUSY ? "Database file locked" :
+					(errmsg ? errmsg : sqlite3_errmsg(rserv_db)));
+			sqlite3_free(errmsg);
+			pthread_cond_broadcast(&rsdb_wb_cond_done);
+			break;
+		}
+
+		pthread_cond_broadcast(&rsdb_wb_cond_done);
+	}
+
+	pthread_mutex_unlock(&rsdb_wb_lock);
+	return NULL;
+}
+#endif
+
+static void
+rsdb_exec_sql(rsdb_callback cb, const char *buf)
+{
+	static char errmsg_busy[] = "Database file locked";
+	char *errmsg;
+	int errcount = 0;
+	int i;
+
 tryexec:
 	if((i = sqlite3_exec(rserv_db, buf, (cb ? rsdb_callback_func : NULL), cb, &errmsg)))
 	{
@@ -140,6 +434,42 @@ tryexec:
 	}
 }
 
+void
+rsdb_exec(rsdb_callback cb, const char *format, ...)
+{
+	static char buf[BUFSIZE*4];
+	va_list args;
+	int i;
+
+	va_start(args, format);
+	i = rs_vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+
+	if(i >= sizeof(buf))
+	{
+		mlog("fatal error: length problem with compiling sql");
+		die(0, "problem with compiling sql statement");
+	}
+
+#ifdef HAVE_LIBPTHREAD
+	/* statements with no results can be written behind, anything
+	 * returning rows must see the writes before it
+	 */
+	if(rsdb_stats.write_behind && !rsdb_cursor_count)
+	{
+		if(cb == NULL)
+		{
+			rsdb_wb_add(buf, NULL);
+			return;
+		}
+
+		rsdb_wb_sync();
+	}
+#endif
+
+	rsdb_exec_sql(cb, buf);
+}
+
 void
 rsdb_exec_insert(unsigned int *insert_id, const char *table_name, const char *field_name, const char *format, ...)
 {
@@ -157,7 +487,11 @@ rsdb_exec_insert(unsigned int *insert_id, const char *table_name, const char *fi
 		die(0, "problem with compiling sql statement");
 	}
 
-	rsdb_exec(NULL, "%s", buf);
+#ifdef HAVE_LIBPTHREAD
+	/* we need the rowid, so this cant be written behind */
+	rsdb_wb_sync();
+#endif
+	rsdb_exec_sql(NULL, buf);
 
 	*insert_id = (unsigned int) sqlite3_last_insert_rowid(rserv_db);
 }
@@ -184,6 +518,10 @@ rsdb_exec_fetch(struct rsdb_table *table, const char *format, ...)
 		die(0, "problem with compiling sql statement");
 	}
 
+#ifdef HAVE_LIBPTHREAD
+	rsdb_wb_sync();
+#endif
+
 tryexec:
 	if((i = sqlite3_get_table(rserv_db, buf, &data, &table->row_count, &table->col_count, &errmsg)))
 	{
@@ -248,6 +586,106 @@ rsdb_exec_fetch_end(struct rsdb_table *table)
 	sqlite3_free_table((char **) table->arg);
 }
 
+/* rsdb_cursor_open()
+ * Starts a query whose rows are then read one at a time with
+ * rsdb_cursor_next(), rather than loading the whole result.
+ */
+void
+rsdb_cursor_open(struct rsdb_cursor *cursor, const char *format, ...)
+{
+	static char buf[BUFSIZE*4];
+	sqlite3_stmt *handle;
+	va_list args;
+	int i;
+
+	va_start(args, format);
+	i = rs_vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+
+	if(i >= sizeof(buf))
+	{
+		mlog("fatal error: length problem with compiling sql");
+		die(0, "problem with compiling sql statement");
+	}
+
+#ifdef HAVE_LIBPTHREAD
+	rsdb_wb_sync();
+#endif
+
+	if(rsdb_sqlite3_prepare(rserv_db, buf, -1, &handle, NULL))
+	{
+		mlog("fatal error: problem with db file: %s", sqlite3_errmsg(rserv_db));
+		die(0, "problem with db file");
+	}
+
+	cursor->arg = handle;
+	cursor->pos = 0;
+	cursor->col_count = sqlite3_column_count(handle);
+
+	if(cursor->col_count > RSDB_MAXCOLS)
+		die(0, "too many columns in result set -- contact the ratbox team");
+
+	rsdb_cursor_count++;
+}
+
+/* rsdb_cursor_next()
+ * Returns the next row of an open cursor, or NULL when there are no
+ * more.  The row is only valid until the next call.
+ */
+const char **
+rsdb_cursor_next(struct rsdb_cursor *cursor)
+{
+	sqlite3_stmt *handle = cursor->arg;
+	int errcount = 0;
+	int i;
+
+	if(handle == NULL)
+		return NULL;
+
+	while((i = sqlite3_step(handle)) == SQLITE_BUSY && errcount < 10)
+	{
+		/* sleep for upto 5 seconds in 10 iterations */
+		errcount++;
+		rb_sleep(0, 500000);
+	}
+
+	switch(i)
+	{
+		case SQLITE_ROW:
+			break;
+
+		case SQLITE_DONE:
+			return NULL;
+
+		default:
+			/* with the legacy interface, the real error comes from reset */
+			sqlite3_reset(handle);
+			mlog("fatal error: problem with db file: %s",
+				i == SQLITE_BUSY ? "Database file locked" : sqlite3_errmsg(rserv_db));
+			die(0, "problem with db file");
+			return NULL;
+	}
+
+	for(i = 0; i < cursor->col_count; i++)
+		cursor->row[i] = (const char *) sqlite3_column_text(handle, i);
+
+	cursor->row[i] = NULL;
+	cursor->pos++;
+
+	return cursor->row;
+}
+
+void
+rsdb_cursor_close(struct rsdb_cursor *cursor)
+{
+	if(cursor->arg == NULL)
+		return;
+
+	sqlite3_finalize((sqlite3_stmt *) cursor->arg);
+	cursor->arg = NULL;
+	rsdb_cursor_count--;
+}
+
 void
 rsdb_transaction(rsdb_transtype type)
 {
@@ -257,3 +695,157 @@ rsdb_transaction(rsdb_transtype type)
 		rsdb_exec(NULL, "COMMIT TRANSACTION");
 }
 
+void
+rsdb_get_stats(struct rsdb_stats *stats)
+{
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_lock(&rsdb_wb_lock);
+	rsdb_stats.queue_len = rsdb_wb_count;
+	memcpy(stats, &rsdb_stats, sizeof(struct rsdb_stats));
+	pthread_mutex_unlock(&rsdb_wb_lock);
+#else
+	memcpy(stats, &rsdb_stats, sizeof(struct rsdb_stats));
+#endif
+}
+
+/* rsdb_stmt_run()
+ * Binds the given parameters to a prepared statement and steps through
+ * it, calling cb for each row.  Used by both the main thread and the
+ * write behind thread, so it must not die().
+ *
+ * inputs	- statement, parameters, optional callback, how many times
+ *		  and how long (usec) to wait on a locked database,
+ *		  counter of busy retries
+ * outputs	- sqlite result code, SQLITE_OK on success
+ */
+static int
+rsdb_stmt_run(struct rsdb_stmt *stmt, struct rsdb_param *param, rsdb_callback cb,
+		int max_busy, unsigned int busy_wait, int *busy_count)
+{
+	const char *coldata[RSDB_MAXCOLS+1];
+	sqlite3_stmt *handle;
+	int reprepared = 0;
+	int col_count;
+	int i, rc;
+
+retry:
+	if(stmt->handle == NULL &&
+	   rsdb_sqlite3_prepare(rserv_db, stmt->sql, -1, (sqlite3_stmt **) &stmt->handle, NULL))
+		return SQLITE_ERROR;
+
+	handle = stmt->handle;
+
+	for(i = 0; i < stmt->param_count; i++)
+	{
+		if(param[i].type == RSDB_PARAM_INT)
+			sqlite3_bind_int64(handle, i+1, (sqlite_int64) param[i].intval);
+		else
+			sqlite3_bind_text(handle, i+1, param[i].strval, -1, SQLITE_TRANSIENT);
+	}
+
+	col_count = sqlite3_column_count(handle);
+
+	if(col_count > RSDB_MAXCOLS)
+		col_count = RSDB_MAXCOLS;
+
+	while(1)
+	{
+		rc = sqlite3_step(handle);
+
+		if(rc == SQLITE_ROW)
+		{
+			if(cb == NULL)
+				continue;
+
+			for(i = 0; i < col_count; i++)
+				coldata[i] = (const char *) sqlite3_column_text(handle, i);
+			coldata[i] = NULL;
+
+			(cb)(col_count, coldata);
+		}
+		else if(rc == SQLITE_BUSY && *busy_count < max_busy)
+		{
+			(*busy_count)++;
+			rb_sleep(0, busy_wait);
+		}
+		else
+			break;
+	}
+
+	if(rc == SQLITE_DONE)
+	{
+		sqlite3_reset(handle);
+		return SQLITE_OK;
+	}
+
+	/* with the legacy interface, the real error comes from reset */
+	i = sqlite3_reset(handle);
+
+	if(rc == SQLITE_ERROR)
+		rc = i;
+
+	if(rc == SQLITE_SCHEMA && !reprepared)
+	{
+		sqlite3_finalize(handle);
+		stmt->handle = NULL;
+		reprepared = 1;
+		goto retry;
+	}
+
+	return rc;
+}
+
+void
+rsdb_stmt_prepare(struct rsdb_stmt *stmt)
+{
+#ifdef HAVE_LIBPTHREAD
+	/* the write behind thread may be using the handle */
+	rsdb_wb_sync();
+#endif
+
+	if(rsdb_sqlite3_prepare(rserv_db, stmt->sql, -1, (sqlite3_stmt **) &stmt->handle, NULL))
+	{
+		mlog("fatal error: problem preparing sql statement: %s: %s",
+			stmt->sql, sqlite3_errmsg(rserv_db));
+		die(0, "problem with compiling sql statement");
+	}
+}
+
+void
+rsdb_stmt_execute(struct rsdb_stmt *stmt, rsdb_callback cb)
+{
+	int busy_count = 0;
+	int rc;
+
+#ifdef HAVE_LIBPTHREAD
+	if(rsdb_stats.write_behind && !rsdb_cursor_count)
+	{
+		if(cb == NULL)
+		{
+			rsdb_wb_add(NULL, stmt);
+			return;
+		}
+
+		rsdb_wb_sync();
+	}
+#endif
+
+	/* sleep for upto 5 seconds in 10 iterations to try and get
+	 * through a locked database
+	 */
+	if((rc = rsdb_stmt_run(stmt, stmt->param, cb, 10, 500000, &busy_count)) != SQLITE_OK)
+	{
+		mlog("fatal error: problem with db file: %s",
+			rc == SQLITE_BUSY ? "Database file locked" : sqlite3_errmsg(rserv_db));
+		die(0, "problem with db file");
+	}
+}
+
+void
+rsdb_stmt_finalise(struct rsdb_stmt *stmt)
+{
+	if(stmt->handle != NULL)
+		sqlite3_finalize((sqlite3_stmt *) stmt->handle);
+
+	stmt->handle = NULL;
+}
@@ -49,6 +49,7 @@
 #include "ucommand.h"
 #include "client.h"
 #include "channel.h"
+#include "hashtab.h"
 #include "log.h"
 #include "c_init.h"
 #include "service.h"
@@ -60,6 +61,7 @@
 #include "serno.h"
 #include "s_userserv.h"
 #include "s_chanserv.h"
+#include "latency.h"
 
 struct timeval system_time;
 
@@ -161,11 +163,12 @@ write_pidfile(void)
 static void
 print_help(void)
 {
-	printf("ratbox-services [-h|-v|-f|-t]\n");
+	printf("ratbox-services [-h|-v|-f|-t|-R capture]\n");
 	printf(" -h show this help\n");
 	printf(" -v show version\n");
 	printf(" -f foreground mode\n");
 	printf(" -t test config\n");
+	printf(" -R replay a capture file, then exit\n");
 	printf(" -r change root directory\n");
 	printf(" -g change the real and effective group ID\n");
 	printf(" -u change the real and effective user ID\n");
@@ -200,6 +203,7 @@ main(int argc, char *argv[])
 	int chroot_gid = 0;
 	int retval;
 	char *chroot_path = NULL;
+	char *replay_path = NULL;
 
 	/* The seteuid() system call (setegid()) sets the effective user ID (group
 	 * ID) of the current process.  The effective user ID may be set to the
@@ -219,7 +223,7 @@ main(int argc, char *argv[])
 		}
 	}
 
-	while((c = getopt(argc, argv, "hvftr:g:u:")) != -1)
+	while((c = getopt(argc, argv, "hvftr:g:u:R:")) != -1)
 	{
 		switch(c)
 		{
@@ -241,6 +245,9 @@ main(int argc, char *argv[])
 			case 'r':
 				chroot_path = rb_strdup(optarg);
 				break;
+			case 'R':
+				replay_path = rb_strdup(optarg);
+				break;
 
 			case 'g':
 				chroot_gid = atoi(optarg);
@@ -355,10 +362,11 @@ main(int argc, char *argv[])
         nofork = 1;
 #endif
 
-	if(testing_conf)
+	if(testing_conf || replay_path != NULL)
 		nofork = 1;
 
-        if(!testing_conf)
+	/* a replay isn't the daemon, so leaves its pidfile alone */
+        if(!testing_conf && replay_path == NULL)
 	{
         	check_pidfile();
 
@@ -392,7 +400,8 @@ main(int argc, char *argv[])
 	open_logfile();
 
 	mlog("ratbox-services started%s",
-		testing_conf ? " (config test)" : "");
+		testing_conf ? " (config test)" :
+		replay_path != NULL ? " (capture replay)" : "");
 
 	signal(SIGHUP, sig_hup);
 	signal(SIGTERM, sig_term);
@@ -498,9 +507,15 @@ main(int argc, char *argv[])
 	/* db must be done before this */
 	init_services();
 
-	rb_event_add("update_service_floodcount", update_service_floodcount, 
+	if(replay_path != NULL)
+	{
+		replay_server(replay_path);
+		exit(0);
+	}
+
+	latency_event_add("update_service_floodcount", update_service_floodcount, 
 		NULL, 1);
-	rb_event_add("check_rehash", check_rehash, NULL, 2);
+	latency_event_add("check_rehash", check_rehash, NULL, 2);
 	add_server_events(); /* events from io.c */
        	write_pidfile();
 
@@ -509,7 +524,7 @@ main(int argc, char *argv[])
 	 */
 	rb_set_time();
 
-	rb_event_addonce("connect_to_server_startup", connect_to_server, NULL, 1);
+	latency_event_addonce("connect_to_server_startup", connect_to_server, NULL, 1);
 	/* enter main IO loop */
 
 	rb_lib_loop(0);
@@ -733,13 +748,9 @@ count_memory(struct client *client_p)
 				sz_bh_free, sz_bh_freemem);
 	}
 #endif
-	sz_hash_overhead += sizeof(rb_dlink_list) * MAX_NAME_HASH;		/* name_table */
-	sz_hash_overhead += sizeof(rb_dlink_list) * MAX_NAME_HASH;		/* uid_table */
 	sz_hash_overhead += sizeof(rb_dlink_list) * MAX_HOST_HASH;		/* host_table */
-	sz_hash_overhead += sizeof(rb_dlink_list) * MAX_CHANNEL_TABLE;	/* channel_table */
-	sz_hash_overhead += sizeof(rb_dlink_list) * MAX_NAME_HASH;		/* user_reg_table */
-	sz_hash_overhead += sizeof(rb_dlink_list) * MAX_CHANNEL_TABLE;	/* chan_reg_table */
-	sz_hash_overhead += sizeof(rb_dlink_list) * MAX_NAME_HASH;		/* nick_reg_table */
+	sz_hash_overhead += hashtab_total_memory();	/* name, channel and reg tables */
+	sz_hash_overhead += count_uid_memory();		/* uid_table */
 
 	sendto_server(":%s 988 %s :Hash Overhead: %u",
 			MYNAME, client_p->name, (unsigned int) sz_hash_overhead);
@@ -749,6 +760,7 @@ count_memory(struct client *client_p)
 	sz_conf += count_memory_string(config_file.gecos);
 	sz_conf += count_memory_string(config_file.vhost);
 	sz_conf += count_memory_string(config_file.dcc_vhost);
+	sz_conf += count_memory_string(config_file.capture_file);
 	sz_conf += count_memory_string(config_file.admin1);
 	sz_conf += count_memory_string(config_file.admin2);
 	sz_conf += count_memory_string(config_file.admin3);
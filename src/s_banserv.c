@@ -55,8 +55,17 @@
 #include "hook.h"
 #include "s_banserv.h"
 #include "tools.h"
+#include "latency.h"
+#include "acmatch.h"
+#include "hashtab.h"
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#include <signal.h>
+#endif
 
 static void init_s_banserv(void);
+static void banserv_stats(struct lconn *, const char **, int);
 
 struct ev_entry *banserv_expire_ev;
 struct ev_entry *banserv_autosync_ev;
@@ -121,7 +130,7 @@ static struct ucommand_handler banserv_ucommand[] =
 static struct service_handler banserv_service = {
 	"BANSERV", "BANSERV", "banserv", "services.int",
 	"Global Ban Service", 0, 0, 
-	banserv_command, sizeof(banserv_command), banserv_ucommand, init_s_banserv, NULL
+	banserv_command, sizeof(banserv_command), banserv_ucommand, init_s_banserv, banserv_stats
 };
 
 rb_dlink_list regexp_list;
@@ -135,11 +144,54 @@ static void e_banserv_autosync(void *unused);
 static int h_banserv_new_client(void *_client_p, void *unused);
 
 static void expire_operbans(void);
+static void load_operbans(void);
+static void operban_burst_add(struct operban *ban_p);
+static void operban_burst_dirty(char type);
 
 static void push_unban(const char *target, char type, const char *mask);
 static void sync_bans(const char *target, char banletter);
 
 static void regexp_free(struct regexp_ban *regexp_p, int neg);
+static pcre_extra *regexp_study(pcre *regexp);
+
+/* the regexps are checked against new clients in the order of
+ * regexp_list, but only those whose required literal the client
+ * contains need running.  regexp_build() rebuilds this from regexp_list
+ * whenever a regexp has been added or removed.
+ */
+static struct acmatch *regexp_prefilter;
+static struct regexp_ban **regexp_table;
+static unsigned int *regexp_marks;
+static unsigned int regexp_count;
+static unsigned int regexp_mark;
+static int regexp_dirty = 1;
+
+/* operbans by OPERBAN key, and those with a hold in a min heap on it, from
+ * operban_heap[1] up
+ */
+static struct hashtab *operban_table;
+static struct operban **operban_heap;
+static unsigned int operban_heap_count;
+static unsigned int operban_heap_size;
+
+/* the rendered lines for syncing, built when first needed */
+static struct operban_burst operban_burst[] =
+{
+	{ 'K', "KLINE",	NULL, 0, 0, NULL, 0, 0, 1 },
+	{ 'X', "XLINE",	NULL, 0, 0, NULL, 0, 0, 1 },
+	{ 'R', "RESV",	NULL, 0, 0, NULL, 0, 0, 1 },
+	{ '\0', NULL,	NULL, 0, 0, NULL, 0, 0, 0 }
+};
+
+static char operban_sync_buf[OPERBAN_SYNC_BUF];
+static size_t operban_sync_len;
+static unsigned int operban_sync_lines;
+
+static unsigned long operban_sync_count;
+static unsigned long operban_sync_total_lines;
+static unsigned long operban_sync_total_bytes;
+static unsigned int operban_sync_last_lines;
+static unsigned long operban_sync_last_bytes;
 
 void
 preinit_s_banserv(void)
@@ -164,13 +216,15 @@ init_s_banserv(void)
 	}
 
 		
-	banserv_expire_ev = rb_event_add("banserv_expire", e_banserv_expire, NULL, 900);
-	banserv_autosync_ev = rb_event_add("banserv_autosync", e_banserv_autosync, NULL,
+	banserv_expire_ev = latency_event_add("banserv_expire", e_banserv_expire, NULL, 900);
+	banserv_autosync_ev = latency_event_add("banserv_autosync", e_banserv_autosync, NULL,
 			DEFAULT_AUTOSYNC_FREQUENCY);
 
 	hook_add(h_banserv_new_client, HOOK_CLIENT_CONNECT);
 	hook_add(h_banserv_new_client, HOOK_CLIENT_CONNECT_BURST);
 
+	load_operbans();
+
 	rsdb_exec(regexp_callback, "SELECT id, regex, reason, hold, create_time, oper FROM operbans_regexp");
 	rsdb_exec(regexp_neg_callback, "SELECT id, parent_id, regex, oper FROM operbans_regexp_neg");
 }
@@ -199,8 +253,11 @@ regexp_callback(int argc, const char **argv)
 	regexp_p->create_time = atol(argv[4]);
 	regexp_p->oper = rb_strdup(argv[5]);
 	regexp_p->regexp = regexp_comp;
+	regexp_p->extra = regexp_study(regexp_comp);
+	regexp_p->literal = regexp_literal(argv[1], REGEXP_LITERAL_MIN);
 
 	rb_dlinkAddTail(regexp_p, &regexp_p->ptr, &regexp_list);
+	regexp_dirty = 1;
 	return 0;
 }
 
@@ -243,6 +300,8 @@ regexp_neg_callback(int argc, const char **argv)
 	regexp_p->regexp_str = rb_strdup(argv[2]);
 	regexp_p->oper = rb_strdup(argv[3]);
 	regexp_p->parent = parent_p;
+	regexp_p->regexp = regexp_comp;
+	regexp_p->extra = regexp_study(regexp_comp);
 
 	rb_dlinkAddTail(regexp_p, &regexp_p->ptr, &parent_p->negations);
 	return 0;
@@ -254,14 +313,273 @@ e_banserv_autosync(void *unused)
 	sync_bans("*", 0);
 }
 
+static void
+banserv_stats(struct lconn *conn_p, const char **parv, int parc)
+{
+	sendto_one(conn_p, " Operbans: %lu Syncs: %lu",
+			(unsigned long) hashtab_count(operban_table),
+			operban_sync_count);
+	sendto_one(conn_p, " Sync output: %lu lines %lu bytes, last %u lines %lu bytes",
+			operban_sync_total_lines, operban_sync_total_bytes,
+			operban_sync_last_lines, operban_sync_last_bytes);
+}
+
+static const char *
+operban_key(char type, const char *mask)
+{
+	static char buf[BUFSIZE+1];
+
+	buf[0] = type;
+	rb_strlcpy(buf + 1, lcase(mask), sizeof(buf) - 1);
+	return buf;
+}
+
+static void
+operban_heap_swap(unsigned int a, unsigned int b)
+{
+	struct operban *tmp = operban_heap[a];
+
+	operban_heap[a] = operban_heap[b];
+	operban_heap[b] = tmp;
+	operban_heap[a]->heap_pos = a;
+	operban_heap[b]->heap_pos = b;
+}
+
+static void
+operban_heap_up(unsigned int pos)
+{
+	while(pos > 1 && operban_heap[pos]->hold < operban_heap[pos / 2]->hold)
+	{
+		operban_heap_swap(pos, pos / 2);
+		pos /= 2;
+	}
+}
+
+static void
+operban_heap_down(unsigned int pos)
+{
+	unsigned int child;
+
+	while((child = pos * 2) <= operban_heap_count)
+	{
+		if(child < operban_heap_count &&
+		   operban_heap[child+1]->hold < operban_heap[child]->hold)
+			child++;
+
+		if(operban_heap[pos]->hold <= operban_heap[child]->hold)
+			break;
+
+		operban_heap_swap(pos, child);
+		pos = child;
+	}
+}
+
+static void
+operban_heap_add(struct operban *ban_p)
+{
+	if(operban_heap_count + 1 >= operban_heap_size)
+	{
+		operban_heap_size = operban_heap_size ? operban_heap_size * 2 : 64;
+		operban_heap = rb_realloc(operban_heap,
+				sizeof(struct operban *) * operban_heap_size);
+	}
+
+	ban_p->heap_pos = ++operban_heap_count;
+	operban_heap[ban_p->heap_pos] = ban_p;
+	operban_heap_up(ban_p->heap_pos);
+}
+
+static void
+operban_heap_del(struct operban *ban_p)
+{
+	unsigned int pos = ban_p->heap_pos;
+
+	if(pos == 0)
+		return;
+
+	ban_p->heap_pos = 0;
+
+	if(pos != operban_heap_count)
+	{
+		operban_heap[pos] = operban_heap[operban_heap_count--];
+		operban_heap[pos]->heap_pos = pos;
+		operban_heap_up(pos);
+		operban_heap_down(pos);
+	}
+	else
+		operban_heap_count--;
+}
+
+static struct operban *
+make_operban(char type, const char *mask, const char *reason,
+		const char *operreason, time_t hold, time_t create_time,
+		const char *oper, int remove)
+{
+	struct operban *ban_p = rb_malloc(sizeof(struct operban));
+
+	ban_p->key = rb_strdup(operban_key(type, mask));
+	ban_p->reason = rb_strdup(reason);
+	ban_p->operreason = EmptyString(operreason) ? NULL : rb_strdup(operreason);
+	ban_p->oper = rb_strdup(oper);
+	ban_p->hold = hold;
+	ban_p->create_time = create_time;
+	ban_p->remove = remove;
+
+	hashtab_add(operban_table, ban_p->key, ban_p);
+
+	if(ban_p->hold)
+		operban_heap_add(ban_p);
+
+	operban_burst_add(ban_p);
+
+	return ban_p;
+}
+
+static void
+free_operban(struct operban *ban_p)
+{
+	operban_burst_dirty(OPERBAN_TYPE(ban_p));
+	operban_heap_del(ban_p);
+	hashtab_del(operban_table, ban_p->key, ban_p);
+
+	rb_free(ban_p->key);
+	rb_free(ban_p->reason);
+	rb_free(ban_p->operreason);
+	rb_free(ban_p->oper);
+	rb_free(ban_p);
+}
+
+/* load_operbans()
+ *   loads the operbans table into memory
+ */
+static void
+load_operbans(void)
+{
+	struct rsdb_cursor cursor;
+	const char **row;
+	int remove;
+
+	operban_table = hashtab_create(OPERBAN_HASH_SIZE, strcmp);
+
+	rsdb_cursor_open(&cursor, "SELECT type, mask, reason, operreason, hold, "
+				"create_time, oper, remove FROM operbans");
+
+	while((row = rsdb_cursor_next(&cursor)))
+	{
+		if(EmptyString(row[0]) || EmptyString(row[1]))
+			continue;
+
+		/* pgsql stores booleans as t/f */
+		remove = (!EmptyString(row[7]) &&
+				(atoi(row[7]) == 1 || row[7][0] == 't'));
+
+		make_operban(row[0][0], row[1], EmptyString(row[2]) ? "" : row[2],
+				row[3], atol(row[4]), atol(row[5]),
+				EmptyString(row[6]) ? "" : row[6], remove);
+	}
+
+	rsdb_cursor_close(&cursor);
+
+	expire_operbans();
+}
+
+/* find_operban()
+ *   finds an operban, expiring any that are due first
+ */
+static struct operban *
+find_operban(char type, const char *mask)
+{
+	expire_operbans();
+
+	return hashtab_find(operban_table, operban_key(type, mask));
+}
+
+/* set_operban()
+ *   places an operban, or replaces the one on the same mask
+ *
+ * inputs	- type, mask, reason, hold time or 0, oper placing it
+ * outputs	-
+ */
+static void
+set_operban(char type, const char *mask, const char *reason, time_t hold,
+		const char *oper)
+{
+	struct operban *ban_p;
+
+	if((ban_p = find_operban(type, mask)) == NULL)
+	{
+		make_operban(type, mask, reason, NULL, hold, rb_time(), oper, 0);
+
+		rsdb_exec(NULL, "INSERT INTO operbans "
+				"(type, mask, reason, hold, create_time, "
+				"oper, remove, flags) "
+				"VALUES('%c', '%Q', '%Q', '%lu', '%lu', '%Q', '0', '0')",
+				type, lcase(mask), reason,
+				(unsigned long) hold, rb_time(), oper);
+		return;
+	}
+
+	operban_burst_dirty(type);
+
+	rb_free(ban_p->reason);
+	rb_free(ban_p->oper);
+	ban_p->reason = rb_strdup(reason);
+	ban_p->oper = rb_strdup(oper);
+	ban_p->remove = 0;
+
+	operban_heap_del(ban_p);
+	ban_p->hold = hold;
+
+	if(ban_p->hold)
+		operban_heap_add(ban_p);
+
+	rsdb_exec(NULL, "UPDATE operbans SET reason='%Q', "
+			"hold='%ld', oper='%Q', remove='0' WHERE "
+			"type='%c' AND mask='%Q'",
+			reason, (long) hold, oper, type, lcase(mask));
+}
+
+/* remove_operban()
+ *   marks an operban as removed, it is kept so the removal can be
+ *   synced to servers until unban_time passes
+ */
+static void
+remove_operban(char type, const char *mask)
+{
+	struct operban *ban_p;
+
+	if((ban_p = find_operban(type, mask)) == NULL)
+		return;
+
+	operban_burst_dirty(type);
+	ban_p->remove = 1;
+
+	operban_heap_del(ban_p);
+	ban_p->hold = rb_time() + config_file.bs_unban_time;
+	operban_heap_add(ban_p);
+
+	rsdb_exec(NULL, "UPDATE operbans SET remove='1', hold='%lu' "
+			"WHERE mask='%Q' AND type='%c'",
+			(unsigned long) ban_p->hold, lcase(mask), type);
+}
+
 static void
 expire_operbans(void)
 {
+	struct operban *ban_p;
+
 	/* these bans are temp, so they will expire automatically on 
 	 * servers
 	 */
-	rsdb_exec(NULL, "DELETE FROM operbans WHERE hold != '0' AND hold <= '%lu'",
-		rb_time());
+	while(operban_heap_count && operban_heap[1]->hold <= rb_time())
+	{
+		ban_p = operban_heap[1];
+
+		rsdb_exec(NULL, "DELETE FROM operbans WHERE type='%c' AND mask='%Q'",
+				OPERBAN_TYPE(ban_p), OPERBAN_MASK(ban_p));
+
+		free_operban(ban_p);
+	}
 }
 
 static void
@@ -282,25 +600,113 @@ e_banserv_expire(void *unused)
 	}
 }
 
+/* regexp_study()
+ *   studies a regexp, so pcre_exec() can run it faster
+ */
+static pcre_extra *
+regexp_study(pcre *regexp)
+{
+	const char *re_error;
+
+#ifdef PCRE_STUDY_JIT_COMPILE
+	return pcre_study(regexp, PCRE_STUDY_JIT_COMPILE, &re_error);
+#else
+	return pcre_study(regexp, 0, &re_error);
+#endif
+}
+
+static void
+regexp_free_study(pcre_extra *extra)
+{
+	if(extra == NULL)
+		return;
+
+#ifdef PCRE_STUDY_JIT_COMPILE
+	pcre_free_study(extra);
+#else
+	pcre_free(extra);
+#endif
+}
+
+/* regexp_build()
+ *   rebuilds the table and prefilter of regexp_list
+ */
+static void
+regexp_build(void)
+{
+	struct regexp_ban *regexp_p;
+	rb_dlink_node *ptr;
+	unsigned int i = 0;
+
+	acmatch_free(regexp_prefilter);
+	rb_free(regexp_table);
+	rb_free(regexp_marks);
+
+	regexp_count = rb_dlink_list_length(&regexp_list);
+	regexp_table = rb_malloc(sizeof(struct regexp_ban *) * (regexp_count + 1));
+	regexp_marks = rb_malloc(sizeof(unsigned int) * (regexp_count + 1));
+	regexp_mark = 0;
+
+	regexp_prefilter = acmatch_create();
+
+	RB_DLINK_FOREACH(ptr, regexp_list.head)
+	{
+		regexp_p = ptr->data;
+
+		if(regexp_p->literal != NULL)
+			acmatch_add(regexp_prefilter, regexp_p->literal, i);
+
+		regexp_table[i++] = regexp_p;
+	}
+
+	acmatch_build(regexp_prefilter);
+	regexp_dirty = 0;
+}
+
 static int
 h_banserv_new_client(void *_target_p, void *unused)
 {
 	char buf[BUFSIZE];
-	int ovector[30];
 	struct regexp_ban *regexp_p;
 	struct regexp_ban *neg_p;
 	struct client *target_p = _target_p;
+	unsigned int count;
+	unsigned int i;
 	int buflen;
-	rb_dlink_node *ptr;
-	rb_dlink_node *next_ptr;
 	rb_dlink_node *neg_ptr;
 
+	if(regexp_dirty)
+		regexp_build();
+
+	if(regexp_count == 0)
+		return 0;
+
 	buflen = snprintf(buf, sizeof(buf), "%s#%s",
 			target_p->user->mask, target_p->info);
 
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, regexp_list.head)
+	if(buflen >= (int) sizeof(buf))
+		buflen = sizeof(buf) - 1;
+
+	if(++regexp_mark == 0)
 	{
-		regexp_p = ptr->data;
+		memset(regexp_marks, 0, sizeof(unsigned int) * regexp_count);
+		regexp_mark = 1;
+	}
+
+	acmatch_scan(regexp_prefilter, buf, buflen, regexp_marks, regexp_mark);
+
+	/* regexp_free() may mark the table for a rebuild as we go, but
+	 * leaves the rest of it intact
+	 */
+	count = regexp_count;
+
+	for(i = 0; i < count; i++)
+	{
+		regexp_p = regexp_table[i];
+
+		/* cant match without its literal */
+		if(regexp_p->literal != NULL && regexp_marks[i] != regexp_mark)
+			continue;
 
 		/* regexp has expired */
 		if(regexp_p->hold && regexp_p->hold <= rb_time())
@@ -309,14 +715,14 @@ h_banserv_new_client(void *_target_p, void *unused)
 			continue;
 		}
 
-		if(pcre_exec(regexp_p->regexp, NULL, buf, buflen, 0, 0, ovector, 30) >= 0)
+		if(pcre_exec(regexp_p->regexp, regexp_p->extra, buf, buflen, 0, 0, NULL, 0) >= 0)
 		{
 			RB_DLINK_FOREACH(neg_ptr, regexp_p->negations.head)
 			{
 				neg_p = neg_ptr->data;
 
 				/* matches a negation, return */
-				if(pcre_exec(regexp_p->regexp, NULL, buf, buflen, 0, 0, ovector, 30) >= 0)
+				if(pcre_exec(neg_p->regexp, neg_p->extra, buf, buflen, 0, 0, NULL, 0) >= 0)
 					return 0;
 			}
 
@@ -364,37 +770,16 @@ split_ban(const char *mask, char **user, char **host)
 static int
 find_ban(const char *mask, char type)
 {
-	struct rsdb_table data;
-	int retval;
-
-	/* The case of "ban exists but has expired" can be a bit of a pain to deal 
-	 * with, so shortcut it by simply expiring all bans prior to checking.
-	 *
-	 * This function shouldn't be used enough for it to be a problem --anfl
-	 */
-	expire_operbans();
-
-	rsdb_exec_fetch(&data, "SELECT remove FROM operbans WHERE type='%c' AND mask='%Q' LIMIT 1",
-			type, lcase(mask));
+	struct operban *ban_p;
 
-	if(data.row_count)
-	{
-		/* pgsql stores booleans as t/f */
-		if(atoi(data.row[0][0]) == 1 || (data.row[0][0] && data.row[0][0][0] == 't'))
-			retval = -1;
-		else
-			retval = 1;
-	}
-	else
-		retval = 0;
-
-	rsdb_exec_fetch_end(&data);
+	if((ban_p = find_operban(type, mask)) == NULL)
+		return 0;
 
-	return retval;
+	return ban_p->remove ? -1 : 1;
 }
 
 /* find_ban_remove()
- * Finds bans in the database suitable for removing.
+ * Finds bans suitable for removing.
  * 
  * inputs	- mask, type (K/X/R)
  * outputs	- oper who set the ban, NULL if none found
@@ -403,31 +788,12 @@ find_ban(const char *mask, char type)
 static const char *
 find_ban_remove(const char *mask, char type)
 {
-	static char buf[BUFSIZE];
-	struct rsdb_table data;
-	const char *retval;
+	struct operban *ban_p;
 
-	/* The case of "ban exists but has expired" can be a bit of a pain to deal 
-	 * with, so shortcut it by simply expiring all bans prior to checking.
-	 *
-	 * This function shouldn't be used enough for it to be a problem --anfl
-	 */
-	expire_operbans();
-
-	rsdb_exec_fetch(&data, "SELECT remove, oper FROM operbans WHERE type='%c' AND mask='%Q' LIMIT 1",
-			type, lcase(mask));
-
-	if(data.row_count && (atoi(data.row[0][0]) == 0 || (data.row[0][0] && data.row[0][0][0] == 'f')))
-	{
-		rb_strlcpy(buf, data.row[0][1], sizeof(buf));
-		retval = buf;
-	}
-	else
-		retval = NULL;
-
-	rsdb_exec_fetch_end(&data);
+	if((ban_p = find_operban(type, mask)) == NULL || ban_p->remove)
+		return NULL;
 
-	return retval;
+	return ban_p->oper;
 }
 
 static void
@@ -451,13 +817,18 @@ regexp_free(struct regexp_ban *regexp_p, int neg)
 	}
 
 	pcre_free(regexp_p->regexp);
+	regexp_free_study(regexp_p->extra);
 
 	if(neg)
 		rb_dlinkDelete(&regexp_p->ptr, &regexp_p->parent->negations);
 	else
+	{
 		rb_dlinkDelete(&regexp_p->ptr, &regexp_list);
+		regexp_dirty = 1;
+	}
 
 	rb_free(regexp_p->regexp_str);
+	rb_free(regexp_p->literal);
 	rb_free(regexp_p->reason);
 	rb_free(regexp_p->oper);
 	rb_free(regexp_p);
@@ -521,75 +892,460 @@ push_unban(const char *target, char type, const char *mask)
 				SVC_UID(banserv_p), target, mask);
 }
 
+static struct operban_burst *
+find_operban_burst(char type)
+{
+	struct operban_burst *burst;
+
+	for(burst = operban_burst; burst->type; burst++)
+	{
+		if(burst->type == type)
+			return burst;
+	}
+
+	return NULL;
+}
+
+/* operban_burst_dirty()
+ *   marks the rendered lines for a ban type as needing a rebuild
+ */
 static void
-sync_bans(const char *target, char banletter)
+operban_burst_dirty(char type)
 {
-	struct rsdb_table data;
-	int i;
+	struct operban_burst *burst = find_operban_burst(type);
 
-	/* first is temporary bans */
-	if(banletter)
-		rsdb_exec_fetch(&data, "SELECT type, mask, reason, hold FROM operbans "
-					"WHERE hold > '%lu' AND remove='0' AND type='%c'",
-				rb_time(), banletter);
+	if(burst != NULL)
+		burst->dirty = 1;
+}
+
+static void
+operban_burst_render(struct operban_burst *burst, struct operban *ban_p)
+{
+	char buf[BUFSIZE];
+	struct operban_line *line;
+	char *user, *host;
+	int unban_len, len;
+
+	if(burst->type == 'K')
+	{
+		if(!split_ban(OPERBAN_MASK(ban_p), &user, &host))
+			return;
+
+		unban_len = snprintf(buf, sizeof(buf), " %s %s", user, host);
+	}
 	else
-		rsdb_exec_fetch(&data, "SELECT type, mask, reason, hold FROM operbans "
-					"WHERE hold > '%lu' AND remove='0'",
-				rb_time());
+		unban_len = snprintf(buf, sizeof(buf), " %s", OPERBAN_MASK(ban_p));
+
+	if(unban_len >= (int) sizeof(buf))
+		unban_len = sizeof(buf) - 1;
+
+	len = snprintf(buf + unban_len, sizeof(buf) - unban_len, "%s :%s",
+			burst->type == 'X' ? " 2" : (burst->type == 'R' ? " 0" : ""),
+			ban_p->reason);
 
-	for(i = 0; i < data.row_count; i++)
+	if(len >= (int) (sizeof(buf) - unban_len))
+		len = sizeof(buf) - unban_len - 1;
+
+	len += unban_len;
+
+	if(burst->len + len > burst->size)
 	{
-		push_ban(target, data.row[i][0][0], data.row[i][1], data.row[i][2],
-			(unsigned long) (atol(data.row[i][3]) - rb_time()));
+		burst->size = burst->size ? burst->size * 2 : OPERBAN_SYNC_BUF;
+
+		if(burst->len + len > burst->size)
+			burst->size = burst->len + len;
+
+		burst->buf = rb_realloc(burst->buf, burst->size);
 	}
 
-	rsdb_exec_fetch_end(&data);
+	if(burst->count == burst->alloc)
+	{
+		burst->alloc = burst->alloc ? burst->alloc * 2 : 256;
+		burst->lines = rb_realloc(burst->lines,
+				sizeof(struct operban_line) * burst->alloc);
+	}
 
-	/* permanent bans */
-	if(banletter)
-		rsdb_exec_fetch(&data, "SELECT type, mask, reason, hold FROM operbans "
-					"WHERE hold='0' AND remove='0' AND type='%c'",
-				rb_time(), banletter);
+	line = &burst->lines[burst->count++];
+	line->hold = ban_p->hold;
+	line->remove = ban_p->remove;
+	line->offset = burst->len;
+	line->len = len;
+	line->unban_len = unban_len;
+
+	memcpy(burst->buf + burst->len, buf, len);
+	burst->len += len;
+}
+
+/* operban_burst_add()
+ *   adds a new operban to the rendered lines of its type, unless they
+ *   are being rebuilt anyway
+ */
+static void
+operban_burst_add(struct operban *ban_p)
+{
+	struct operban_burst *burst = find_operban_burst(OPERBAN_TYPE(ban_p));
+
+	if(burst != NULL && !burst->dirty)
+		operban_burst_render(burst, ban_p);
+}
+
+static void
+operban_burst_build(struct operban_burst *burst)
+{
+	struct operban *ban_p;
+	unsigned int i;
+
+	burst->len = 0;
+	burst->count = 0;
+
+	HASHTAB_WALK(i, ban_p, operban_table)
+	{
+		if(OPERBAN_TYPE(ban_p) == burst->type)
+			operban_burst_render(burst, ban_p);
+	}
+	HASHTAB_WALK_END
+
+	burst->dirty = 0;
+}
+
+static void
+operban_sync_flush(void)
+{
+	sendto_server_buf(operban_sync_buf, operban_sync_len, operban_sync_lines);
+
+	operban_sync_last_bytes += operban_sync_len;
+	operban_sync_last_lines += operban_sync_lines;
+	operban_sync_len = 0;
+	operban_sync_lines = 0;
+}
+
+/* operban_sync_line()
+ *   renders a line into the sync buffer, patching in the hold
+ *
+ * inputs	- prefix with the target, burst, line, whether its an unban,
+ * 		  hold to send
+ * outputs	-
+ */
+static void
+operban_sync_line(const char *prefix, size_t prefix_len,
+		struct operban_burst *burst, struct operban_line *line,
+		int unban, unsigned long hold)
+{
+	char holdbuf[24];
+	char *p;
+	const char *tail = burst->buf + line->offset;
+	size_t hold_len = 0;
+	size_t tail_len;
+	size_t len;
+
+	if(unban)
+		tail_len = line->unban_len;
 	else
-		rsdb_exec_fetch(&data, "SELECT type, mask, reason, hold FROM operbans "
-					"WHERE hold='0' AND remove='0'",
-				rb_time());
+	{
+		hold_len = snprintf(holdbuf, sizeof(holdbuf), " %lu", hold);
+		tail_len = line->len;
+	}
+
+	/* ircd lines are at most 510 chars, less the \r\n */
+	len = prefix_len + (unban ? 2 : 0) + strlen(burst->command) + hold_len;
+
+	if(len + tail_len > 510)
+		tail_len = (len < 510) ? 510 - len : 0;
+
+	if(operban_sync_len + len + tail_len + 2 > sizeof(operban_sync_buf))
+		operban_sync_flush();
+
+	p = operban_sync_buf + operban_sync_len;
+
+	memcpy(p, prefix, prefix_len);
+	p += prefix_len;
+
+	if(unban)
+	{
+		*p++ = 'U';
+		*p++ = 'N';
+	}
+
+	memcpy(p, burst->command, strlen(burst->command));
+	p += strlen(burst->command);
+
+	memcpy(p, holdbuf, hold_len);
+	p += hold_len;
+
+	memcpy(p, tail, tail_len);
+	p += tail_len;
+
+	*p++ = '\r';
+	*p++ = '\n';
+
+	operban_sync_len = p - operban_sync_buf;
+	operban_sync_lines++;
+}
+
+static void
+sync_bans(const char *target, char banletter)
+{
+	char prefix[BUFSIZE];
+	struct operban_burst *burst;
+	struct operban_line *line;
+	size_t prefix_len;
+	unsigned int i;
 
-	for(i = 0; i < data.row_count; i++)
+	expire_operbans();
+
+	/* the lines for each type are rendered ahead of time, so all we do
+	 * here is fill in the target and hold and queue them in bulk
+	 */
+	prefix_len = snprintf(prefix, sizeof(prefix), ":%s ENCAP %s ",
+				SVC_UID(banserv_p), target);
+
+	if(prefix_len >= sizeof(prefix))
+		return;
+
+	operban_sync_last_lines = 0;
+	operban_sync_last_bytes = 0;
+
+	for(burst = operban_burst; burst->type; burst++)
 	{
-		push_ban(target, data.row[i][0][0], data.row[i][1], data.row[i][2], 0);
+		if(burst->dirty && (!banletter || burst->type == banletter))
+			operban_burst_build(burst);
 	}
 
-	rsdb_exec_fetch_end(&data);
+	/* first is temporary bans */
+	for(burst = operban_burst; burst->type; burst++)
+	{
+		if(banletter && burst->type != banletter)
+			continue;
+
+		for(i = 0; i < burst->count; i++)
+		{
+			line = &burst->lines[i];
+
+			if(!line->hold || line->remove)
+				continue;
+
+			/* see push_ban() */
+			if(config_file.bs_temp_workaround)
+				operban_sync_line(prefix, prefix_len, burst, line, 1, 0);
+
+			operban_sync_line(prefix, prefix_len, burst, line, 0,
+					(unsigned long) (line->hold - rb_time()));
+		}
+	}
+
+	/* permanent bans */
+	for(burst = operban_burst; burst->type; burst++)
+	{
+		if(banletter && burst->type != banletter)
+			continue;
+
+		for(i = 0; i < burst->count; i++)
+		{
+			line = &burst->lines[i];
+
+			if(!line->hold && !line->remove)
+				operban_sync_line(prefix, prefix_len, burst, line, 0, 0);
+		}
+	}
 
 	/* bans to remove */
-	if(banletter)
-		rsdb_exec_fetch(&data, "SELECT type, mask FROM operbans "
-					"WHERE hold > '%lu' AND remove='1' AND type='%c'",
-				rb_time(), banletter);
-	else
-		rsdb_exec_fetch(&data, "SELECT type, mask FROM operbans "
-					"WHERE hold > '%lu' AND remove='1'",
-				rb_time());
+	for(burst = operban_burst; burst->type; burst++)
+	{
+		if(banletter && burst->type != banletter)
+			continue;
+
+		for(i = 0; i < burst->count; i++)
+		{
+			line = &burst->lines[i];
+
+			if(line->remove)
+				operban_sync_line(prefix, prefix_len, burst, line, 1, 0);
+		}
+	}
+
+	operban_sync_flush();
+
+	operban_sync_count++;
+	operban_sync_total_lines += operban_sync_last_lines;
+	operban_sync_total_bytes += operban_sync_last_bytes;
+}
+
+#ifdef HAVE_LIBPTHREAD
+/* a slice of a regexp_sweep() snapshot for one thread to run */
+struct regexp_slice
+{
+	pcre *regexp;
+	pcre_extra *extra;
+	const char *arena;		/* "mask#info\0" strings back to back */
+	const unsigned int *offsets;	/* where each string starts, and one past the last */
+	unsigned char *matched;
+	unsigned int start;
+	unsigned int end;
+};
 
-	for(i = 0; i < data.row_count; i++)
+static void
+regexp_slice_run(struct regexp_slice *slice)
+{
+	unsigned int i;
+
+	for(i = slice->start; i < slice->end; i++)
 	{
-		push_unban(target, data.row[i][0][0], data.row[i][1]);
+		if(pcre_exec(slice->regexp, slice->extra, slice->arena + slice->offsets[i],
+				slice->offsets[i+1] - slice->offsets[i] - 1,
+				0, 0, NULL, 0) >= 0)
+			slice->matched[i] = 1;
 	}
+}
 
-	rsdb_exec_fetch_end(&data);
+static void *
+regexp_slice_main(void *arg)
+{
+	sigset_t sigs;
+
+	/* signals are for the main thread */
+	sigfillset(&sigs);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	regexp_slice_run(arg);
+	return NULL;
 }
 
-static int
-regexp_match(pcre *regexp, int kline, const char *kline_reason)
+/* regexp_sweep_threaded()
+ *   runs a regexp over a snapshot of the users, split across threads
+ *
+ * inputs	- regexp, number of threads, array to fill with matching
+ *		  clients
+ * outputs	- number of matches, in user_list order
+ */
+static unsigned int
+regexp_sweep_threaded(pcre *regexp, pcre_extra *extra, unsigned int nthreads,
+			struct client **results)
+{
+	struct regexp_slice *slices;
+	struct client **clients;
+	struct client *target_p;
+	pthread_t *threads;
+	unsigned int *offsets;
+	unsigned char *matched;
+	char *arena;
+	size_t size = 0;
+	size_t pos = 0;
+	unsigned int count = rb_dlink_list_length(&user_list);
+	unsigned int matches = 0;
+	unsigned int started;
+	unsigned int chunk;
+	unsigned int i;
+	int err;
+	rb_dlink_node *ptr;
+
+	clients = rb_malloc(sizeof(struct client *) * count);
+	offsets = rb_malloc(sizeof(unsigned int) * (count + 1));
+	matched = rb_malloc(count);
+
+	i = 0;
+	RB_DLINK_FOREACH(ptr, user_list.head)
+	{
+		target_p = ptr->data;
+		clients[i++] = target_p;
+		size += strlen(target_p->user->mask) + strlen(target_p->info) + 2;
+	}
+
+	arena = rb_malloc(size);
+
+	for(i = 0; i < count; i++)
+	{
+		offsets[i] = pos;
+		pos += sprintf(arena + pos, "%s#%s",
+				clients[i]->user->mask, clients[i]->info) + 1;
+	}
+
+	offsets[count] = pos;
+
+	slices = rb_malloc(sizeof(struct regexp_slice) * nthreads);
+	threads = rb_malloc(sizeof(pthread_t) * nthreads);
+	chunk = (count + nthreads - 1) / nthreads;
+
+	for(i = 0; i < nthreads; i++)
+	{
+		slices[i].regexp = regexp;
+		slices[i].extra = extra;
+		slices[i].arena = arena;
+		slices[i].offsets = offsets;
+		slices[i].matched = matched;
+		slices[i].start = (i * chunk < count) ? i * chunk : count;
+		slices[i].end = (slices[i].start + chunk < count) ? slices[i].start + chunk : count;
+	}
+
+	for(started = 1; started < nthreads; started++)
+	{
+		/* pthread_create() returns its error rather than setting errno */
+		if((err = pthread_create(&threads[started], NULL, regexp_slice_main, &slices[started])) != 0)
+		{
+			mlog("Warning: unable to start regexp thread: %s", strerror(err));
+			break;
+		}
+	}
+
+	/* the first slice is ours, as are any a thread couldn't be
+	 * started for
+	 */
+	regexp_slice_run(&slices[0]);
+
+	for(i = started; i < nthreads; i++)
+		regexp_slice_run(&slices[i]);
+
+	for(i = 1; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	for(i = 0; i < count; i++)
+	{
+		if(matched[i])
+			results[matches++] = clients[i];
+	}
+
+	rb_free(threads);
+	rb_free(slices);
+	rb_free(arena);
+	rb_free(matched);
+	rb_free(offsets);
+	rb_free(clients);
+
+	return matches;
+}
+#endif
+
+/* regexp_sweep()
+ *   runs a regexp over every user
+ *
+ * inputs	- regexp, pointer to set to the matching clients
+ * outputs	- number of matches, *results is set to an array of the
+ *		  matching clients in user_list order, which must be freed
+ */
+static unsigned int
+regexp_sweep(pcre *regexp, pcre_extra *extra, struct client ***results)
 {
 	char buf[BUFSIZE];
-	int ovector[30];
 	struct client *target_p;
 	unsigned int matches = 0;
 	int buflen;
 	rb_dlink_node *ptr;
 
+	*results = rb_malloc(sizeof(struct client *) *
+				(rb_dlink_list_length(&user_list) + 1));
+
+#ifdef HAVE_LIBPTHREAD
+	{
+		unsigned int nthreads = config_file.bs_regexp_threads;
+
+		/* not worth a thread for just a few users */
+		if(nthreads > rb_dlink_list_length(&user_list) / REGEXP_SWEEP_SLICE)
+			nthreads = rb_dlink_list_length(&user_list) / REGEXP_SWEEP_SLICE;
+
+		if(nthreads > 1)
+			return regexp_sweep_threaded(regexp, extra, nthreads, *results);
+	}
+#endif
+
 	RB_DLINK_FOREACH(ptr, user_list.head)
 	{
 		target_p = ptr->data;
@@ -597,18 +1353,8 @@ regexp_match(pcre *regexp, int kline, const char *kline_reason)
 		buflen = snprintf(buf, sizeof(buf), "%s#%s", 
 				target_p->user->mask, target_p->info);
 
-		if(pcre_exec(regexp, NULL, buf, buflen, 0, 0, ovector, 30) >= 0)
-		{
-			matches++;
-
-			if(kline)
-			{
-				sendto_server(":%s ENCAP %s KLINE %u * %s :%s",
-						SVC_UID(banserv_p), target_p->user->servername,
-						config_file.bs_regexp_time,
-						target_p->user->host, kline_reason);
-			}
-		}	
+		if(pcre_exec(regexp, extra, buf, buflen, 0, 0, NULL, 0) >= 0)
+			(*results)[matches++] = target_p;
 	}
 
 	return matches;
@@ -702,21 +1448,8 @@ o_banserv_kline(struct client *client_p, struct lconn *conn_p, const char *parv[
 		}
 	}
 
-	if(res)
-		rsdb_exec(NULL, "UPDATE operbans SET reason='%Q', "
-				"hold='%ld', oper='%Q', remove='0' WHERE "
-				"type='K' AND mask='%Q'",
-				reason,
-				temptime ? rb_time() + temptime : 0,
-				OPER_NAME(client_p, conn_p), lcase(mask));
-	else
-		rsdb_exec(NULL, "INSERT INTO operbans "
-				"(type, mask, reason, hold, create_time, "
-				"oper, remove, flags) "
-				"VALUES('K', '%Q', '%Q', '%lu', '%lu', '%Q', '0', '0')",
-				lcase(mask), reason,
-				temptime ? rb_time() + temptime : 0,
-				rb_time(), OPER_NAME(client_p, conn_p));
+	set_operban('K', mask, reason, temptime ? rb_time() + temptime : 0,
+			OPER_NAME(client_p, conn_p));
 			
 	service_snd(banserv_p, client_p, conn_p, SVC_BAN_ISSUED,
 			"KLINE", mask);
@@ -815,21 +1548,8 @@ o_banserv_xline(struct client *client_p, struct lconn *conn_p, const char *parv[
 		}
 	}
 
-	if(res)
-		rsdb_exec(NULL, "UPDATE operbans SET reason='%Q', "
-				"hold='%ld', oper='%Q', remove='0' WHERE "
-				"type='X' AND mask='%Q'",
-				reason,
-				temptime ? rb_time() + temptime : 0,
-				OPER_NAME(client_p, conn_p), lcase(gecos));
-	else
-		rsdb_exec(NULL, "INSERT INTO operbans "
-				"(type, mask, reason, hold, create_time, "
-				"oper, remove, flags) "
-				"VALUES('X', '%Q', '%Q', '%lu', '%lu', '%Q', '0', '0')",
-				lcase(gecos), reason, 
-				temptime ? rb_time() + temptime : 0,
-				rb_time(), OPER_NAME(client_p, conn_p));
+	set_operban('X', gecos, reason, temptime ? rb_time() + temptime : 0,
+			OPER_NAME(client_p, conn_p));
 
 	service_snd(banserv_p, client_p, conn_p, SVC_BAN_ISSUED,
 			"XLINE", gecos);
@@ -905,21 +1625,8 @@ o_banserv_resv(struct client *client_p, struct lconn *conn_p, const char *parv[]
 	if(strlen(reason) > REASONLEN)
 		reason[REASONLEN] = '\0';
 
-	if(res)
-		rsdb_exec(NULL, "UPDATE operbans SET reason='%Q', "
-				"hold='%ld', oper='%Q', remove='0' WHERE "
-				"type='R' AND mask='%Q'",
-				reason,
-				temptime ? rb_time() + temptime : 0,
-				OPER_NAME(client_p, conn_p), lcase(mask));
-	else
-		rsdb_exec(NULL, "INSERT INTO operbans "
-				"(type, mask, reason, hold, create_time, "
-				"oper, remove, flags) "
-				"VALUES('R', '%Q', '%Q', '%lu', '%lu', '%Q', '0', '0')",
-				lcase(mask), reason, 
-				temptime ? rb_time() + temptime : 0,
-				rb_time(), OPER_NAME(client_p, conn_p));
+	set_operban('R', mask, reason, temptime ? rb_time() + temptime : 0,
+			OPER_NAME(client_p, conn_p));
 
 	service_snd(banserv_p, client_p, conn_p, SVC_BAN_ISSUED,
 			"RESV", mask);
@@ -939,7 +1646,9 @@ o_banserv_addregexp(struct client *client_p, struct lconn *conn_p, const char *p
 {
 	static pcre *regexp_validity = NULL;
 	pcre *regexp_comp;
+	pcre_extra *regexp_extra;
 	struct regexp_ban *regexp_p;
+	struct client **results;
 	const char *mask;
 	const char *re_error;
 	char *reason;
@@ -947,6 +1656,7 @@ o_banserv_addregexp(struct client *client_p, struct lconn *conn_p, const char *p
 	int para = 0;
 	int re_error_offset;
 	unsigned int matches;
+	unsigned int i;
 	rb_dlink_node *ptr;
 
 	if(regexp_validity == NULL)
@@ -1023,13 +1733,17 @@ o_banserv_addregexp(struct client *client_p, struct lconn *conn_p, const char *p
 		return 0;
 	}
 
+	regexp_extra = regexp_study(regexp_comp);
+
 	/* run the regexp over clients to see how many it matches */
-	matches = regexp_match(regexp_comp, 0, NULL);
+	matches = regexp_sweep(regexp_comp, regexp_extra, &results);
 
 	/* then check its not over the limit */
 	if(config_file.bs_max_regexp_matches && (matches > config_file.bs_max_regexp_matches))
 	{
 		pcre_free(regexp_comp);
+		regexp_free_study(regexp_extra);
+		rb_free(results);
 
 		service_snd(banserv_p, client_p, conn_p, SVC_BAN_TOOMANYREGEXPMATCHES,
 				mask, matches, config_file.bs_max_regexp_matches);
@@ -1038,6 +1752,8 @@ o_banserv_addregexp(struct client *client_p, struct lconn *conn_p, const char *p
 
 	regexp_p = rb_malloc(sizeof(struct regexp_ban));
 	regexp_p->regexp = regexp_comp;
+	regexp_p->extra = regexp_extra;
+	regexp_p->literal = regexp_literal(mask, REGEXP_LITERAL_MIN);
 	regexp_p->regexp_str = rb_strdup(mask);
 	regexp_p->reason = rb_strdup(reason);
 	regexp_p->oper = rb_strdup(OPER_NAME(client_p, conn_p));
@@ -1045,6 +1761,7 @@ o_banserv_addregexp(struct client *client_p, struct lconn *conn_p, const char *p
 	regexp_p->create_time = rb_time();
 
 	rb_dlinkAddTail(regexp_p, &regexp_p->ptr, &regexp_list);
+	regexp_dirty = 1;
 
 	rsdb_exec_insert(&regexp_p->id, "operbans_regexp", "id", 
 			"INSERT INTO operbans_regexp (regex, reason, hold, create_time, oper) "
@@ -1053,7 +1770,18 @@ o_banserv_addregexp(struct client *client_p, struct lconn *conn_p, const char *p
 			temptime ? rb_time() + temptime : 0,
 			rb_time(), OPER_NAME(client_p, conn_p));
 
-	matches = regexp_match(regexp_p->regexp, 1, regexp_p->reason);
+	/* nothing has run since the sweep, so the clients are all still
+	 * here
+	 */
+	for(i = 0; i < matches; i++)
+	{
+		sendto_server(":%s ENCAP %s KLINE %u * %s :%s",
+				SVC_UID(banserv_p), results[i]->user->servername,
+				config_file.bs_regexp_time,
+				results[i]->user->host, regexp_p->reason);
+	}
+
+	rb_free(results);
 
 	service_snd(banserv_p, client_p, conn_p, SVC_BAN_REGEXPSUCCESS,
 			banserv_p->name, mask, matches);
@@ -1109,7 +1837,7 @@ o_banserv_addregexpneg(struct client *client_p, struct lconn *conn_p, const char
 	{
 		regexp_p = ptr->data;
 
-		if(!strcmp(parent_p->regexp_str, parv[1]))
+		if(!strcmp(regexp_p->regexp_str, parv[1]))
 		{
 			service_snd(banserv_p, client_p, conn_p, SVC_BAN_ALREADYPLACED,
 					"REGEXPNEG", parv[1]);
@@ -1136,6 +1864,7 @@ o_banserv_addregexpneg(struct client *client_p, struct lconn *conn_p, const char
 
 	regexp_p = rb_malloc(sizeof(struct regexp_ban));
 	regexp_p->regexp = regexp_comp;
+	regexp_p->extra = regexp_study(regexp_comp);
 	regexp_p->regexp_str = rb_strdup(parv[1]);
 	regexp_p->oper = rb_strdup(OPER_NAME(client_p, conn_p));
 	regexp_p->create_time = rb_time();
@@ -1199,9 +1928,7 @@ o_banserv_unkline(struct client *client_p, struct lconn *conn_p, const char *par
 		return 0;
 	}
 
-	rsdb_exec(NULL, "UPDATE operbans SET remove='1', hold='%lu' "
-			"WHERE mask='%Q' AND type='K'",
-			rb_time() + config_file.bs_unban_time, lcase(parv[0]));
+	remove_operban('K', parv[0]);
 
 	service_snd(banserv_p, client_p, conn_p, SVC_BAN_ISSUED,
 			"UNKLINE", parv[0]);
@@ -1246,9 +1973,7 @@ o_banserv_unxline(struct client *client_p, struct lconn *conn_p, const char *par
 		}
 	}
 
-	rsdb_exec(NULL, "UPDATE operbans SET remove='1', hold='%lu' "
-			"WHERE mask='%Q' AND type='X'",
-			rb_time() + config_file.bs_unban_time, lcase(parv[0]));
+	remove_operban('X', parv[0]);
 
 	service_snd(banserv_p, client_p, conn_p, SVC_BAN_ISSUED,
 			"UNXLINE", parv[0]);
@@ -1293,9 +2018,7 @@ o_banserv_unresv(struct client *client_p, struct lconn *conn_p, const char *parv
 		}
 	}
 
-	rsdb_exec(NULL, "UPDATE operbans SET remove='1', hold='%lu' "
-			"WHERE mask='%Q' AND type='R'",
-			rb_time() + config_file.bs_unban_time, lcase(parv[0]));
+	remove_operban('R', parv[0]);
 
 	service_snd(banserv_p, client_p, conn_p, SVC_BAN_ISSUED,
 			"UNRESV", parv[0]);
@@ -1511,34 +2234,34 @@ static void
 list_bans(struct client *client_p, struct lconn *conn_p, 
 		const char *mask, char type)
 {
-	struct rsdb_table data;
+	struct operban *ban_p;
 	time_t duration;
-	int i;
+	unsigned int i;
 
-	rsdb_exec_fetch(&data, "SELECT mask, reason, operreason, hold, oper "
-				"FROM operbans WHERE type='%c' AND remove='0' AND (hold='0' OR hold > '%lu')",
-			type, (unsigned long) rb_time());
+	expire_operbans();
 
 	service_snd(banserv_p, client_p, conn_p, SVC_BAN_LISTSTART, mask);
 
-	for(i = 0; i < data.row_count; i++)
+	HASHTAB_WALK(i, ban_p, operban_table)
 	{
-		if(!match(mask, data.row[i][0]))
+		if(OPERBAN_TYPE(ban_p) != type || ban_p->remove)
 			continue;
 
-		duration = (unsigned long) atol(data.row[i][3]);
+		if(!match(mask, OPERBAN_MASK(ban_p)))
+			continue;
+
+		duration = ban_p->hold;
 
 		if(duration)
 			duration -= rb_time();
 
 		service_send(banserv_p, client_p, conn_p,
 				"  %-30s exp:%s oper:%s [%s%s]",
-				data.row[i][0], duration ? get_short_duration(duration) : "never",
-				data.row[i][4], data.row[i][1],
-				EmptyString(data.row[i][2]) ? "" : data.row[i][2]);
+				OPERBAN_MASK(ban_p), duration ? get_short_duration(duration) : "never",
+				ban_p->oper, ban_p->reason,
+				EmptyString(ban_p->operreason) ? "" : ban_p->operreason);
 	}
-
-	rsdb_exec_fetch_end(&data);
+	HASHTAB_WALK_END
 
 	service_snd(banserv_p, client_p, conn_p, SVC_ENDOFLIST);
 }
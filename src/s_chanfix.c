@@ -40,6 +40,7 @@
 #include "service.h"
 #include "client.h"
 #include "channel.h"
+#include "hashtab.h"
 #include "c_init.h"
 #include "log.h"
 #include "conf.h"
@@ -52,6 +53,7 @@
 #include "s_chanfix.h"
 #include "event.h"
 #include "notes.h"
+#include "latency.h"
 #ifdef ENABLE_CHANSERV
 #include "s_chanserv.h"
 #endif
@@ -122,12 +124,111 @@ static struct service_handler chanfix_service = {
 static int h_chanfix_channel_destroy(void *chptr_v, void *unused);
 static int h_chanfix_channel_opless(void *chptr_v, void *unused);
 static int h_chanfix_server_squit_warn(void *target_p, void *unused);
+static int h_chanfix_server_exit_opless(void *target_p, void *opless_v);
 
 static void e_chanfix_score_channels(void *unused);
 static void e_chanfix_collate_history(void *unused);
 static void e_chanfix_autofix_channels(void *unused);
 static void e_chanfix_manfix_channels(void *unused);
 
+static struct rsdb_stmt *cf_userhost_id_stmt;
+static struct rsdb_stmt *cf_channel_id_stmt;
+static struct rsdb_stmt *cf_score_stmt;
+
+/* channel and userhost ids already looked up in the DB, so scoring does
+ * not need to ask for them again every pass.  Entries are hashed both by
+ * name and by id.  With the memory store, every id is cached and refcount
+ * holds the number of scores referring to it.
+ */
+struct cf_id_entry
+{
+	char *name;
+	unsigned long id;
+	unsigned int hashv;
+	unsigned int refcount;
+	rb_dlink_node node;
+	rb_dlink_node idnode;
+};
+
+static rb_dlink_list cf_channel_id_table[MAX_CHANNEL_TABLE];
+static rb_dlink_list cf_channel_idnum_table[MAX_CHANNEL_TABLE];
+static rb_dlink_list cf_userhost_id_table[MAX_NAME_HASH];
+static rb_dlink_list cf_userhost_idnum_table[MAX_NAME_HASH];
+
+/* The in-memory score store, used instead of summing cf_score and
+ * cf_score_history for every lookup when memory_store is enabled.  Each
+ * channel with scores keeps an array of the userhosts scored in it,
+ * sorted by userhost_id, each with a ring of daily scores indexed by
+ * dayts % CF_DAYSAMPLES.  cf_mem_dayts is the newest day in the rings.
+ *
+ * cf_score is still written every scoring pass, and the daily rollup
+ * writes the finished day's totals into cf_score_history from memory,
+ * so the DB can be reloaded at startup.
+ */
+struct cf_mem_score
+{
+	unsigned long userhost_id;
+	uint16_t day[CF_DAYSAMPLES];
+};
+
+struct cf_mem_channel
+{
+	unsigned long channel_id;
+	struct cf_mem_score *items;
+	unsigned int count;
+	unsigned int alloc;
+	rb_dlink_node node;
+};
+
+static int cf_memory_store;
+static rb_dlink_list cf_mem_channel_table[MAX_CHANNEL_TABLE];
+static unsigned int cf_mem_dayts;
+static unsigned int cf_mem_collate_dayts;	/* oldest day left in cf_score */
+static unsigned long cf_mem_channel_count;
+static unsigned long cf_mem_score_count;
+static struct rsdb_stmt *cf_history_stmt;
+
+/* the chanops seen during the current scoring pass, written to cf_score
+ * in one go at the end of it.
+ */
+struct cf_score_sample
+{
+	unsigned long channel_id;
+	unsigned long userhost_id;
+};
+
+static struct cf_score_sample *cf_samples;
+static unsigned int cf_sample_count;
+static unsigned int cf_sample_alloc;
+
+/* Scoring sweeps walk channel_list from the tail a slice at a time,
+ * resuming at cf_score_next on the next tick.  Channels are only ever
+ * added at the head, still ahead of the sweep, and a channel being
+ * destroyed moves cf_score_next past it, so each channel is scored once.
+ * cf_score_count is the number there were when the sweep started.
+ * cf_score_sweep_start is 0 when no sweep is in progress.
+ */
+#define CF_SCORE_SLICE(count)	((count) / ((CF_SCORE_FREQ / CF_SCORE_TICK) - 1) + 1)
+
+static rb_dlink_node *cf_score_next;
+static unsigned int cf_score_count;
+static unsigned int cf_score_done;
+static time_t cf_score_sweep_start;
+static time_t cf_score_next_sweep;
+static unsigned int cf_score_dayts;
+static unsigned int cf_score_rows;
+static unsigned long cf_score_usec;
+static unsigned long cf_score_pause;
+
+/* results of the last scoring sweep, for CHANFIX STATUS */
+static time_t cf_score_last_time;
+static time_t cf_score_last_duration;
+static unsigned long cf_score_last_usec;
+static unsigned long cf_score_last_pause;
+static unsigned int cf_score_last_rows;
+
+static void collate_temp_scores(void);
+static void load_mem_store(void);
 static void takeover_channel(struct channel *);
 static unsigned long get_userhost_id(const char *);
 static unsigned long get_channel_id(const char *);
@@ -155,11 +256,32 @@ init_s_chanfix(void)
 	hook_add(h_chanfix_channel_destroy, HOOK_CHANNEL_DESTROY);
 	hook_add(h_chanfix_channel_opless, HOOK_CHANNEL_OPLESS);
 	hook_add(h_chanfix_server_squit_warn, HOOK_SERVER_EXIT_WARNING);
+	hook_add(h_chanfix_server_exit_opless, HOOK_SERVER_EXIT_OPLESS);
+
+	cf_userhost_id_stmt = rsdb_stmt_declare("SELECT id FROM cf_userhost WHERE userhost=?");
+	cf_channel_id_stmt = rsdb_stmt_declare("SELECT id FROM cf_channel WHERE chname=?");
+	cf_score_stmt = rsdb_stmt_declare("INSERT INTO cf_score "
+				"(channel_id, userhost_id, timestamp, dayts) VALUES(?, ?, ?, ?)");
+
+	/* scores used to be collected through cf_temp_score, move over
+	 * anything left in it
+	 */
+	collate_temp_scores();
+
+	/* only read at startup, the store can't be dropped or loaded later */
+	if((cf_memory_store = config_file.cf_memory_store))
+	{
+		cf_history_stmt = rsdb_stmt_declare("INSERT INTO cf_score_history "
+					"(channel_id, userhost_id, dayts, score) VALUES(?, ?, ?, ?)");
+		load_mem_store();
+	}
+
+	cf_score_next_sweep = rb_time() + CF_SCORE_FREQ;
 
-	rb_event_add("e_chanfix_score_channels", e_chanfix_score_channels, NULL, 300);
-	rb_event_add("e_chanfix_autofix_channels", e_chanfix_autofix_channels, NULL, 300);
-	rb_event_add("e_chanfix_manfix_channels", e_chanfix_manfix_channels, NULL, 300);
-	rb_event_addonce("e_chanfix_collate_history", e_chanfix_collate_history, NULL,
+	latency_event_add("e_chanfix_score_channels", e_chanfix_score_channels, NULL, CF_SCORE_TICK);
+	latency_event_add("e_chanfix_autofix_channels", e_chanfix_autofix_channels, NULL, 300);
+	latency_event_add("e_chanfix_manfix_channels", e_chanfix_manfix_channels, NULL, 300);
+	latency_event_addonce("e_chanfix_collate_history", e_chanfix_collate_history, NULL,
 				seconds_to_midnight()+30);
 }
 
@@ -200,52 +322,187 @@ takeover_channel(struct channel *chptr)
 	}
 }
 
-/* Fetch the userhost_id of a given userhost from the DB. */
-static unsigned long
-get_userhost_id(const char *userhost)
+static unsigned long fetched_id;
+
+static int
+fetch_id_cb(int argc, const char **argv)
 {
-	unsigned long userhost_id;
-	struct rsdb_table data;
+	if(argv[0] != NULL)
+		fetched_id = atoi(argv[0]);
+
+	return 0;
+}
 
-	rsdb_exec_fetch(&data, "SELECT id FROM cf_userhost WHERE userhost='%Q'",
-						lcase(userhost));
+static struct cf_id_entry *
+find_cached_id(rb_dlink_list *table, unsigned int hashv, const char *name)
+{
+	struct cf_id_entry *entry;
+	rb_dlink_node *ptr;
 
-	if((data.row_count > 0) && (data.row[0][0] != NULL))
+	RB_DLINK_FOREACH(ptr, table[hashv].head)
 	{
-		userhost_id = atoi(data.row[0][0]);
+		entry = ptr->data;
+
+		if(!strcmp(entry->name, name))
+			return entry;
 	}
-	else
+
+	return NULL;
+}
+
+static struct cf_id_entry *
+find_cached_idnum(rb_dlink_list *id_table, unsigned int size, unsigned long id)
+{
+	struct cf_id_entry *entry;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, id_table[id & (size-1)].head)
 	{
-		userhost_id = 0;
+		entry = ptr->data;
+
+		if(entry->id == id)
+			return entry;
 	}
 
-	rsdb_exec_fetch_end(&data);
+	return NULL;
+}
+
+static struct cf_id_entry *
+add_cached_id(rb_dlink_list *table, rb_dlink_list *id_table, unsigned int size,
+		unsigned int hashv, const char *name, unsigned long id)
+{
+	struct cf_id_entry *entry = rb_malloc(sizeof(struct cf_id_entry));
 
-	return userhost_id;
+	entry->name = rb_strdup(name);
+	entry->id = id;
+	entry->hashv = hashv;
+	rb_dlinkAdd(entry, &entry->node, &table[hashv]);
+	rb_dlinkAdd(entry, &entry->idnode, &id_table[id & (size-1)]);
+
+	return entry;
 }
 
-/* Fetch the channel_id of a given channel name from the DB. */
+static void
+del_cached_id(rb_dlink_list *table, rb_dlink_list *id_table, unsigned int size,
+		struct cf_id_entry *entry)
+{
+	rb_dlinkDelete(&entry->node, &table[entry->hashv]);
+	rb_dlinkDelete(&entry->idnode, &id_table[entry->id & (size-1)]);
+	rb_free(entry->name);
+	rb_free(entry);
+}
+
+static void
+clear_cached_ids(rb_dlink_list *table, rb_dlink_list *id_table, unsigned int size)
+{
+	rb_dlink_node *ptr, *next_ptr;
+	int i;
+
+	HASH_WALK_SAFE(i, size, ptr, next_ptr, table)
+	{
+		del_cached_id(table, id_table, size, ptr->data);
+	}
+	HASH_WALK_END
+}
+
+/* Fetch the userhost_id of a given userhost from the DB, optionally
+ * adding it if it isn't there.
+ */
 static unsigned long
-get_channel_id(const char *channel)
+get_userhost_id_add(const char *userhost, int add)
 {
-	unsigned long channel_id;
-	struct rsdb_table data;
+	struct cf_id_entry *entry;
+	char *lc_userhost = LOCAL_COPY(userhost);
+	unsigned int hashv;
+	unsigned int insert_id;
+	int i;
 
-	rsdb_exec_fetch(&data, "SELECT id FROM cf_channel WHERE chname='%Q'",
-						lcase(channel));
+	for(i = 0; lc_userhost[i] != '\0'; i++)
+		lc_userhost[i] = ToLower(lc_userhost[i]);
 
-	if((data.row_count > 0) && (data.row[0][0] != NULL))
+	hashv = hash_name(lc_userhost);
+
+	if((entry = find_cached_id(cf_userhost_id_table, hashv, lc_userhost)) != NULL)
+		return entry->id;
+
+	/* the memory store caches every userhost with a score */
+	if(cf_memory_store && !add)
+		return 0;
+
+	fetched_id = 0;
+
+	rsdb_stmt_bind_str(cf_userhost_id_stmt, 1, lc_userhost);
+	rsdb_stmt_exec(cf_userhost_id_stmt, fetch_id_cb);
+
+	if(fetched_id == 0)
 	{
-		channel_id = atoi(data.row[0][0]);
+		if(!add)
+			return 0;
+
+		rsdb_exec_insert(&insert_id, "cf_userhost", "id",
+				"INSERT INTO cf_userhost (userhost) VALUES('%Q')",
+				lc_userhost);
+		fetched_id = insert_id;
 	}
-	else
+
+	add_cached_id(cf_userhost_id_table, cf_userhost_idnum_table, MAX_NAME_HASH,
+			hashv, lc_userhost, fetched_id);
+	return fetched_id;
+}
+
+/* Fetch the channel_id of a given channel name from the DB, optionally
+ * adding it if it isn't there.
+ */
+static unsigned long
+get_channel_id_add(const char *channel, int add)
+{
+	struct cf_id_entry *entry;
+	char *lc_channel = LOCAL_COPY(channel);
+	unsigned int hashv;
+	unsigned int insert_id;
+	int i;
+
+	for(i = 0; lc_channel[i] != '\0'; i++)
+		lc_channel[i] = ToLower(lc_channel[i]);
+
+	hashv = hash_channel(lc_channel);
+
+	if((entry = find_cached_id(cf_channel_id_table, hashv, lc_channel)) != NULL)
+		return entry->id;
+
+	fetched_id = 0;
+
+	rsdb_stmt_bind_str(cf_channel_id_stmt, 1, lc_channel);
+	rsdb_stmt_exec(cf_channel_id_stmt, fetch_id_cb);
+
+	if(fetched_id == 0)
 	{
-		channel_id = 0;
+		if(!add)
+			return 0;
+
+		rsdb_exec_insert(&insert_id, "cf_channel", "id",
+				"INSERT INTO cf_channel (chname) VALUES('%Q')",
+				lc_channel);
+		fetched_id = insert_id;
 	}
 
-	rsdb_exec_fetch_end(&data);
+	add_cached_id(cf_channel_id_table, cf_channel_idnum_table, MAX_CHANNEL_TABLE,
+			hashv, lc_channel, fetched_id);
+	return fetched_id;
+}
+
+/* Fetch the userhost_id of a given userhost from the DB. */
+static unsigned long
+get_userhost_id(const char *userhost)
+{
+	return get_userhost_id_add(userhost, 0);
+}
 
-	return channel_id;
+/* Fetch the channel_id of a given channel name from the DB. */
+static unsigned long
+get_channel_id(const char *channel)
+{
+	return get_channel_id_add(channel, 0);
 }
 
 /* Fetch a channel's chanfix flags from the DB (if present). */
@@ -274,6 +531,438 @@ get_cf_chan_flags(const char *chan, uint32_t *flags)
 
 
 
+typedef int (*scorecmp)(const void *, const void *);
+static int
+score_cmp(struct chanfix_score_item *one, struct chanfix_score_item *two)
+{
+	return (two->score - one->score);
+}
+
+/* find_mem_channel()
+ *   Finds the memory store entry for a channel, optionally adding it.
+ */
+static struct cf_mem_channel *
+find_mem_channel(unsigned long channel_id, int add)
+{
+	struct cf_mem_channel *mchan;
+	struct cf_id_entry *entry;
+	rb_dlink_node *ptr;
+	unsigned int hashv = channel_id & (MAX_CHANNEL_TABLE-1);
+
+	RB_DLINK_FOREACH(ptr, cf_mem_channel_table[hashv].head)
+	{
+		mchan = ptr->data;
+
+		if(mchan->channel_id == channel_id)
+			return mchan;
+	}
+
+	if(!add)
+		return NULL;
+
+	mchan = rb_malloc(sizeof(struct cf_mem_channel));
+	mchan->channel_id = channel_id;
+	rb_dlinkAdd(mchan, &mchan->node, &cf_mem_channel_table[hashv]);
+	cf_mem_channel_count++;
+
+	if((entry = find_cached_idnum(cf_channel_idnum_table, MAX_CHANNEL_TABLE,
+					channel_id)) != NULL)
+		entry->refcount++;
+
+	return mchan;
+}
+
+static void
+free_mem_channel(struct cf_mem_channel *mchan)
+{
+	struct cf_id_entry *entry;
+
+	if((entry = find_cached_idnum(cf_channel_idnum_table, MAX_CHANNEL_TABLE,
+					mchan->channel_id)) != NULL && entry->refcount)
+		entry->refcount--;
+
+	rb_dlinkDelete(&mchan->node,
+			&cf_mem_channel_table[mchan->channel_id & (MAX_CHANNEL_TABLE-1)]);
+	cf_mem_channel_count--;
+
+	rb_free(mchan->items);
+	rb_free(mchan);
+}
+
+/* find_mem_score()
+ *   Finds the scores of a userhost in a channel, optionally adding them.
+ */
+static struct cf_mem_score *
+find_mem_score(struct cf_mem_channel *mchan, unsigned long userhost_id, int add)
+{
+	struct cf_id_entry *entry;
+	unsigned int low = 0, high = mchan->count, mid;
+
+	while(low < high)
+	{
+		mid = (low + high) / 2;
+
+		if(mchan->items[mid].userhost_id < userhost_id)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if(low < mchan->count && mchan->items[low].userhost_id == userhost_id)
+		return &mchan->items[low];
+
+	if(!add)
+		return NULL;
+
+	if(mchan->count >= mchan->alloc)
+	{
+		mchan->alloc = mchan->alloc ? mchan->alloc * 2 : 4;
+		mchan->items = rb_realloc(mchan->items,
+				sizeof(struct cf_mem_score) * mchan->alloc);
+	}
+
+	memmove(&mchan->items[low+1], &mchan->items[low],
+		sizeof(struct cf_mem_score) * (mchan->count - low));
+	memset(&mchan->items[low], 0, sizeof(struct cf_mem_score));
+	mchan->items[low].userhost_id = userhost_id;
+	mchan->count++;
+	cf_mem_score_count++;
+
+	if((entry = find_cached_idnum(cf_userhost_idnum_table, MAX_NAME_HASH,
+					userhost_id)) != NULL)
+		entry->refcount++;
+
+	return &mchan->items[low];
+}
+
+static int
+mem_score_total(struct cf_mem_score *item)
+{
+	int i, total = 0;
+
+	for(i = 0; i < CF_DAYSAMPLES; i++)
+		total += item->day[i];
+
+	return total;
+}
+
+/* advance_mem_store()
+ *   Moves the day rings on to dayts, clearing the days that drop out of
+ *   them and freeing any scores left empty.
+ */
+static void
+advance_mem_store(unsigned int dayts)
+{
+	struct cf_mem_channel *mchan;
+	struct cf_mem_score *item;
+	struct cf_id_entry *entry;
+	rb_dlink_node *ptr, *next_ptr;
+	unsigned int days, d, j, k;
+	int i;
+
+	days = dayts - cf_mem_dayts;
+
+	if(days > CF_DAYSAMPLES)
+		days = CF_DAYSAMPLES;
+
+	HASH_WALK_SAFE(i, MAX_CHANNEL_TABLE, ptr, next_ptr, cf_mem_channel_table)
+	{
+		mchan = ptr->data;
+
+		for(j = 0, k = 0; j < mchan->count; j++)
+		{
+			item = &mchan->items[j];
+
+			for(d = 1; d <= days; d++)
+				item->day[(cf_mem_dayts + d) % CF_DAYSAMPLES] = 0;
+
+			if(mem_score_total(item) == 0)
+			{
+				if((entry = find_cached_idnum(cf_userhost_idnum_table,
+						MAX_NAME_HASH, item->userhost_id)) != NULL &&
+				   entry->refcount)
+					entry->refcount--;
+
+				cf_mem_score_count--;
+				continue;
+			}
+
+			if(k != j)
+				mchan->items[k] = *item;
+
+			k++;
+		}
+
+		mchan->count = k;
+
+		if(mchan->count == 0)
+			free_mem_channel(mchan);
+	}
+	HASH_WALK_END
+
+	cf_mem_dayts = dayts;
+}
+
+static void
+add_mem_score(unsigned long channel_id, unsigned long userhost_id,
+		unsigned int dayts, int score)
+{
+	struct cf_mem_score *item;
+	uint16_t *slot;
+
+	if(score <= 0)
+		return;
+
+	if(dayts > cf_mem_dayts)
+		advance_mem_store(dayts);
+	else if(dayts + CF_DAYSAMPLES <= cf_mem_dayts)
+		return;
+
+	item = find_mem_score(find_mem_channel(channel_id, 1), userhost_id, 1);
+	slot = &item->day[dayts % CF_DAYSAMPLES];
+
+	if(*slot + score > 65535)
+		*slot = 65535;
+	else
+		*slot += score;
+}
+
+/* load_mem_store()
+ *   Loads the ids and scores from the DB into the memory store.
+ */
+static void
+load_mem_store(void)
+{
+	struct rsdb_cursor cursor;
+	const char **row;
+	unsigned int dayts;
+
+	cf_mem_dayts = DAYS_SINCE_EPOCH;
+	cf_mem_collate_dayts = cf_mem_dayts;
+
+	rsdb_cursor_open(&cursor, "SELECT id, userhost FROM cf_userhost");
+
+	while((row = rsdb_cursor_next(&cursor)))
+	{
+		if(EmptyString(row[1]))
+			continue;
+
+		add_cached_id(cf_userhost_id_table, cf_userhost_idnum_table,
+				MAX_NAME_HASH, hash_name(row[1]), row[1], atoi(row[0]));
+	}
+
+	rsdb_cursor_close(&cursor);
+
+	rsdb_cursor_open(&cursor, "SELECT id, chname FROM cf_channel");
+
+	while((row = rsdb_cursor_next(&cursor)))
+	{
+		if(EmptyString(row[1]))
+			continue;
+
+		add_cached_id(cf_channel_id_table, cf_channel_idnum_table,
+				MAX_CHANNEL_TABLE, hash_channel(row[1]), row[1],
+				atoi(row[0]));
+	}
+
+	rsdb_cursor_close(&cursor);
+
+	/* ordered so scores are appended to each channel's array */
+	rsdb_cursor_open(&cursor, "SELECT channel_id, userhost_id, dayts, score "
+			"FROM cf_score_history WHERE dayts > %u "
+			"ORDER BY channel_id, userhost_id",
+			cf_mem_dayts - CF_DAYSAMPLES);
+
+	while((row = rsdb_cursor_next(&cursor)))
+	{
+		if(row[2] == NULL || row[3] == NULL)
+			continue;
+
+		add_mem_score(atoi(row[0]), atoi(row[1]), atoi(row[2]), atoi(row[3]));
+	}
+
+	rsdb_cursor_close(&cursor);
+
+	rsdb_cursor_open(&cursor, "SELECT channel_id, userhost_id, dayts, COUNT(*) "
+			"FROM cf_score "
+			"GROUP BY channel_id, userhost_id, dayts "
+			"ORDER BY channel_id, userhost_id");
+
+	while((row = rsdb_cursor_next(&cursor)))
+	{
+		if(row[2] == NULL || row[3] == NULL)
+			continue;
+
+		dayts = atoi(row[2]);
+
+		if(dayts < cf_mem_collate_dayts)
+			cf_mem_collate_dayts = dayts;
+
+		add_mem_score(atoi(row[0]), atoi(row[1]), dayts, atoi(row[3]));
+	}
+
+	rsdb_cursor_close(&cursor);
+
+	mlog("info: Loaded %lu chanfix scores for %lu channels into memory.",
+		cf_mem_score_count, cf_mem_channel_count);
+}
+
+/* collate_mem_day()
+ *   Writes the scores for the oldest day left in cf_score into
+ *   cf_score_history from the memory store.  Returns 1 if a day was
+ *   collated, 0 when there are none left.
+ */
+static int
+collate_mem_day(void)
+{
+	struct cf_mem_channel *mchan;
+	rb_dlink_node *ptr;
+	unsigned int today = DAYS_SINCE_EPOCH;
+	unsigned int dayts = cf_mem_collate_dayts;
+	unsigned int j, slot;
+	int i;
+
+	if(today > cf_mem_dayts)
+		advance_mem_store(today);
+
+	if(dayts >= today)
+		return 0;
+
+	/* days that have already left the rings are of no further use */
+	if(dayts + CF_DAYSAMPLES <= today)
+	{
+		rsdb_exec(NULL, "DELETE FROM cf_score WHERE dayts <= %u",
+				today - CF_DAYSAMPLES);
+		cf_mem_collate_dayts = today - CF_DAYSAMPLES + 1;
+		return 1;
+	}
+
+	mlog("info: Collating score history for dayts: %u", dayts);
+
+	slot = dayts % CF_DAYSAMPLES;
+
+	rsdb_transaction(RSDB_TRANS_START);
+
+	HASH_WALK(i, MAX_CHANNEL_TABLE, ptr, cf_mem_channel_table)
+	{
+		mchan = ptr->data;
+
+		for(j = 0; j < mchan->count; j++)
+		{
+			if(!mchan->items[j].day[slot])
+				continue;
+
+			rsdb_stmt_bind_int(cf_history_stmt, 1, mchan->channel_id);
+			rsdb_stmt_bind_int(cf_history_stmt, 2, mchan->items[j].userhost_id);
+			rsdb_stmt_bind_int(cf_history_stmt, 3, dayts);
+			rsdb_stmt_bind_int(cf_history_stmt, 4, mchan->items[j].day[slot]);
+			rsdb_stmt_exec(cf_history_stmt, NULL);
+		}
+	}
+	HASH_WALK_END
+
+	rsdb_exec(NULL, "DELETE FROM cf_score WHERE dayts = %u", dayts);
+
+	rsdb_transaction(RSDB_TRANS_END);
+
+	cf_mem_collate_dayts++;
+	return 1;
+}
+
+/* purge_mem_orphans()
+ *   Deletes the userhosts and channels no score refers to any more.
+ */
+static void
+purge_mem_orphans(void)
+{
+	struct cf_id_entry *entry;
+	rb_dlink_node *ptr, *next_ptr;
+	unsigned long userhosts = 0, channels = 0;
+	int i;
+
+	rsdb_transaction(RSDB_TRANS_START);
+
+	HASH_WALK_SAFE(i, MAX_NAME_HASH, ptr, next_ptr, cf_userhost_id_table)
+	{
+		entry = ptr->data;
+
+		if(entry->refcount)
+			continue;
+
+		rsdb_exec(NULL, "DELETE FROM cf_userhost WHERE id = %lu", entry->id);
+		del_cached_id(cf_userhost_id_table, cf_userhost_idnum_table,
+				MAX_NAME_HASH, entry);
+		userhosts++;
+	}
+	HASH_WALK_END
+
+	/* channels with flags set are kept */
+	HASH_WALK_SAFE(i, MAX_CHANNEL_TABLE, ptr, next_ptr, cf_channel_id_table)
+	{
+		entry = ptr->data;
+
+		if(entry->refcount)
+			continue;
+
+		rsdb_exec(NULL, "DELETE FROM cf_channel WHERE id = %lu AND flags = 0",
+				entry->id);
+		del_cached_id(cf_channel_id_table, cf_channel_idnum_table,
+				MAX_CHANNEL_TABLE, entry);
+		channels++;
+	}
+	HASH_WALK_END
+
+	rsdb_transaction(RSDB_TRANS_END);
+
+	mlog("info: Deleted %lu unused userhost_ids and %lu unused channel_ids.",
+		userhosts, channels);
+}
+
+/* fetch_mem_scores()
+ *   The memory store version of fetch_cf_scores()
+ */
+static struct chanfix_score *
+fetch_mem_scores(unsigned long channel_id, int max_num, int min_score)
+{
+	struct chanfix_score *scores;
+	struct cf_mem_channel *mchan;
+	unsigned int i, num = 0;
+	int total;
+
+	if((mchan = find_mem_channel(channel_id, 0)) == NULL)
+		return NULL;
+
+	scores = rb_malloc(sizeof(struct chanfix_score));
+	scores->s_items = rb_malloc(sizeof(struct chanfix_score_item) * mchan->count);
+
+	for(i = 0; i < mchan->count; i++)
+	{
+		if((total = mem_score_total(&mchan->items[i])) <= min_score)
+			continue;
+
+		scores->s_items[num].userhost_id = mchan->items[i].userhost_id;
+		scores->s_items[num].score = total;
+		num++;
+	}
+
+	if(num == 0)
+	{
+		rb_free(scores->s_items);
+		rb_free(scores);
+		return NULL;
+	}
+
+	qsort(scores->s_items, num, sizeof(struct chanfix_score_item),
+			(scorecmp) score_cmp);
+
+	if(max_num > 0 && num > max_num)
+		num = max_num;
+
+	scores->length = num;
+
+	return scores;
+}
+
 /* Return an array of chanfix_score_item structures for each chanop stored in
  * the DB for the specified channel.
  */
@@ -281,17 +970,24 @@ static struct chanfix_score *
 fetch_cf_scores(struct channel *chptr, int max_num, int min_score)
 {
 	struct chanfix_score *scores;
-	unsigned long channel_id;
-	struct rsdb_table data;
-	int i;
+	struct rsdb_cursor cursor;
+	unsigned long channel_id;
+	const char **row;
+	int alloc_num, num;
 
 	/* If the channel has no ID in the DB, it cannot have any scores. */
 	if((channel_id = get_channel_id(chptr->name)) == 0)
 		return NULL;
 
+	if(cf_memory_store)
+		return fetch_mem_scores(channel_id, max_num, min_score);
+
+	/* busy channels have a score for thousands of userhosts, so read
+	 * them a row at a time and stop once we have max_num.
+	 */
 	if(min_score > 0)
 	{
-		rsdb_exec_fetch(&data, "SELECT userhost_id, SUM(t) "
+		rsdb_cursor_open(&cursor, "SELECT userhost_id, SUM(t) "
 			"FROM "
 			"  (SELECT cf_score.userhost_id, count(*) AS t "
 			"  FROM cf_score WHERE channel_id = %lu "
@@ -307,7 +1003,7 @@ fetch_cf_scores(struct channel *chptr, int max_num, int min_score)
 	}
 	else
 	{
-		rsdb_exec_fetch(&data, "SELECT userhost_id, SUM(t) "
+		rsdb_cursor_open(&cursor, "SELECT userhost_id, SUM(t) "
 			"FROM "
 			"  (SELECT cf_score.userhost_id, count(*) AS t "
 			"  FROM cf_score WHERE channel_id = %lu "
@@ -321,27 +1017,35 @@ fetch_cf_scores(struct channel *chptr, int max_num, int min_score)
 			channel_id, channel_id);
 	}
 
-	if(data.row_count == 0)
-	{
-		rsdb_exec_fetch_end(&data);
-		return NULL;
-	}
-
 	scores = rb_malloc(sizeof(struct chanfix_score));
+	alloc_num = (max_num > 0) ? max_num : 64;
+	scores->s_items = rb_malloc(sizeof(struct chanfix_score_item) * alloc_num);
+	num = 0;
 
-	if(max_num < 1 || max_num > data.row_count)
-		max_num = data.row_count;
+	while((max_num < 1 || num < max_num) && (row = rsdb_cursor_next(&cursor)))
+	{
+		if(num >= alloc_num)
+		{
+			alloc_num *= 2;
+			scores->s_items = rb_realloc(scores->s_items,
+					sizeof(struct chanfix_score_item) * alloc_num);
+		}
+
+		scores->s_items[num].userhost_id = atoi(row[0]);
+		scores->s_items[num].score = atoi(row[1]);
+		num++;
+	}
 
-	scores->length = max_num;
-	scores->s_items = rb_malloc(sizeof(struct chanfix_score_item) * max_num);
+	rsdb_cursor_close(&cursor);
 
-	for(i = 0; i < max_num; i++)
+	if(num == 0)
 	{
-		scores->s_items[i].userhost_id = atoi(data.row[i][0]);
-		scores->s_items[i].score = atoi(data.row[i][1]);
+		rb_free(scores->s_items);
+		rb_free(scores);
+		return NULL;
 	}
 
-	rsdb_exec_fetch_end(&data);
+	scores->length = num;
 
 	return scores;
 }
@@ -727,38 +1431,71 @@ process_chanfix_list(int fix_type)
 }
 
 
-typedef int (*scorecmp)(const void *, const void *);
-static int
-score_cmp(struct chanfix_score_item *one, struct chanfix_score_item *two)
-{
-	return (two->score - one->score);
-}
 
+/* scores of the userhosts seen in a channel, used by build_db_scores() */
+#define CF_SCORE_HASH	1024
 
-static struct chanfix_score *
-build_channel_scores(struct channel *chptr, int max_num)
+struct cf_userhost_score
 {
-	struct chanfix_score *scores;
-	unsigned long channel_id, userhost_id;
+	char *userhost;
+	unsigned long userhost_id;
+	int score;
+	rb_dlink_node node;
+};
+
+/* build_db_scores()
+ *   Fills s_items with the scores from the DB of the members of a
+ *   channel, returning how many members had one.
+ */
+static unsigned int
+build_db_scores(struct channel *chptr, unsigned long channel_id,
+		struct chanfix_score_item *s_items)
+{
+	struct cf_userhost_score *uh_score;
+	struct rsdb_cursor cursor;
 	struct chmember *msptr;
-	rb_dlink_node *ptr;
-	struct rsdb_table data;
+	rb_dlink_list *score_table;
+	rb_dlink_node *ptr, *next_ptr;
+	const char **row;
 	char userhost[USERHOSTLEN+1];
-	int day_score, hist_score;
-	unsigned int user_count;
+	unsigned int hashv;
+	unsigned int user_count = 0;
+	int i;
 
-	/* Channel has no ID in the DB and therefore can't have any scores. */
-	if((channel_id = get_channel_id(chptr->name)) == 0)
-		return NULL;
+	/* Fetch the score of every userhost that has one in this channel
+	 * in a single query, then match the members against them in
+	 * memory, rather than querying for each member.
+	 */
+	score_table = rb_malloc(sizeof(rb_dlink_list) * CF_SCORE_HASH);
+
+	rsdb_cursor_open(&cursor, "SELECT cf_userhost.userhost, total_table.userhost_id, SUM(t) "
+		"FROM "
+		"  (SELECT cf_score.userhost_id, count(*) AS t "
+		"  FROM cf_score WHERE channel_id = %lu "
+		"  GROUP BY cf_score.userhost_id "
+		"  UNION ALL "
+		"  SELECT cf_score_history.userhost_id, SUM(score) AS t "
+		"  FROM cf_score_history WHERE channel_id = %lu "
+		"  GROUP BY cf_score_history.userhost_id) AS total_table "
+		"JOIN cf_userhost ON cf_userhost.id = total_table.userhost_id "
+		"GROUP BY total_table.userhost_id, cf_userhost.userhost",
+		channel_id, channel_id);
+
+	while((row = rsdb_cursor_next(&cursor)))
+	{
+		if(EmptyString(row[0]) || row[2] == NULL || atoi(row[2]) == 0)
+			continue;
 
-	if(rb_dlink_list_length(&chptr->users) < 1)
-		return NULL;
+		uh_score = rb_malloc(sizeof(struct cf_userhost_score));
+		uh_score->userhost = rb_strdup(row[0]);
+		uh_score->userhost_id = atoi(row[1]);
+		uh_score->score = atoi(row[2]);
 
-	scores = rb_malloc(sizeof(struct chanfix_score));
-	scores->s_items = rb_malloc(sizeof(struct chanfix_score_item) *
-					rb_dlink_list_length(&chptr->users));
+		hashv = hash_name(uh_score->userhost) & (CF_SCORE_HASH-1);
+		rb_dlinkAdd(uh_score, &uh_score->node, &score_table[hashv]);
+	}
 
-	user_count = 0;
+	rsdb_cursor_close(&cursor);
 
 	RB_DLINK_FOREACH(ptr, chptr->users.head)
 	{
@@ -768,45 +1505,103 @@ build_channel_scores(struct channel *chptr, int max_num)
 				msptr->client_p->user->username,
 				msptr->client_p->user->host);
 
-		userhost_id = get_userhost_id(userhost);
+		for(i = 0; userhost[i] != '\0'; i++)
+			userhost[i] = ToLower(userhost[i]);
+
+		hashv = hash_name(userhost) & (CF_SCORE_HASH-1);
+
+		RB_DLINK_FOREACH(next_ptr, score_table[hashv].head)
+		{
+			uh_score = next_ptr->data;
 
-		mlog("debug: user id %lu matches with userhost '%s'.", userhost_id, userhost);
+			if(!strcmp(uh_score->userhost, userhost))
+				break;
+		}
 
-		if(!userhost_id)
+		if(next_ptr == NULL)
 			continue;
 
-		rsdb_exec_fetch(&data, "SELECT COUNT(*) "
-			"FROM cf_score "
-			"WHERE channel_id = %lu AND userhost_id = %lu",
-			channel_id, userhost_id);
-		if(data.row_count == 0 || data.row[0][0] == NULL)
-			day_score = 0;
-		else
-			day_score = atoi(data.row[0][1]);
-		rsdb_exec_fetch_end(&data);
+		s_items[user_count].userhost_id = uh_score->userhost_id;
+		s_items[user_count].score = uh_score->score;
+		s_items[user_count].msptr = msptr;
+		user_count++;
+	}
+
+	HASH_WALK_SAFE(i, CF_SCORE_HASH, ptr, next_ptr, score_table)
+	{
+		uh_score = ptr->data;
+		rb_free(uh_score->userhost);
+		rb_free(uh_score);
+	}
+	HASH_WALK_END
 
+	rb_free(score_table);
 
-		rsdb_exec_fetch(&data, "SELECT SUM(score) "
-			"FROM cf_score_history "
-			"WHERE channel_id = %lu AND userhost_id = %lu",
-			channel_id, userhost_id);
-		if(data.row_count == 0 || data.row[0][0] == NULL)
-			hist_score = 0;
-		else
-			hist_score = atoi(data.row[0][1]);
-		rsdb_exec_fetch_end(&data);
+	return user_count;
+}
 
-		if(day_score == 0 && hist_score == 0)
-		{
+/* build_mem_scores()
+ *   The memory store version of build_db_scores()
+ */
+static unsigned int
+build_mem_scores(struct channel *chptr, unsigned long channel_id,
+		struct chanfix_score_item *s_items)
+{
+	struct cf_mem_channel *mchan;
+	struct cf_mem_score *item;
+	struct chmember *msptr;
+	rb_dlink_node *ptr;
+	char userhost[USERHOSTLEN+1];
+	unsigned long userhost_id;
+	unsigned int user_count = 0;
+
+	if((mchan = find_mem_channel(channel_id, 0)) == NULL)
+		return 0;
+
+	RB_DLINK_FOREACH(ptr, chptr->users.head)
+	{
+		msptr = ptr->data;
+
+		rb_snprintf(userhost, sizeof(userhost), "%s@%s",
+				msptr->client_p->user->username,
+				msptr->client_p->user->host);
+
+		if((userhost_id = get_userhost_id(userhost)) == 0 ||
+		   (item = find_mem_score(mchan, userhost_id, 0)) == NULL)
 			continue;
-		}
 
-		scores->s_items[user_count].userhost_id = userhost_id;
-		scores->s_items[user_count].score = day_score + hist_score;
-		scores->s_items[user_count].msptr = msptr;
+		s_items[user_count].userhost_id = userhost_id;
+		s_items[user_count].score = mem_score_total(item);
+		s_items[user_count].msptr = msptr;
 		user_count++;
 	}
 
+	return user_count;
+}
+
+static struct chanfix_score *
+build_channel_scores(struct channel *chptr, int max_num)
+{
+	struct chanfix_score *scores;
+	unsigned long channel_id;
+	unsigned int user_count;
+
+	/* Channel has no ID in the DB and therefore can't have any scores. */
+	if((channel_id = get_channel_id(chptr->name)) == 0)
+		return NULL;
+
+	if(rb_dlink_list_length(&chptr->users) < 1)
+		return NULL;
+
+	scores = rb_malloc(sizeof(struct chanfix_score));
+	scores->s_items = rb_malloc(sizeof(struct chanfix_score_item) *
+					rb_dlink_list_length(&chptr->users));
+
+	if(cf_memory_store)
+		user_count = build_mem_scores(chptr, channel_id, scores->s_items);
+	else
+		user_count = build_db_scores(chptr, channel_id, scores->s_items);
+
 	scores->s_items = rb_realloc(scores->s_items,
 			sizeof(struct chanfix_score_item) * user_count);
 
@@ -833,12 +1628,12 @@ build_channel_scores(struct channel *chptr, int max_num)
 /* Function for collecting chanop scores for a given channel.
  */
 static void
-collect_channel_scores(struct channel *chptr, time_t timestamp, unsigned int dayts)
+collect_channel_scores(struct channel *chptr)
 {
 	struct chmember *msptr;
 	rb_dlink_node *ptr;
 	char userhost[USERHOSTLEN+1];
-	int i;
+	unsigned long channel_id = 0;
 
 	RB_DLINK_FOREACH(ptr, chptr->users_opped.head)
 	{
@@ -853,125 +1648,268 @@ collect_channel_scores(struct channel *chptr, time_t timestamp, unsigned int day
 				(msptr->client_p->flags & FLAGS_NODNS))
 			continue;
 
+		/* only create the channel once it has an op to score */
+		if(channel_id == 0 &&
+		   (channel_id = get_channel_id_add(chptr->name, 1)) == 0)
+			return;
+
 		rb_snprintf(userhost, sizeof(userhost), "%s@%s",
 				msptr->client_p->user->username,
 				msptr->client_p->user->host);
 
-		/* We can't use lcase() twice in the same function call.
-		 * Ensure userhost is in lowercase format.
-		 */
-		for(i = 0; (userhost[i] != '\0') && (i < USERHOSTLEN); i++)
+		if(cf_sample_count >= cf_sample_alloc)
 		{
-			userhost[i] = ToLower(userhost[i]);
+			cf_sample_alloc = cf_sample_alloc ? cf_sample_alloc * 2 : 1024;
+			cf_samples = rb_realloc(cf_samples,
+					sizeof(struct cf_score_sample) * cf_sample_alloc);
 		}
 
-		rsdb_exec(NULL, "INSERT INTO cf_temp_score (chname, userhost, timestamp, dayts) "
-						"VALUES('%Q', '%Q', '%lu', '%lu')",
-						lcase(chptr->name), userhost, timestamp, dayts);
+		cf_samples[cf_sample_count].channel_id = channel_id;
+		cf_samples[cf_sample_count].userhost_id = get_userhost_id_add(userhost, 1);
+		cf_sample_count++;
 	}
 }
 
-/* General event to manage how we iterate over all the channels
- * gathering score data.
+static int
+score_sample_cmp(const void *a, const void *b)
+{
+	const struct cf_score_sample *sa = a;
+	const struct cf_score_sample *sb = b;
+
+	if(sa->channel_id != sb->channel_id)
+		return (sa->channel_id < sb->channel_id) ? -1 : 1;
+
+	if(sa->userhost_id != sb->userhost_id)
+		return (sa->userhost_id < sb->userhost_id) ? -1 : 1;
+
+	return 0;
+}
+
+/* Writes the scores collected this pass into cf_score, in a single
+ * transaction.  Clones opped in the same channel only score once.
+ * Returns the number of rows written.
  */
-static void 
-e_chanfix_score_channels(void *unused)
+static unsigned int
+flush_channel_scores(time_t timestamp, unsigned int dayts)
 {
-	struct channel *chptr;
-	rb_dlink_node *ptr;
-	time_t min_ts, max_ts, timestamp = rb_time();
-	unsigned int dayts = DAYS_SINCE_EPOCH;
-	uint8_t i = 0;
-	struct rsdb_table ts_data;
+	unsigned int i, rows = 0;
 
-	if(is_network_split())
+	if(cf_sample_count == 0)
+		return 0;
+
+	qsort(cf_samples, cf_sample_count, sizeof(struct cf_score_sample),
+		score_sample_cmp);
+
+	rsdb_transaction(RSDB_TRANS_START);
+
+	for(i = 0; i < cf_sample_count; i++)
 	{
-		mlog("debug: Channel scoring suspended (network split).");
-		return;
+		if(i > 0 && !score_sample_cmp(&cf_samples[i], &cf_samples[i-1]))
+			continue;
+
+		rsdb_stmt_bind_int(cf_score_stmt, 1, cf_samples[i].channel_id);
+		rsdb_stmt_bind_int(cf_score_stmt, 2, cf_samples[i].userhost_id);
+		rsdb_stmt_bind_time(cf_score_stmt, 3, timestamp);
+		rsdb_stmt_bind_int(cf_score_stmt, 4, dayts);
+		rsdb_stmt_exec(cf_score_stmt, NULL);
+		rows++;
+
+		if(cf_memory_store)
+			add_mem_score(cf_samples[i].channel_id,
+					cf_samples[i].userhost_id, dayts, 1);
 	}
 
-	mlog("debug: Examining channels for opped users.");
+	rsdb_transaction(RSDB_TRANS_END);
+
+	cf_sample_count = 0;
 
-	RB_DLINK_FOREACH(ptr, channel_list.head)
+	/* dont hold onto a big buffer after a large pass */
+	if(cf_sample_alloc > 65536)
 	{
-		chptr = ptr->data;
+		rb_free(cf_samples);
+		cf_samples = NULL;
+		cf_sample_alloc = 0;
+	}
 
-		if(rb_dlink_list_length(&chptr->users) >= config_file.cf_min_clients)
-		{
-			if(rb_dlink_list_length(&chptr->users_opped) > 0)
-			{
-				/*mlog("debug: Collecting scores for channel '%s'.", chptr->name);*/
-				collect_channel_scores(chptr, timestamp, dayts);
-			}
-			else if((!chptr->cfptr) && (add_chanfix(chptr, CF_STATUS_AUTOFIX, NULL)))
-			{
-				mlog("debug: Added opless channel '%s' for autofixing.",
-						chptr->name);
-			}
-		}
+	return rows;
+}
+
+/* Scores were collected in cf_temp_score by older versions, and only
+ * moved into cf_score on the following pass.  Move over anything that
+ * was left behind.
+ */
+static void
+collate_temp_scores(void)
+{
+	rsdb_exec(NULL, "INSERT INTO cf_channel (chname) "
+			"SELECT DISTINCT cf_temp_score.chname FROM cf_temp_score "
+			"LEFT JOIN cf_channel ON cf_temp_score.chname=cf_channel.chname "
+			"WHERE cf_channel.id IS NULL");
+
+	rsdb_exec(NULL, "INSERT INTO cf_userhost (userhost) "
+			"SELECT DISTINCT cf_temp_score.userhost FROM cf_temp_score "
+			"LEFT JOIN cf_userhost ON cf_temp_score.userhost=cf_userhost.userhost "
+			"WHERE cf_userhost.id IS NULL");
+
+	rsdb_exec(NULL, "INSERT INTO cf_score (channel_id, userhost_id, timestamp, dayts) "
+			"SELECT DISTINCT cf_channel.id, cf_userhost.id, timestamp, dayts "
+			"FROM cf_temp_score LEFT JOIN cf_channel ON cf_temp_score.chname=cf_channel.chname "
+			"LEFT JOIN cf_userhost ON cf_temp_score.userhost=cf_userhost.userhost");
+
+	rsdb_exec(NULL, "DELETE FROM cf_temp_score");
+}
+
+/* score_channel()
+ *   Scores the ops in a channel, or queues it for autofixing if it has
+ *   none.
+ */
+static void
+score_channel(struct channel *chptr)
+{
+	if(rb_dlink_list_length(&chptr->users) < config_file.cf_min_clients)
+		return;
+
+	if(rb_dlink_list_length(&chptr->users_opped) > 0)
+		collect_channel_scores(chptr);
+	else if((!chptr->cfptr) && (add_chanfix(chptr, CF_STATUS_AUTOFIX, NULL)))
+	{
+		mlog("debug: Added opless channel '%s' for autofixing.",
+				chptr->name);
 	}
+}
 
-	/* Done collecting chanops, execute the collation routine.
-	 * As a basic sanity check, don't do more than 5 of these at a time.
-	 */
-	while (i < 5)
+/* General event to manage how we iterate over all the channels
+ * gathering score data.  Each sweep over the channels is spread across
+ * CF_SCORE_FREQ, scoring up to CF_SCORE_SLICE channels each tick, or as
+ * many as fit into CF_SCORE_TICK_BUDGET.
+ */
+static void 
+e_chanfix_score_channels(void *unused)
+{
+	struct channel *chptr;
+	struct timeval start_tv, end_tv;
+	unsigned long usec;
+	unsigned int count = 0;
+
+	if(!cf_score_sweep_start)
 	{
-		rsdb_exec_fetch(&ts_data, "SELECT MIN(timestamp), MAX(timestamp) FROM cf_temp_score");
+		if(rb_time() < cf_score_next_sweep)
+			return;
 
-		if(ts_data.row_count == 0)
+		cf_score_next_sweep = rb_time() + CF_SCORE_FREQ;
+
+		if(is_network_split())
 		{
-			mlog("warning: Unable to retrieve min timestamp for ChanFix collation.");
-			rsdb_exec_fetch_end(&ts_data);
+			mlog("debug: Channel scoring suspended (network split).");
 			return;
 		}
 
-		min_ts = atoi(ts_data.row[0][0]);
-		max_ts = atoi(ts_data.row[0][1]);
-		rsdb_exec_fetch_end(&ts_data);
+		mlog("debug: Examining channels for opped users.");
 
-		if(min_ts == max_ts)
-			break;
+		cf_score_sweep_start = rb_time();
+		cf_score_dayts = DAYS_SINCE_EPOCH;
+		cf_score_next = channel_list.tail;
+		cf_score_count = rb_dlink_list_length(&channel_list);
+		cf_score_done = 0;
+		cf_score_rows = 0;
+		cf_score_usec = 0;
+		cf_score_pause = 0;
+	}
+	else if(is_network_split())
+	{
+		mlog("debug: Channel scoring sweep abandoned (network split).");
+		cf_sample_count = 0;
+		cf_score_sweep_start = 0;
+		cf_score_next = NULL;
+		return;
+	}
 
-		/* Using the min_ts timestamp, select the distinct channels and
-		 * userhosts from the temporary table.
-		 */
+	gettimeofday(&start_tv, NULL);
 
-		rsdb_exec(NULL, "INSERT INTO cf_channel (chname) "
-				"SELECT DISTINCT cf_temp_score.chname FROM cf_temp_score "
-				"LEFT JOIN cf_channel ON cf_temp_score.chname=cf_channel.chname "
-				"WHERE cf_channel.id IS NULL");
+	while(cf_score_next != NULL)
+	{
+		chptr = cf_score_next->data;
+		cf_score_next = cf_score_next->prev;
+		cf_score_done++;
 
-		rsdb_exec(NULL, "INSERT INTO cf_userhost (userhost) "
-				"SELECT DISTINCT cf_temp_score.userhost FROM cf_temp_score "
-				"LEFT JOIN cf_userhost ON cf_temp_score.userhost=cf_userhost.userhost "
-				"WHERE cf_userhost.id IS NULL");
+		score_channel(chptr);
 
-		rsdb_exec(NULL, "INSERT INTO cf_score (channel_id, userhost_id, timestamp, dayts) "
-				"SELECT DISTINCT cf_channel.id, cf_userhost.id, timestamp, dayts "
-				"FROM cf_temp_score LEFT JOIN cf_channel ON cf_temp_score.chname=cf_channel.chname "
-				"LEFT JOIN cf_userhost ON cf_temp_score.userhost=cf_userhost.userhost "
-				"WHERE timestamp=%lu", min_ts);
+		if(++count >= CF_SCORE_SLICE(cf_score_count))
+			break;
 
-		/* Delete these timestamp entries when we're done. */
-		rsdb_exec(NULL, "DELETE FROM cf_temp_score WHERE timestamp=%lu", min_ts);
+		gettimeofday(&end_tv, NULL);
 
-		i++;
+		if((end_tv.tv_sec - start_tv.tv_sec) * 1000000 +
+		   (end_tv.tv_usec - start_tv.tv_usec) >= CF_SCORE_TICK_BUDGET)
+			break;
 	}
 
-	mlog("debug: channel op scoring time: %s",
-			get_duration(rb_time() - timestamp));
+	cf_score_rows += flush_channel_scores(cf_score_sweep_start, cf_score_dayts);
+
+	gettimeofday(&end_tv, NULL);
+	usec = (end_tv.tv_sec - start_tv.tv_sec) * 1000000 +
+		(end_tv.tv_usec - start_tv.tv_usec);
+
+	cf_score_usec += usec;
+
+	if(usec > cf_score_pause)
+		cf_score_pause = usec;
+
+	if(cf_score_next != NULL)
+		return;
+
+	/* sweep complete */
+	cf_score_last_time = cf_score_sweep_start;
+	cf_score_last_duration = rb_time() - cf_score_sweep_start;
+	cf_score_last_usec = cf_score_usec;
+	cf_score_last_pause = cf_score_pause;
+	cf_score_last_rows = cf_score_rows;
+	cf_score_sweep_start = 0;
+
+	mlog("debug: channel op scoring sweep: %lus, %lu.%03lus busy, "
+		"longest pause %lu.%03lus, %u scores written",
+		(unsigned long) cf_score_last_duration,
+		cf_score_last_usec / 1000000, (cf_score_last_usec / 1000) % 1000,
+		cf_score_last_pause / 1000000, (cf_score_last_pause / 1000) % 1000,
+		cf_score_last_rows);
 }
 
-/* Collate the cf_score data into cf_score_history. */
+/* Collate the cf_score data into cf_score_history.  A single day is
+ * collated per call, with the next following shortly after, so a
+ * backlog of days doesn't stall everything else.
+ */
 static void 
 e_chanfix_collate_history(void *unused)
 {
+	static uint8_t collated = 0;
 	unsigned int min_dayts;
 	struct rsdb_table ts_data;
-	uint8_t i = 0;
+
+	/* with the memory store, the day's scores are written out from it
+	 * and nothing needs aggregating in the DB.
+	 */
+	if(cf_memory_store)
+	{
+		if(collate_mem_day())
+		{
+			latency_event_addonce("e_chanfix_collate_history", e_chanfix_collate_history,
+					NULL, CF_SCORE_TICK);
+			return;
+		}
+
+		latency_event_addonce("e_chanfix_collate_history", e_chanfix_collate_history,
+				NULL, seconds_to_midnight()+30);
+
+		rsdb_exec(NULL, "DELETE FROM cf_score_history WHERE dayts < %lu",
+				(DAYS_SINCE_EPOCH - CF_DAYSAMPLES + 1));
+
+		/* refcounts replace the periodic orphan sweeps below */
+		purge_mem_orphans();
+		return;
+	}
 
 	/* As a basic sanity check, don't do more than 10 of these at a time. */
-	while (i < 10)
+	if(collated < 10)
 	{
 		rsdb_exec_fetch(&ts_data, "SELECT MIN(dayts) FROM cf_score");
 
@@ -979,6 +1917,9 @@ e_chanfix_collate_history(void *unused)
 		{
 			mlog("warning: Unable to retrieve min timestamp for ChanFix collation.");
 			rsdb_exec_fetch_end(&ts_data);
+			collated = 0;
+			latency_event_addonce("e_chanfix_collate_history", e_chanfix_collate_history,
+					NULL, seconds_to_midnight()+30);
 			return;
 		}
 
@@ -996,24 +1937,30 @@ e_chanfix_collate_history(void *unused)
 		if(min_dayts == DAYS_SINCE_EPOCH || min_dayts == 0)
 		{
 			mlog("info: History successfully collated.");
-			break;
 		}
+		else
+		{
+			mlog("info: Collating score history for dayts: %d", min_dayts);
 
-		mlog("info: Collating score history for dayts: %d", min_dayts);
-
-		rsdb_exec(NULL, "INSERT INTO cf_score_history (channel_id, userhost_id, dayts, score) "
-				"SELECT channel_id, userhost_id, dayts, count(*) "
-				"FROM cf_score where dayts = %u "
-				"GROUP BY channel_id, userhost_id, dayts",
-				min_dayts);
+			rsdb_exec(NULL, "INSERT INTO cf_score_history (channel_id, userhost_id, dayts, score) "
+					"SELECT channel_id, userhost_id, dayts, count(*) "
+					"FROM cf_score where dayts = %u "
+					"GROUP BY channel_id, userhost_id, dayts",
+					min_dayts);
 
-		/* Delete these day's entries when we're done. */
-		rsdb_exec(NULL, "DELETE FROM cf_score WHERE dayts = %lu", min_dayts);
+			/* Delete these day's entries when we're done. */
+			rsdb_exec(NULL, "DELETE FROM cf_score WHERE dayts = %lu", min_dayts);
 
-		i++;
+			collated++;
+			latency_event_addonce("e_chanfix_collate_history", e_chanfix_collate_history,
+					NULL, CF_SCORE_TICK);
+			return;
+		}
 	}
 
-	rb_event_addonce("e_chanfix_collate_history", e_chanfix_collate_history,
+	collated = 0;
+
+	latency_event_addonce("e_chanfix_collate_history", e_chanfix_collate_history,
 			NULL, seconds_to_midnight()+30);
 
 	/* Drop old history data from the cf_score_history table. */
@@ -1051,6 +1998,12 @@ e_chanfix_collate_history(void *unused)
 			"    SELECT cf_score_history.channel_id "
 			"    FROM cf_score_history "
 			"    GROUP BY cf_score_history.channel_id) AS comb_table)");
+
+		/* the cached ids may have just been deleted */
+		clear_cached_ids(cf_channel_id_table, cf_channel_idnum_table,
+				MAX_CHANNEL_TABLE);
+		clear_cached_ids(cf_userhost_id_table, cf_userhost_idnum_table,
+				MAX_NAME_HASH);
 	}
 
 }
@@ -1094,6 +2047,10 @@ h_chanfix_channel_destroy(void *chptr_v, void *unused)
 	if(chptr->cfptr)
 		del_chanfix(chptr);
 
+	/* the scoring sweep was to do this one next */
+	if(cf_score_next == &chptr->listptr)
+		cf_score_next = chptr->listptr.prev;
+
 	return 0;
 }
 
@@ -1131,6 +2088,24 @@ h_chanfix_server_squit_warn(void *target_p, void *unused)
 	return 0;
 }
 
+/* h_chanfix_server_exit_opless()
+ *   channels left opless by a server exiting, which always comes after
+ *   the squit warning, so they're all ignored the same as
+ *   h_chanfix_channel_opless() would.
+ */
+static int
+h_chanfix_server_exit_opless(void *target_p, void *opless_v)
+{
+	struct client *exiting_p = target_p;
+	rb_dlink_list *opless = opless_v;
+
+	mlog("debug: Temporarily ignoring %lu opless channels "
+		"(squit of %s).",
+		(unsigned long) rb_dlink_list_length(opless), exiting_p->name);
+
+	return 0;
+}
+
 static int
 o_chanfix_score(struct client *client_p, struct lconn *conn_p, const char *parv[], int parc)
 {
@@ -1247,6 +2222,8 @@ static int
 o_chanfix_uscore(struct client *client_p, struct lconn *conn_p, const char *parv[], int parc)
 {
 	unsigned long channel_id, userhost_id;
+	struct cf_mem_channel *mchan;
+	struct cf_mem_score *item;
 	struct rsdb_table data;
 	int day_score, hist_score;
 	char userhost[USERHOSTLEN+1];
@@ -1302,26 +2279,36 @@ o_chanfix_uscore(struct client *client_p, struct lconn *conn_p, const char *parv
 		return 0;
 	}
 
-	rsdb_exec_fetch(&data, "SELECT COUNT(*) FROM cf_score "
-		"WHERE channel_id = %lu AND userhost_id = %lu",
-		channel_id, userhost_id);
-	if(data.row_count == 0 || data.row[0][0] == NULL)
+	if(cf_memory_store)
+	{
+		mchan = find_mem_channel(channel_id, 0);
+		item = mchan ? find_mem_score(mchan, userhost_id, 0) : NULL;
+
 		day_score = 0;
+		hist_score = item ? mem_score_total(item) : 0;
+	}
 	else
-		day_score = atoi(data.row[0][0]);
-	rsdb_exec_fetch_end(&data);
-
+	{
+		rsdb_exec_fetch(&data, "SELECT COUNT(*) FROM cf_score "
+			"WHERE channel_id = %lu AND userhost_id = %lu",
+			channel_id, userhost_id);
+		if(data.row_count == 0 || data.row[0][0] == NULL)
+			day_score = 0;
+		else
+			day_score = atoi(data.row[0][0]);
+		rsdb_exec_fetch_end(&data);
 
-	rsdb_exec_fetch(&data, "SELECT SUM(score) "
-		"  FROM cf_score_history "
-		"  WHERE channel_id = %lu AND userhost_id = %lu",
-		channel_id, userhost_id);
-	if(data.row_count == 0 || data.row[0][0] == NULL)
-		hist_score = 0;
-	else
-		hist_score = atoi(data.row[0][0]);
-	rsdb_exec_fetch_end(&data);
 
+		rsdb_exec_fetch(&data, "SELECT SUM(score) "
+			"  FROM cf_score_history "
+			"  WHERE channel_id = %lu AND userhost_id = %lu",
+			channel_id, userhost_id);
+		if(data.row_count == 0 || data.row[0][0] == NULL)
+			hist_score = 0;
+		else
+			hist_score = atoi(data.row[0][0]);
+		rsdb_exec_fetch_end(&data);
+	}
 
 	if(day_score == 0 && hist_score == 0)
 	{
@@ -2134,6 +3121,30 @@ o_chanfix_status(struct client *client_p, struct lconn *conn_p, const char *parv
 
 	service_send(chanfix_p, client_p, conn_p, "Splitmode status: %s",
 			is_network_split() ? "active (scoring/fixing disabled)" : "inactive");
+
+	if(cf_score_last_time)
+	{
+		service_send(chanfix_p, client_p, conn_p,
+				"Last scoring sweep: %s ago, %u scores written",
+				get_duration(rb_time() - cf_score_last_time),
+				cf_score_last_rows);
+		service_send(chanfix_p, client_p, conn_p,
+				"Last sweep time: %s, %lu.%03lus busy, longest pause %lu.%03lus",
+				get_duration(cf_score_last_duration),
+				cf_score_last_usec / 1000000, (cf_score_last_usec / 1000) % 1000,
+				cf_score_last_pause / 1000000, (cf_score_last_pause / 1000) % 1000);
+	}
+
+	if(cf_memory_store)
+		service_send(chanfix_p, client_p, conn_p,
+				"Score store: memory, %lu scores in %lu channels",
+				cf_mem_score_count, cf_mem_channel_count);
+
+	if(cf_score_sweep_start)
+		service_send(chanfix_p, client_p, conn_p,
+				"Scoring sweep in progress: %u/%u channels, started %s ago",
+				cf_score_done, cf_score_count,
+				get_duration(rb_time() - cf_score_sweep_start));
 	
 	return 0;
 }
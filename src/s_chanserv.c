@@ -52,6 +52,9 @@
 #include "watch.h"
 #include "email.h"
 #include "tools.h"
+#include "hashtab.h"
+#include "latency.h"
+
 #define S_C_OWNER	200
 #define S_C_MANAGER	190
 #define S_C_USERLIST	150
@@ -75,7 +78,10 @@ static rb_bh *channel_reg_heap;
 static rb_bh *member_reg_heap;
 static rb_bh *ban_reg_heap;
 
-static rb_dlink_list chan_reg_table[MAX_CHANNEL_TABLE];
+static struct hashtab *chan_reg_table;
+
+/* registered channels joined whilst our uplink is bursting */
+static rb_dlink_list burst_join_list;
 
 static int o_chan_chanregister(struct client *, struct lconn *, const char **, int);
 static int o_chan_chandrop(struct client *, struct lconn *, const char **, int);
@@ -193,6 +199,7 @@ void
 preinit_s_chanserv(void)
 {
 	chanserv_p = add_service(&chanserv_service);
+	chan_reg_table = hashtab_create(CHAN_REG_HASH_SIZE, irccmp);
 }
 
 static void
@@ -215,18 +222,18 @@ init_s_chanserv(void)
 	hook_add(h_chanserv_dbsync, HOOK_DBSYNC);
 	hook_add(h_chanserv_eob_uplink, HOOK_EOB_UPLINK);
 
-	rb_event_add("chanserv_updatechan", e_chanserv_updatechan, NULL, 3600);
-	rb_event_add("chanserv_expirechan", e_chanserv_expirechan, NULL, 43200);
-	rb_event_add("chanserv_partinhabit", e_chanserv_partinhabit, NULL, 21600);
+	latency_event_add("chanserv_updatechan", e_chanserv_updatechan, NULL, 3600);
+	latency_event_add("chanserv_expirechan", e_chanserv_expirechan, NULL, 43200);
+	latency_event_add("chanserv_partinhabit", e_chanserv_partinhabit, NULL, 21600);
 
 	/* we add these with defaults, then update the timers when we parse
 	 * the conf..
 	 */
-	chanserv_expireban_ev = rb_event_add("chanserv_expireban", e_chanserv_expireban, NULL,
+	chanserv_expireban_ev = latency_event_add("chanserv_expireban", e_chanserv_expireban, NULL,
 		config_file.cexpireban_frequency);
-	chanserv_enforcetopic_ev = rb_event_add("chanserv_enforcetopic", e_chanserv_enforcetopic, NULL,
+	chanserv_enforcetopic_ev = latency_event_add("chanserv_enforcetopic", e_chanserv_enforcetopic, NULL,
 		config_file.cenforcetopic_frequency);
-	rb_event_add("chanserv_expire_delowner", e_chanserv_expire_delowner, NULL, 3600);
+	latency_event_add("chanserv_expire_delowner", e_chanserv_expire_delowner, NULL, 3600);
 }
 
 void
@@ -234,10 +241,11 @@ free_channel_reg(struct chan_reg *reg_p)
 {
 	rb_dlink_node *ptr, *next_ptr;
 
-	unsigned int hashv = hash_channel(reg_p->name);
-
 	part_service(chanserv_p, reg_p->name);
 
+	if(reg_p->burst_join)
+		rb_dlinkDelete(&reg_p->burstnode, &burst_join_list);
+
 	rsdb_exec(NULL, "DELETE FROM channels_dropowner WHERE chname='%Q'", reg_p->name);
 
 	rsdb_exec(NULL, "DELETE FROM bans WHERE chname = '%Q'",
@@ -248,7 +256,7 @@ free_channel_reg(struct chan_reg *reg_p)
 		free_ban_reg(reg_p, ptr->data);
 	}
 
-	rb_dlinkDelete(&reg_p->node, &chan_reg_table[hashv]);
+	hashtab_del(chan_reg_table, reg_p->name, reg_p);
 
 	rsdb_exec(NULL, "DELETE FROM channels WHERE chname = '%Q'",
 			reg_p->name);
@@ -280,9 +288,8 @@ destroy_channel_reg(struct chan_reg *reg_p)
 static void
 add_channel_reg(struct chan_reg *reg_p)
 {
-	unsigned int hashv = hash_channel(reg_p->name);
 	reg_p->bants = 1L; /* initially allow UNBAN */
-	rb_dlinkAdd(reg_p, &reg_p->node, &chan_reg_table[hashv]);
+	hashtab_add(chan_reg_table, reg_p->name, reg_p);
 }
 
 static void
@@ -311,16 +318,9 @@ struct chan_reg *
 find_channel_reg(struct client *client_p, const char *name)
 {
 	struct chan_reg *reg_p;
-	unsigned int hashv = hash_channel(name);
-	rb_dlink_node *ptr;
-
-	RB_DLINK_FOREACH(ptr, chan_reg_table[hashv].head)
-	{
-		reg_p = ptr->data;
 
-		if(!irccmp(reg_p->name, name))
-			return reg_p;
-	}
+	if((reg_p = hashtab_find(chan_reg_table, name)) != NULL)
+		return reg_p;
 
 	if(client_p != NULL)
 		service_err(chanserv_p, client_p, SVC_CHAN_NOTREG, name);
@@ -614,6 +614,171 @@ member_db_callback(int argc, const char **argv)
 	return 0;
 }
 
+/* bans of registrations with BAN_INDEX_MIN or more bans are indexed by
+ * the host in their mask, so a joining user only needs to be matched
+ * against the bans on their host, on the domains their host is in, and
+ * those too wild to index.
+ */
+struct ban_bucket
+{
+	char *key;
+	int suffix;			/* in the suffixes table */
+	rb_dlink_list bans;		/* newest first */
+};
+
+struct ban_index
+{
+	struct hashtab *hosts;		/* bans on an exact host */
+	struct hashtab *suffixes;	/* bans on *.domain, by domain */
+	rb_dlink_list wild;		/* everything else, newest first */
+};
+
+static unsigned long ban_seq;
+
+/* ban_host_key()
+ *   finds what a ban is indexed under
+ *
+ * inputs	- collapsed ban mask, set to whether its a *.domain ban
+ * outputs	- host or domain from the mask, or NULL if its too wild
+ *		  to index
+ */
+static const char *
+ban_host_key(const char *mask, int *suffix)
+{
+	const char *host;
+	const char *s;
+
+	*suffix = 0;
+
+	if((host = strchr(mask, '@')) == NULL)
+		return NULL;
+
+	host++;
+
+	if(host[0] == '*' && host[1] == '.')
+	{
+		host += 2;
+		*suffix = 1;
+	}
+
+	if(EmptyString(host))
+		return NULL;
+
+	/* the host has to match a users host exactly, so the mask may only
+	 * have the one '@' which lines up with theirs
+	 */
+	for(s = host; *s; s++)
+	{
+		if(*s == '*' || *s == '?' || *s == '@')
+			return NULL;
+	}
+
+	return host;
+}
+
+static void
+ban_index_add(struct ban_index *index_p, struct ban_reg *banreg_p)
+{
+	struct hashtab *table;
+	struct ban_bucket *bucket;
+	const char *key;
+	int suffix;
+
+	if((key = ban_host_key(banreg_p->mask, &suffix)) == NULL)
+	{
+		banreg_p->bucket = NULL;
+		rb_dlinkAdd(banreg_p, &banreg_p->indexnode, &index_p->wild);
+		return;
+	}
+
+	table = suffix ? index_p->suffixes : index_p->hosts;
+
+	if((bucket = hashtab_find(table, key)) == NULL)
+	{
+		bucket = rb_malloc(sizeof(struct ban_bucket));
+		bucket->key = rb_strdup(key);
+		bucket->suffix = suffix;
+		hashtab_add(table, bucket->key, bucket);
+	}
+
+	banreg_p->bucket = bucket;
+	rb_dlinkAdd(banreg_p, &banreg_p->indexnode, &bucket->bans);
+}
+
+static void
+ban_index_del(struct ban_index *index_p, struct ban_reg *banreg_p)
+{
+	struct ban_bucket *bucket = banreg_p->bucket;
+
+	if(bucket == NULL)
+	{
+		rb_dlinkDelete(&banreg_p->indexnode, &index_p->wild);
+		return;
+	}
+
+	rb_dlinkDelete(&banreg_p->indexnode, &bucket->bans);
+
+	if(rb_dlink_list_length(&bucket->bans) == 0)
+	{
+		hashtab_del(bucket->suffix ? index_p->suffixes : index_p->hosts,
+				bucket->key, bucket);
+		rb_free(bucket->key);
+		rb_free(bucket);
+	}
+}
+
+static void
+free_ban_buckets(struct hashtab *table)
+{
+	struct ban_bucket *bucket;
+	unsigned int i;
+
+	HASHTAB_WALK(i, bucket, table)
+	{
+		rb_free(bucket->key);
+		rb_free(bucket);
+	}
+	HASHTAB_WALK_END
+
+	hashtab_destroy(table);
+}
+
+/* build_ban_index()
+ *   (re)builds the index of a registrations bans
+ *
+ * inputs	- channel reg, whether to build the index or just remove it
+ * outputs	-
+ */
+static void
+build_ban_index(struct chan_reg *chreg_p, int build)
+{
+	struct ban_index *index_p = chreg_p->ban_index;
+	rb_dlink_node *ptr;
+
+	if(index_p != NULL)
+	{
+		free_ban_buckets(index_p->hosts);
+		free_ban_buckets(index_p->suffixes);
+		rb_free(index_p);
+		chreg_p->ban_index = NULL;
+	}
+
+	if(!build)
+		return;
+
+	index_p = rb_malloc(sizeof(struct ban_index));
+	index_p->hosts = hashtab_create(BAN_INDEX_MIN, irccmp);
+	index_p->suffixes = hashtab_create(BAN_INDEX_MIN, irccmp);
+
+	/* oldest first, so the buckets end up newest first */
+	RB_DLINK_FOREACH_PREV(ptr, chreg_p->bans.tail)
+	{
+		ban_index_add(index_p, ptr->data);
+	}
+
+	chreg_p->ban_index = index_p;
+}
+
 static struct ban_reg *
 make_ban_reg(struct chan_reg *chreg_p, const char *mask, const char *reason,
               const char *username, int level, int hold)
@@ -627,8 +792,16 @@ make_ban_reg(struct chan_reg *chreg_p, const char *mask, const char *reason,
 	banreg_p->hold = hold;
 
 	collapse(banreg_p->mask);
+	banreg_p->cmask = compile_mask(banreg_p->mask);
+	banreg_p->seq = ++ban_seq;
 
 	rb_dlinkAdd(banreg_p, &banreg_p->channode, &chreg_p->bans);
+
+	if(chreg_p->ban_index != NULL)
+		ban_index_add(chreg_p->ban_index, banreg_p);
+	else if(rb_dlink_list_length(&chreg_p->bans) >= BAN_INDEX_MIN)
+		build_ban_index(chreg_p, 1);
+
 	return banreg_p;
 }
 
@@ -637,6 +810,15 @@ free_ban_reg(struct chan_reg *chreg_p, struct ban_reg *banreg_p)
 {
 	rb_dlinkDelete(&banreg_p->channode, &chreg_p->bans);
 
+	if(chreg_p->ban_index != NULL)
+	{
+		if(rb_dlink_list_length(&chreg_p->bans) < BAN_INDEX_MIN / 2)
+			build_ban_index(chreg_p, 0);
+		else
+			ban_index_del(chreg_p->ban_index, banreg_p);
+	}
+
+	free_mask(banreg_p->cmask);
 	rb_free(banreg_p->mask);
 	rb_free(banreg_p->reason);
 	rb_free(banreg_p->username);
@@ -647,10 +829,27 @@ free_ban_reg(struct chan_reg *chreg_p, struct ban_reg *banreg_p)
 static struct ban_reg *
 find_ban_reg(struct chan_reg *chreg_p, const char *mask)
 {
+	struct ban_index *index_p = chreg_p->ban_index;
+	struct ban_bucket *bucket;
 	struct ban_reg *banreg_p;
+	rb_dlink_list *list = &chreg_p->bans;
 	rb_dlink_node *ptr;
+	const char *key;
+	int suffix;
+
+	/* an identical mask is indexed under the same key */
+	if(index_p != NULL)
+	{
+		if((key = ban_host_key(mask, &suffix)) == NULL)
+			list = &index_p->wild;
+		else if((bucket = hashtab_find(suffix ? index_p->suffixes : index_p->hosts,
+						key)) != NULL)
+			list = &bucket->bans;
+		else
+			return NULL;
+	}
 
-	RB_DLINK_FOREACH(ptr, chreg_p->bans.head)
+	RB_DLINK_FOREACH(ptr, list->head)
 	{
 		banreg_p = ptr->data;
 
@@ -661,6 +860,94 @@ find_ban_reg(struct chan_reg *chreg_p, const char *mask)
 	return NULL;
 }
 
+/* ban_applies()
+ *   checks whether a ban should be enforced against a user
+ */
+static int
+ban_applies(struct ban_reg *banreg_p, struct match_name *mname,
+		struct member_reg *mreg_p)
+{
+	/* ban has expired? */
+	if(banreg_p->hold && banreg_p->hold <= rb_time())
+		return 0;
+
+	if(!match_mask_name(banreg_p->cmask, mname))
+		return 0;
+
+	if(mreg_p && mreg_p->level >= banreg_p->level)
+		return 0;
+
+	return 1;
+}
+
+/* ban_list_match()
+ *   finds the newest ban in a list that applies to a user, if its newer
+ *   than the one already found
+ */
+static struct ban_reg *
+ban_list_match(rb_dlink_list *list, struct ban_reg *found,
+		struct match_name *mname, struct member_reg *mreg_p)
+{
+	struct ban_reg *banreg_p;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		banreg_p = ptr->data;
+
+		/* newest first, nothing further on can beat it */
+		if(found != NULL && banreg_p->seq < found->seq)
+			break;
+
+		if(ban_applies(banreg_p, mname, mreg_p))
+			return banreg_p;
+	}
+
+	return found;
+}
+
+/* find_ban_reg_match()
+ *   finds the ban to enforce against a user
+ *
+ * inputs	- channel reg, user, their (non suspended) access or NULL
+ * outputs	- the newest ban that applies to them, as the first that
+ *		  would be found walking chreg_p->bans, or NULL
+ */
+static struct ban_reg *
+find_ban_reg_match(struct chan_reg *chreg_p, struct client *client_p,
+			struct member_reg *mreg_p)
+{
+	struct ban_index *index_p = chreg_p->ban_index;
+	struct ban_bucket *bucket;
+	struct ban_reg *found;
+	struct match_name mname;
+	const char *s;
+
+	if(!rb_dlink_list_length(&chreg_p->bans))
+		return NULL;
+
+	fold_name(&mname, client_p->user->mask);
+
+	if(index_p == NULL)
+		return ban_list_match(&chreg_p->bans, NULL, &mname, mreg_p);
+
+	found = ban_list_match(&index_p->wild, NULL, &mname, mreg_p);
+
+	if((bucket = hashtab_find(index_p->hosts, client_p->user->host)) != NULL)
+		found = ban_list_match(&bucket->bans, found, &mname, mreg_p);
+
+	/* *.domain bans on each domain the host is in */
+	for(s = client_p->user->host; (s = strchr(s, '.')) != NULL; )
+	{
+		s++;
+
+		if((bucket = hashtab_find(index_p->suffixes, s)) != NULL)
+			found = ban_list_match(&bucket->bans, found, &mname, mreg_p);
+	}
+
+	return found;
+}
+
 static int
 ban_db_callback(int argc, const char **argv)
 {
@@ -816,15 +1103,13 @@ static void
 e_chanserv_updatechan(void *unused)
 {
 	struct chan_reg *chreg_p;
-	rb_dlink_node *ptr, *next_ptr;
 	int i;
 
 	/* Start a transaction, we're going to make a lot of changes */
 	rsdb_transaction(RSDB_TRANS_START);
 
-	HASH_WALK_SAFE(i, MAX_CHANNEL_TABLE, ptr, next_ptr, chan_reg_table)
+	HASHTAB_WALK(i, chreg_p, chan_reg_table)
 	{
-		chreg_p = ptr->data;
 
 		if(chreg_p->flags & CS_FLAGS_NEEDUPDATE)
 		{
@@ -834,7 +1119,7 @@ e_chanserv_updatechan(void *unused)
 					chreg_p->last_time, chreg_p->tsinfo, chreg_p->name);
 		}
 	}
-	HASH_WALK_END
+	HASHTAB_WALK_END
 
 	rsdb_transaction(RSDB_TRANS_END);
 }
@@ -850,15 +1135,13 @@ static void
 e_chanserv_expirechan(void *unused)
 {
 	struct chan_reg *chreg_p;
-	rb_dlink_node *ptr, *next_ptr;
 	int i;
 
 	/* Start a transaction, we're going to make a lot of changes */
 	rsdb_transaction(RSDB_TRANS_START);
 
-	HASH_WALK_SAFE(i, MAX_CHANNEL_TABLE, ptr, next_ptr, chan_reg_table)
+	HASHTAB_WALK(i, chreg_p, chan_reg_table)
 	{
-		chreg_p = ptr->data;
 
 		if(CHAN_SUSPEND_EXPIRED(chreg_p))
 			expire_chan_suspend(chreg_p);
@@ -888,7 +1171,7 @@ e_chanserv_expirechan(void *unused)
 
 		destroy_channel_reg(chreg_p);
 	}
-	HASH_WALK_END
+	HASHTAB_WALK_END
 
 	rsdb_transaction(RSDB_TRANS_END);
 }	
@@ -898,7 +1181,6 @@ e_chanserv_expireban(void *unused)
 {
 	struct chan_reg *chreg_p;
 	struct ban_reg *banreg_p;
-	rb_dlink_node *hptr;
 	rb_dlink_node *ptr, *next_ptr;
 	rb_dlink_node *bptr;
 	int i, any;
@@ -907,9 +1189,8 @@ e_chanserv_expireban(void *unused)
 	/* Start a transaction, we're going to make a lot of changes */
 	rsdb_transaction(RSDB_TRANS_START);
 
-	HASH_WALK(i, MAX_CHANNEL_TABLE, hptr, chan_reg_table)
+	HASHTAB_WALK(i, chreg_p, chan_reg_table)
 	{
-		chreg_p = hptr->data;
 		any = 0;
 		chptr = NULL;
 
@@ -948,7 +1229,7 @@ e_chanserv_expireban(void *unused)
 		if (chptr != NULL)
 			modebuild_finish();
 	}
-	HASH_WALK_END
+	HASHTAB_WALK_END
 
 	rsdb_transaction(RSDB_TRANS_END);
 }
@@ -958,16 +1239,14 @@ e_chanserv_enforcetopic(void *unused)
 {
 	struct channel *chptr;
 	struct chan_reg *chreg_p;
-	rb_dlink_node *ptr;
 	int i;
 
 	/* topics are enforced automatically */
 	if(config_file.cenforcetopic_frequency == 0)
 		return;
 
-	HASH_WALK(i, MAX_CHANNEL_TABLE, ptr, chan_reg_table)
+	HASHTAB_WALK(i, chreg_p, chan_reg_table)
 	{
-		chreg_p = ptr->data;
 
 		if(EmptyString(chreg_p->topic))
 			continue;
@@ -989,7 +1268,7 @@ e_chanserv_enforcetopic(void *unused)
 		rb_strlcpy(chptr->topicwho, MYNAME, sizeof(chptr->topicwho));
 		chptr->topic_tsinfo = rb_time();
 	}
-	HASH_WALK_END
+	HASHTAB_WALK_END
 }
 
 static void
@@ -1004,12 +1283,10 @@ e_chanserv_partinhabit(void *unused)
 {
 	struct channel *chptr;
 	struct chan_reg *chreg_p;
-	rb_dlink_node *ptr;
 	int i;
 
-	HASH_WALK(i, MAX_CHANNEL_TABLE, ptr, chan_reg_table)
+	HASHTAB_WALK(i, chreg_p, chan_reg_table)
 	{
-		chreg_p = ptr->data;
 
 		if((chreg_p->flags & (CS_FLAGS_INHABIT|CS_FLAGS_AUTOJOIN)) == 0)
 			continue;
@@ -1064,7 +1341,7 @@ e_chanserv_partinhabit(void *unused)
 			continue;
 		}
 	}
-	HASH_WALK_END
+	HASHTAB_WALK_END
 }
 
 static int
@@ -1334,32 +1611,25 @@ dlink_find_string(const char *data, rb_dlink_list *list)
 
 
 
-static int
-h_chanserv_join(void *v_chptr, void *v_members)
+/* chanserv_join_members()
+ *   enforces bans and op/voice settings on members joining a registered
+ *   channel, removing those kicked from the list
+ */
+static void
+chanserv_join_members(struct chan_reg *chreg_p, struct channel *chptr,
+			rb_dlink_list *members)
 {
-	struct chan_reg *chreg_p;
 	struct member_reg *mreg_p;
 	struct ban_reg *banreg_p;
-	struct channel *chptr = v_chptr;
 	struct chmember *member_p;
-	rb_dlink_list *members = v_members;
 	rb_dlink_node *ptr, *next_ptr;
-	rb_dlink_node *bptr;
 	int hit;
 
-	/* another hook couldve altered this.. */
-	if(!rb_dlink_list_length(members))
-		return 0;
-
-	/* not registered, cant ban anyone.. */
-	if((chreg_p = find_channel_reg(NULL, chptr->name)) == NULL)
-		return 0;
-
 	if(CHAN_SUSPEND_EXPIRED(chreg_p))
 		expire_chan_suspend(chreg_p);
 
 	if(chreg_p->flags & CS_FLAGS_SUSPENDED)
-		return 0;
+		return;
 
 	modebuild_start(chanserv_p, chptr);
 	kickbuild_start();
@@ -1378,23 +1648,10 @@ h_chanserv_join(void *v_chptr, void *v_members)
 		if(mreg_p != NULL && mreg_p->suspend)
 			mreg_p = NULL;
 
-		RB_DLINK_FOREACH(bptr, chreg_p->bans.head)
-		{
-			banreg_p = bptr->data;
-
-			/* ban has expired? */
-			if(banreg_p->hold && banreg_p->hold <= rb_time())
-				continue;
-
-			if(!match(banreg_p->mask, member_p->client_p->user->mask))
-				continue;
-
-			if(mreg_p && mreg_p->level >= banreg_p->level)
-				continue;
-
-			if(find_exempt(member_p->chptr, member_p->client_p))
-				break;
+		banreg_p = find_ban_reg_match(chreg_p, member_p->client_p, mreg_p);
 
+		if(banreg_p != NULL && !find_exempt(member_p->chptr, member_p->client_p))
+		{
 			/* explained in delban */
 			if(mreg_p)
 				mreg_p->bants = chreg_p->bants;
@@ -1425,14 +1682,8 @@ h_chanserv_join(void *v_chptr, void *v_members)
 
 			rb_dlinkDestroy(ptr, members);
 			del_chmember(member_p);
-			hit++;
-			break;
-		}
-
-		if(hit)
 			continue;
-		else
-			hit = 0;
+		}
 
 		if(mreg_p != NULL)
 		{
@@ -1503,10 +1754,82 @@ h_chanserv_join(void *v_chptr, void *v_members)
 
 	modebuild_finish();
 	kickbuild_finish(chanserv_p, chptr);
+}
+
+static int
+h_chanserv_join(void *v_chptr, void *v_members)
+{
+	struct chan_reg *chreg_p;
+	struct channel *chptr = v_chptr;
+	rb_dlink_list *members = v_members;
+
+	/* another hook couldve altered this.. */
+	if(!rb_dlink_list_length(members))
+		return 0;
+
+	/* not registered, cant ban anyone.. */
+	if((chreg_p = find_channel_reg(NULL, chptr->name)) == NULL)
+		return 0;
+
+	/* whilst our uplink bursts a channel can arrive over several SJOINs
+	 * with its BMASKs after, so just note it and deal with everyone in
+	 * it once at the end of the burst.
+	 */
+	if(!finished_bursting)
+	{
+		if(!chreg_p->burst_join)
+		{
+			chreg_p->burst_join = 1;
+			rb_dlinkAdd(chreg_p, &chreg_p->burstnode, &burst_join_list);
+		}
+
+		return 0;
+	}
 
+	chanserv_join_members(chreg_p, chptr, members);
 	return 0;
 }
 
+/* chanserv_burst_joins()
+ *   deals with the registered channels joined during our uplinks burst,
+ *   treating everyone in each as having just joined
+ */
+static void
+chanserv_burst_joins(void)
+{
+	struct chan_reg *chreg_p;
+	struct channel *chptr;
+	rb_dlink_list members;
+	rb_dlink_node *ptr, *next_ptr;
+	rb_dlink_node *mptr, *next_mptr;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, burst_join_list.head)
+	{
+		chreg_p = ptr->data;
+
+		rb_dlinkDelete(ptr, &burst_join_list);
+		chreg_p->burst_join = 0;
+
+		/* may have emptied again during the burst */
+		if((chptr = find_channel(chreg_p->name)) == NULL)
+			continue;
+
+		memset(&members, 0, sizeof(rb_dlink_list));
+
+		RB_DLINK_FOREACH(mptr, chptr->users.head)
+		{
+			rb_dlinkAddAlloc(mptr->data, &members);
+		}
+
+		chanserv_join_members(chreg_p, chptr, &members);
+
+		RB_DLINK_FOREACH_SAFE(mptr, next_mptr, members.head)
+		{
+			rb_free_rb_dlink_node(mptr);
+		}
+	}
+}
+
 /* A user logged in;
  * if they have access, note the channel is being used and op/voice them if
  * appropriate
@@ -1581,6 +1904,8 @@ h_chanserv_user_login(void *v_client_p, void *unused)
 static int
 h_chanserv_eob_uplink(void *unused, void *unusedd)
 {
+	chanserv_burst_joins();
+
 	/* ugh, uplink doesn't support topic bursting */
 	if(!ConnCapTB(server_p))
 	{
@@ -1823,7 +2148,6 @@ o_chan_chanlist(struct client *client_p, struct lconn *conn_p, const char *parv[
 	static char buf[BUFSIZE];
 	struct chan_reg *chreg_p;
 	const char *mask = def_mask;
-	rb_dlink_node *ptr;
 	unsigned int limit = 100;
 	int para = 0;
 	int longlist = 0, suspended = 0;
@@ -1857,9 +2181,8 @@ o_chan_chanlist(struct client *client_p, struct lconn *conn_p, const char *parv[
 	service_snd(chanserv_p, client_p, conn_p, SVC_CHAN_LISTSTART,
 			mask, limit, suspended ? ", suspended" : "");
 
-	HASH_WALK(i, MAX_CHANNEL_TABLE, ptr, chan_reg_table)
+	HASHTAB_WALK(i, chreg_p, chan_reg_table)
 	{
-		chreg_p = ptr->data;
 
 		if(!match(mask, chreg_p->name))
 			continue;
@@ -1917,15 +2240,11 @@ o_chan_chanlist(struct client *client_p, struct lconn *conn_p, const char *parv[
 		}
 
 		if(limit == 1)
-		{
-			/* two loops to exit here, kludge it */
-			i = MAX_CHANNEL_TABLE;
 			break;
-		}
 
 		limit--;
 	}
-	HASH_WALK_END
+	HASHTAB_WALK_END
 
 	if(!longlist)
 		service_send(chanserv_p, client_p, conn_p, "  %s", buf);
@@ -3467,7 +3786,7 @@ s_chan_addban(struct client *client_p, struct lconn *conn_p, const char *parv[],
 	{
 		msptr = ptr->data;
 
-		if(!match(mask, msptr->client_p->user->mask))
+		if(!match_mask(banreg_p->cmask, msptr->client_p->user->mask))
 			continue;
 
 		/* matching +e */
@@ -3849,12 +4168,11 @@ s_chanserv_countmem(size_t *sz_chan_reg_name, size_t *sz_chan_reg_topic,
 {
 	struct chan_reg *chreg_p;
 	struct ban_reg *banreg_p;
-	rb_dlink_node *ptr, *vptr;
+	rb_dlink_node *vptr;
 	int i;
 
-	HASH_WALK(i, MAX_CHANNEL_TABLE, ptr, chan_reg_table)
+	HASHTAB_WALK(i, chreg_p, chan_reg_table)
 	{
-		chreg_p = ptr->data;
 
 		if(!EmptyString(chreg_p->name))
 			*sz_chan_reg_name += strlen(chreg_p->name) + 1;
@@ -3885,6 +4203,6 @@ s_chanserv_countmem(size_t *sz_chan_reg_name, size_t *sz_chan_reg_topic,
 				*sz_ban_reg_username += strlen(banreg_p->username) + 1;
 		}
 	}
-	HASH_WALK_END
+	HASHTAB_WALK_END
 }
 
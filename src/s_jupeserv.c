@@ -49,6 +49,7 @@
 #include "event.h"
 #include "watch.h"
 #include "tools.h"
+#include "latency.h"
 
 struct server_jupe
 {
@@ -125,7 +126,7 @@ init_s_jupeserv(void)
 
 	hook_add(h_jupeserv_squit, HOOK_PROTO_SQUIT_UNKNOWN);
 	hook_add(h_jupeserv_finburst, HOOK_EOB_UPLINK);
-	rb_event_add("e_jupeserv_expire", e_jupeserv_expire, NULL, 60);
+	latency_event_add("e_jupeserv_expire", e_jupeserv_expire, NULL, 60);
 
 	rsdb_exec(jupe_db_callback, "SELECT servername, reason FROM jupes");
 }
@@ -166,19 +166,20 @@ s_memo_read(struct client *client_p, struct lconn *conn_p, const char *parv[], i
 
 	if(!strcasecmp(parv[0], "ALL"))
 	{
-		int i;
+		struct rsdb_cursor cursor;
+		const char **row;
 
-		rsdb_exec_fetch(&data, "SELECT id, source, timestamp, text FROM memos WHERE user_id='%u'",
+		rsdb_cursor_open(&cursor, "SELECT id, source, timestamp, text FROM memos WHERE user_id='%u'",
 				client_p->user->user_reg->id);
 
-		for(i = 0; i < data.row_count; i++)
+		while((row = rsdb_cursor_next(&cursor)))
 		{
 			service_err(memoserv_p, client_p, SVC_MEMO_READ,
-					atoi(data.row[i][0]), get_time(atoi(data.row[i][2]), 0),
-					data.row[i][1], data.row[i][3]);
+					atoi(row[0]), get_time(atoi(row[2]), 0),
+					row[1], row[3]);
 		}
 
-		rsdb_exec_fetch_end(&data);
+		rsdb_cursor_close(&cursor);
 
 		rsdb_exec(NULL, "UPDATE memos SET flags = (flags|%u) WHERE user_id='%u'",
 				MS_FLAGS_READ, client_p->user->user_reg->id);
@@ -49,13 +49,14 @@
 #include "hook.h"
 #include "watch.h"
 #include "tools.h"
+#include "hashtab.h"
 
 static void init_s_nickserv(void);
 
 static struct client *nickserv_p;
 static rb_bh *nick_reg_heap;
 
-static rb_dlink_list nick_reg_table[MAX_NAME_HASH];
+static struct hashtab *nick_reg_table;
 
 static int o_nick_nickdrop(struct client *, struct lconn *, const char **, int);
 
@@ -98,6 +99,7 @@ void
 preinit_s_nickserv(void)
 {
 	nickserv_p = add_service(&nick_service);
+	nick_reg_table = hashtab_create(NICK_REG_HASH_SIZE, irccmp);
 }
 
 static void
@@ -116,19 +118,16 @@ init_s_nickserv(void)
 static void
 add_nick_reg(struct nick_reg *nreg_p)
 {
-	unsigned int hashv = hash_name(nreg_p->name);
-	rb_dlinkAdd(nreg_p, &nreg_p->node, &nick_reg_table[hashv]);
+	hashtab_add(nick_reg_table, nreg_p->name, nreg_p);
 }
 
 void
 free_nick_reg(struct nick_reg *nreg_p)
 {
-	unsigned int hashv = hash_name(nreg_p->name);
-
 	rsdb_exec(NULL, "DELETE FROM nicks WHERE nickname = '%Q'",
 			nreg_p->name);
 
-	rb_dlinkDelete(&nreg_p->node, &nick_reg_table[hashv]);
+	hashtab_del(nick_reg_table, nreg_p->name, nreg_p);
 	rb_dlinkDelete(&nreg_p->usernode, &nreg_p->user_reg->nicks);
 	rb_bh_free(nick_reg_heap, nreg_p);
 }
@@ -137,15 +136,9 @@ static struct nick_reg *
 find_nick_reg(struct client *client_p, const char *name)
 {
 	struct nick_reg *nreg_p;
-	rb_dlink_node *ptr;
-	unsigned int hashv = hash_name(name);
 
-	RB_DLINK_FOREACH(ptr, nick_reg_table[hashv].head)
-	{
-		nreg_p = ptr->data;
-		if(!irccmp(nreg_p->name, name))
-			return nreg_p;
-	}
+	if((nreg_p = hashtab_find(nick_reg_table, name)) != NULL)
+		return nreg_p;
 
 	if(client_p)
 		service_err(nickserv_p, client_p, SVC_NICK_NOTREG, name);
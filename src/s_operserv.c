@@ -463,10 +463,12 @@ o_oper_addignore(struct client *client_p, struct lconn *conn_p, const char *parv
 
 	RB_DLINK_FOREACH(ptr, ignore_list.head)
 	{
-		if(match(ptr->data, parv[0]))
+		ignore_p = ptr->data;
+
+		if(match(ignore_p->mask, parv[0]))
 		{
 			service_snd(operserv_p, client_p, conn_p, SVC_OPER_IGNOREALREADY,
-					parv[0], ptr->data);
+					parv[0], ignore_p->mask);
 			return 0;
 		}
 	}
@@ -477,7 +479,7 @@ o_oper_addignore(struct client *client_p, struct lconn *conn_p, const char *parv
 	ignore_p->reason = rb_strdup(rebuild_params(parv, parc, 1));
 	ignore_p->oper = rb_strdup(OPER_NAME(client_p, conn_p));
 
-	rb_dlinkAdd(ignore_p, &ignore_p->ptr, &ignore_list);
+	add_ignore(ignore_p);
 
 	rsdb_exec(NULL, "INSERT INTO ignore_hosts (hostname, oper, reason) VALUES('%Q', '%Q', '%Q')",
 			ignore_p->mask, ignore_p->oper, ignore_p->reason);
@@ -499,12 +501,7 @@ o_oper_delignore(struct client *client_p, struct lconn *conn_p, const char *parv
 
 		if(!irccmp(ignore_p->mask, parv[0]))
 		{
-			rb_dlinkDelete(&ignore_p->ptr, &ignore_list);
-
-			rb_free(ignore_p->mask);
-			rb_free(ignore_p->oper);
-			rb_free(ignore_p->reason);
-			rb_free(ignore_p);
+			free_ignore(ignore_p);
 
 			rsdb_exec(NULL, "DELETE FROM ignore_hosts WHERE hostname='%Q'", parv[0]);
 
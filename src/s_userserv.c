@@ -54,15 +54,21 @@
 #include "dbhook.h"
 #include "watch.h"
 #include "tools.h"
+#include "hashtab.h"
+#include "latency.h"
 
-#define MAX_HASH_WALK	1024
+/* each expire run walks this fraction of the registrations */
+#define EXPIRE_WALK_SLICES	64
 
 static void init_s_userserv(void);
 
 static struct client *userserv_p;
 static rb_bh *user_reg_heap;
 
-rb_dlink_list user_reg_table[MAX_NAME_HASH];
+/* updated for every user on each expire run, so keep it prepared */
+static struct rsdb_stmt *user_last_time_stmt;
+
+static struct hashtab *user_reg_table;
 
 static int o_user_userregister(struct client *, struct lconn *, const char **, int);
 static int o_user_userdrop(struct client *, struct lconn *, const char **, int);
@@ -140,6 +146,7 @@ void
 preinit_s_userserv(void)
 {
 	userserv_p = add_service(&userserv_service);
+	user_reg_table = hashtab_create(USER_REG_HASH_SIZE, strcasecmp);
 }
 
 static void
@@ -151,6 +158,8 @@ init_s_userserv(void)
 			"SELECT username, password, email, suspender, suspend_reason, "
 			"suspend_time, reg_time, last_time, flags, language, id FROM users");
 
+	user_last_time_stmt = rsdb_stmt_declare("UPDATE users SET last_time=? WHERE username=?");
+
 	rsdb_hook_add("users_sync", "REGISTER", 900, dbh_user_register);
 	rsdb_hook_add("users_sync", "SETPASS", 900, dbh_user_setpass);
 	rsdb_hook_add("users_sync", "SETEMAIL", 900, dbh_user_setemail);
@@ -158,24 +167,22 @@ init_s_userserv(void)
 	hook_add(h_user_burst_login, HOOK_USERSERV_LOGIN_BURST);
 	hook_add(h_user_dbsync, HOOK_DBSYNC);
 
-	rb_event_add("userserv_expire", e_user_expire, NULL, 900);
-	rb_event_add("userserv_expire_reset", e_user_expire_reset, NULL, 3600);
+	latency_event_add("userserv_expire", e_user_expire, NULL, 900);
+	latency_event_add("userserv_expire_reset", e_user_expire_reset, NULL, 3600);
 }
 
 static void
 add_user_reg(struct user_reg *reg_p)
 {
-	unsigned int hashv = hash_name(reg_p->name);
-	rb_dlinkAdd(reg_p, &reg_p->node, &user_reg_table[hashv]);
+	hashtab_add(user_reg_table, reg_p->name, reg_p);
 }
 
 static void
 free_user_reg(struct user_reg *ureg_p)
 {
 	rb_dlink_node *ptr, *next_ptr;
-	unsigned int hashv = hash_name(ureg_p->name);
 
-	rb_dlinkDelete(&ureg_p->node, &user_reg_table[hashv]);
+	hashtab_del(user_reg_table, ureg_p->name, ureg_p);
 
 	rsdb_exec(NULL, "DELETE FROM users_resetpass WHERE username = '%Q'",
 			ureg_p->name);
@@ -261,16 +268,9 @@ struct user_reg *
 find_user_reg(struct client *client_p, const char *username)
 {
 	struct user_reg *reg_p;
-	unsigned int hashv = hash_name(username);
-	rb_dlink_node *ptr;
 
-	RB_DLINK_FOREACH(ptr, user_reg_table[hashv].head)
-	{
-		reg_p = ptr->data;
-
-		if(!strcasecmp(reg_p->name, username))
-			return reg_p;
-	}
+	if((reg_p = hashtab_find(user_reg_table, username)) != NULL)
+		return reg_p;
 
 	if(client_p != NULL)
 		service_err(userserv_p, client_p, SVC_USER_NOTREG, username);
@@ -492,14 +492,12 @@ static int
 h_user_dbsync(void *unused, void *unusedd)
 {
 	struct user_reg *ureg_p;
-	rb_dlink_node *ptr;
 	int i;
 
 	rsdb_transaction(RSDB_TRANS_START);
 
-	HASH_WALK(i, MAX_NAME_HASH, ptr, user_reg_table)
+	HASHTAB_WALK(i, ureg_p, user_reg_table)
 	{
-		ureg_p = ptr->data;
 
 		/* if they're logged in, reset the expiry */
 		if(rb_dlink_list_length(&ureg_p->users))
@@ -511,11 +509,12 @@ h_user_dbsync(void *unused, void *unusedd)
 		if(ureg_p->flags & US_FLAGS_NEEDUPDATE)
 		{
 			ureg_p->flags &= ~US_FLAGS_NEEDUPDATE;
-			rsdb_exec(NULL, "UPDATE users SET last_time='%lu' WHERE username='%Q'",
-					ureg_p->last_time, ureg_p->name);
+			rsdb_stmt_bind_time(user_last_time_stmt, 1, ureg_p->last_time);
+			rsdb_stmt_bind_str(user_last_time_stmt, 2, ureg_p->name);
+			rsdb_stmt_exec(user_last_time_stmt, NULL);
 		}
 	}
-	HASH_WALK_END
+	HASHTAB_WALK_END
 
 	rsdb_transaction(RSDB_TRANS_END);
 
@@ -545,17 +544,18 @@ expire_bonus(time_t duration)
 static void
 e_user_expire(void *unused)
 {
-	static int hash_pos = 0;
+	static unsigned int hash_pos = 0;
 	struct user_reg *ureg_p;
-	rb_dlink_node *ptr, *next_ptr;
+	unsigned int walk_max;
 	int i;
 
 	/* Start a transaction, we're going to make a lot of changes */
 	rsdb_transaction(RSDB_TRANS_START);
 
-	HASH_WALK_SAFE_POS(i, hash_pos, MAX_HASH_WALK, MAX_NAME_HASH, ptr, next_ptr, user_reg_table)
+	walk_max = user_reg_table->alloc / EXPIRE_WALK_SLICES + 1;
+
+	HASHTAB_WALK_POS(i, hash_pos, walk_max, ureg_p, user_reg_table)
 	{
-		ureg_p = ptr->data;
 
 		/* nuke unverified accounts first */
 		if(ureg_p->flags & US_FLAGS_NEVERLOGGEDIN &&
@@ -575,8 +575,9 @@ e_user_expire(void *unused)
 		if(ureg_p->flags & US_FLAGS_NEEDUPDATE)
 		{
 			ureg_p->flags &= ~US_FLAGS_NEEDUPDATE;
-			rsdb_exec(NULL, "UPDATE users SET last_time='%lu' WHERE username='%Q'",
-				ureg_p->last_time, ureg_p->name);
+			rsdb_stmt_bind_time(user_last_time_stmt, 1, ureg_p->last_time);
+			rsdb_stmt_bind_str(user_last_time_stmt, 2, ureg_p->name);
+			rsdb_stmt_exec(user_last_time_stmt, NULL);
 		}
 
 		if(ureg_p->flags & US_FLAGS_SUSPENDED)
@@ -595,7 +596,7 @@ e_user_expire(void *unused)
 
 		free_user_reg(ureg_p);
 	}
-	HASH_WALK_SAFE_POS_END(i, hash_pos, MAX_NAME_HASH);
+	HASHTAB_WALK_POS_END(hash_pos, walk_max, user_reg_table);
 
 	rsdb_transaction(RSDB_TRANS_END);
 }
@@ -818,7 +819,6 @@ o_user_userlist(struct client *client_p, struct lconn *conn_p, const char *parv[
 	static char buf[BUFSIZE];
 	struct user_reg *ureg_p;
 	const char *mask = def_mask;
-	rb_dlink_node *ptr;
 	unsigned int limit = 100;
 	int para = 0;
 	int longlist = 0, suspended = 0;
@@ -852,9 +852,8 @@ o_user_userlist(struct client *client_p, struct lconn *conn_p, const char *parv[
 	service_snd(userserv_p, client_p, conn_p, SVC_USER_UL_START,
 			mask, limit, suspended ? ", suspended" : "");
 
-	HASH_WALK(i, MAX_NAME_HASH, ptr, user_reg_table)
+	HASHTAB_WALK(i, ureg_p, user_reg_table)
 	{
-		ureg_p = ptr->data;
 
 		if(!match(mask, ureg_p->name))
 			continue;
@@ -917,15 +916,11 @@ o_user_userlist(struct client *client_p, struct lconn *conn_p, const char *parv[
 		}
 
 		if(limit == 1)
-		{
-			/* two loops to exit here, kludge it */
-			i = MAX_NAME_HASH;
 			break;
-		}
 
 		limit--;
 	}
-	HASH_WALK_END
+	HASHTAB_WALK_END
 
 	if(!longlist)
 		service_send(userserv_p, client_p, conn_p, "  %s", buf);
@@ -2166,12 +2161,11 @@ s_userserv_countmem(size_t *sz_user_reg_password, size_t *sz_user_reg_email,
 {
 	struct user_reg *ureg_p;
 	struct member_reg *mreg_p;
-	rb_dlink_node *ptr, *vptr;
+	rb_dlink_node *vptr;
 	int i;
 
-	HASH_WALK(i, MAX_NAME_HASH, ptr, user_reg_table)
+	HASHTAB_WALK(i, ureg_p, user_reg_table)
 	{
-		ureg_p = ptr->data;
 
 		if(!EmptyString(ureg_p->password))
 			*sz_user_reg_password += strlen(ureg_p->password) + 1;
@@ -2191,7 +2185,7 @@ s_userserv_countmem(size_t *sz_user_reg_password, size_t *sz_user_reg_email,
 			*sz_member_reg_lastmod += strlen(mreg_p->lastmod) + 1;
 		}
 	}
-	HASH_WALK_END
+	HASHTAB_WALK_END
 }
 
 #endif
@@ -44,8 +44,14 @@
 #include "hook.h"
 #include "event.h"
 #include "s_userserv.h"
+#include "latency.h"
 
+/* handlers are looked up directly by command_slot(), anything that
+ * collides with a handler already there goes in scommand_table instead.
+ */
+static struct scommand_handler *scommand_direct[COMMAND_SLOTS];
 static rb_dlink_list scommand_table[MAX_SCOMMAND_HASH];
+static unsigned int scommand_table_count;
 
 static void c_admin(struct client *, const char *parv[], int parc);
 static void c_capab(struct client *, const char *parv[], int parc);
@@ -101,22 +107,44 @@ hash_command(const char *p)
 	return(hash_val % MAX_SCOMMAND_HASH);
 }
 
-static void
-handle_scommand_unknown(const char *command, const char *parv[], int parc)
+static struct scommand_handler *
+find_scommand(const char *command)
 {
 	struct scommand_handler *handler;
 	rb_dlink_node *ptr;
-	unsigned int hashv = hash_command(command);
-	
-	RB_DLINK_FOREACH(ptr, scommand_table[hashv].head)
+
+	handler = scommand_direct[command_slot(command)];
+
+	if(handler != NULL && !strcasecmp(command, handler->cmd))
+		return handler;
+
+	if(scommand_table_count == 0)
+		return NULL;
+
+	RB_DLINK_FOREACH(ptr, scommand_table[hash_command(command)].head)
 	{
 		handler = ptr->data;
 		if(!strcasecmp(command, handler->cmd))
-		{
-			if(handler->flags & FLAGS_UNKNOWN)
-				handler->func(NULL, parv, parc);
-			return;
-		}
+			return handler;
+	}
+
+	return NULL;
+}
+
+static void
+handle_scommand_unknown(const char *command, const char *parv[], int parc)
+{
+	struct scommand_handler *handler;
+	struct timespec start;
+
+	if((handler = find_scommand(command)) == NULL)
+		return;
+
+	if(handler->flags & FLAGS_UNKNOWN)
+	{
+		latency_start(&start);
+		handler->func(NULL, parv, parc);
+		latency_stop(handler->latency, &start);
 	}
 }
 
@@ -126,26 +154,23 @@ handle_scommand_client(struct client *client_p, const char *command,
 {
 	struct scommand_handler *handler;
 	scommand_func hook;
-	rb_dlink_node *ptr;
 	rb_dlink_node *hptr;
-	unsigned int hashv = hash_command(command);
-	
-	RB_DLINK_FOREACH(ptr, scommand_table[hashv].head)
-	{
-		handler = ptr->data;
-		if(!strcasecmp(command, handler->cmd))
-		{
-			handler->func(client_p, parv, parc);
+	struct timespec start;
 
-			RB_DLINK_FOREACH(hptr, handler->hooks.head)
-			{
-				hook = hptr->data;
-				(*hook)(client_p, parv, parc);
-			}
+	if((handler = find_scommand(command)) == NULL)
+		return;
 
-			break;
-		}
+	latency_start(&start);
+
+	handler->func(client_p, parv, parc);
+
+	RB_DLINK_FOREACH(hptr, handler->hooks.head)
+	{
+		hook = hptr->data;
+		(*hook)(client_p, parv, parc);
 	}
+
+	latency_stop(handler->latency, &start);
 }
 
 void
@@ -171,30 +196,34 @@ handle_scommand(const char *source, const char *command, const char *parv[], int
 void
 add_scommand_handler(struct scommand_handler *chandler)
 {
-	unsigned int hashv;
+	unsigned int slot;
 
 	if(chandler == NULL || EmptyString(chandler->cmd))
 		return;
 
-	hashv = hash_command(chandler->cmd);
-	rb_dlinkAddAlloc(chandler, &scommand_table[hashv]);
+	chandler->latency = latency_find(LATENCY_SCOMMAND, chandler->cmd);
+
+	slot = command_slot(chandler->cmd);
+
+	if(scommand_direct[slot] == NULL)
+	{
+		scommand_direct[slot] = chandler;
+		return;
+	}
+
+	rb_dlinkAddAlloc(chandler, &scommand_table[hash_command(chandler->cmd)]);
+	scommand_table_count++;
 }
 
 void
 add_scommand_hook(scommand_func hook, const char *command)
 {
 	struct scommand_handler *handler;
-	rb_dlink_node *ptr;
-	unsigned int hashv = hash_command(command);
 
-	RB_DLINK_FOREACH(ptr, scommand_table[hashv].head)
+	if((handler = find_scommand(command)) != NULL)
 	{
-		handler = ptr->data;
-		if(!strcasecmp(command, handler->cmd))
-		{
-			rb_dlinkAddAlloc(hook, &handler->hooks);
-			return;
-		}
+		rb_dlinkAddAlloc(hook, &handler->hooks);
+		return;
 	}
 
 	s_assert(0);
@@ -204,17 +233,11 @@ void
 del_scommand_hook(scommand_func hook, const char *command)
 {
 	struct scommand_handler *handler;
-	rb_dlink_node *ptr;
-	unsigned int hashv = hash_command(command);
 
-	RB_DLINK_FOREACH(ptr, scommand_table[hashv].head)
+	if((handler = find_scommand(command)) != NULL)
 	{
-		handler = ptr->data;
-		if(!strcasecmp(command, handler->cmd))
-		{
-			rb_dlinkFindDestroy(hook, &handler->hooks);
-			return;
-		}
+		rb_dlinkFindDestroy(hook, &handler->hooks);
+		return;
 	}
 
 	s_assert(0);
@@ -635,6 +658,14 @@ c_stats(struct client *client_p, const char *parv[], int parc)
 			count_memory(client_p);
 			break;
 
+		case 'L':
+			/* restrict to admins */
+			if(!client_p->user->oper || !(client_p->user->oper->flags & CONF_OPER_ADMIN))
+				break;
+
+			latency_show(client_p, NULL);
+			break;
+
 		case 'E':
 			/* restrict to admins */
 			if(!client_p->user->oper || !(client_p->user->oper->flags & CONF_OPER_ADMIN))
@@ -48,10 +48,16 @@
 #include "s_userserv.h"
 #include "watch.h"
 #include "tools.h"
+#include "latency.h"
+#include "hashtab.h"
+#include "hostindex.h"
 
 rb_dlink_list service_list;
 rb_dlink_list ignore_list;
 
+/* ignore_list indexed on host */
+static struct hostindex *ignore_index;
+
 static int ignore_db_callback(int, const char **);
 
 static void unmerge_service(struct client *service_p);
@@ -91,25 +97,92 @@ ignore_db_callback(int argc, const char **argv)
 	ignore_p->oper = rb_strdup(argv[1]);
 	ignore_p->reason = rb_strdup(argv[2]);
 
-	rb_dlinkAdd(ignore_p, &ignore_p->ptr, &ignore_list);
+	add_ignore(ignore_p);
 	return 0;
 }
 
+/* add_ignore()
+ *   compiles an ignore and adds it to the list, indexed on its host
+ */
+void
+add_ignore(struct service_ignore *ignore_p)
+{
+	char buf[BUFSIZE];
+	char *host;
+
+	if(ignore_index == NULL)
+		ignore_index = hostindex_create();
+
+	ignore_p->cmask = compile_mask(ignore_p->mask);
+
+	rb_strlcpy(buf, ignore_p->mask, sizeof(buf));
+
+	if((host = strrchr(buf, '@')) != NULL)
+		*host++ = '\0';
+
+	ignore_p->hentry = hostindex_add(ignore_index, host, ignore_p);
+
+	/* the index matches the cidr, leaving us the nick!user */
+	if(ignore_p->hentry->type == HOSTINDEX_CIDR)
+		ignore_p->umask = compile_mask(buf);
+
+	rb_dlinkAdd(ignore_p, &ignore_p->ptr, &ignore_list);
+}
+
+/* free_ignore()
+ *   removes an ignore from the list and frees it
+ */
+void
+free_ignore(struct service_ignore *ignore_p)
+{
+	hostindex_del(ignore_index, ignore_p->hentry);
+	rb_dlinkDelete(&ignore_p->ptr, &ignore_list);
+
+	free_mask(ignore_p->cmask);
+	free_mask(ignore_p->umask);
+	rb_free(ignore_p->mask);
+	rb_free(ignore_p->oper);
+	rb_free(ignore_p->reason);
+	rb_free(ignore_p);
+}
+
+struct ignore_match
+{
+	struct client *client_p;
+	struct match_name mname;
+	char nickuser[NICKLEN+USERLEN+2];
+};
+
+static int
+ignore_match(struct hostindex_entry *entry, void *arg)
+{
+	struct service_ignore *ignore_p = entry->data;
+	struct ignore_match *im = arg;
+
+	if(entry->type != HOSTINDEX_CIDR)
+		return match_mask_name(ignore_p->cmask, &im->mname);
+
+	if(im->nickuser[0] == '\0')
+		snprintf(im->nickuser, sizeof(im->nickuser), "%s!%s",
+			im->client_p->name, im->client_p->user->username);
+
+	return match_mask(ignore_p->umask, im->nickuser);
+}
+
 static int
 find_ignore(struct client *client_p)
 {
-	struct service_ignore *ignore_p;
-	rb_dlink_node *ptr;
+	struct ignore_match im;
 
-	RB_DLINK_FOREACH(ptr, ignore_list.head)
-	{
-		ignore_p = ptr->data;
+	if(!rb_dlink_list_length(&ignore_list))
+		return 0;
 
-		if(match(ignore_p->mask, client_p->user->mask))
-			return 1;
-	}
+	im.client_p = client_p;
+	im.nickuser[0] = '\0';
+	fold_name(&im.mname, client_p->user->mask);
 
-	return 0;
+	return hostindex_find(ignore_index, client_p->user->host,
+				client_p->user->ip, ignore_match, &im) != NULL;
 }
 
 typedef int (*bqcmp)(const void *, const void *);
@@ -828,6 +901,9 @@ handle_service(struct client *service_p, struct client *client_p,
 		const char *command, int parc, const char *parv[], int msg)
 {
 	struct service_command *cmd_entry;
+	struct latency_stat *latency;
+	struct timespec start;
+	char buf[BUFSIZE];
         int retval;
 
         /* this service doesnt handle commands via privmsg */
@@ -842,7 +918,8 @@ handle_service(struct client *service_p, struct client *client_p,
 		 */
 		if(find_ignore(client_p) && 
 			(strcasecmp(command, "OLOGIN") ||
-			 find_conf_oper(client_p->user->username, client_p->user->host, client_p->user->servername, NULL) == NULL))
+			 find_conf_oper(client_p->user->username, client_p->user->host, client_p->user->ip,
+					client_p->user->servername, NULL) == NULL))
 			return;
 
 		if((client_p->user->flood_time + config_file.client_flood_time) < rb_time())
@@ -926,7 +1003,8 @@ handle_service(struct client *service_p, struct client *client_p,
 		}
 
 		if((oper_p = find_conf_oper(client_p->user->username, client_p->user->host,
-						client_p->user->servername, parv[0])) == NULL)
+						client_p->user->ip, client_p->user->servername,
+						parv[0])) == NULL)
 		{
 			sendto_server(":%s NOTICE %s :No access to %s::OLOGIN",
 					MYUID, UID(client_p), ucase(service_p->name));
@@ -1027,11 +1105,23 @@ handle_service(struct client *service_p, struct client *client_p,
 
 		cmd_entry->cmd_use++;
 
+		if(cmd_entry->latency == NULL)
+		{
+			snprintf(buf, sizeof(buf), "%s::%s",
+				service_p->service->id, cmd_entry->cmd);
+			cmd_entry->latency = latency_find(LATENCY_SERVICE, buf);
+		}
+
+		latency = cmd_entry->latency;
+		latency_start(&start);
+
 		if(cmd_entry->func)
 			retval = (cmd_entry->func)(client_p, NULL, (const char **) parv, parc);
 		else
 			retval = 0;
 
+		latency_stop(latency, &start);
+
 		/* NOTE, at this point cmd_entry may now be invalid.
 		 * Particularly if we have just done a rehash help
 		 */
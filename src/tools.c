@@ -176,6 +176,29 @@ ucase(const char *text)
 	return buf;
 }
 
+/* command_slot()
+ *   works out a commands slot in a direct command table, from its
+ *   length, first two and last characters, case insensitively
+ *
+ * inputs	- command
+ * outputs	- slot, less than COMMAND_SLOTS
+ */
+unsigned int
+command_slot(const char *command)
+{
+	unsigned int len = strlen(command);
+	unsigned int h = len;
+
+	if(len == 0)
+		return 0;
+
+	h = (h * 31) ^ ((unsigned char) command[0] & 0xDF);
+	h = (h * 31) ^ ((unsigned char) command[len > 1 ? 1 : 0] & 0xDF);
+	h = (h * 31) ^ ((unsigned char) command[len-1] & 0xDF);
+
+	return h & (COMMAND_SLOTS - 1);
+}
+
 /*
  * strip_tabs(dst, src, length)
  *
@@ -37,6 +37,8 @@
 #include "ucommand.h"
 #include "io.h"
 #include "tools.h"
+#include "rsdb.h"
+#include "latency.h"
 
 static int u_stats(struct client *, struct lconn *, const char **, int);
 struct ucommand_handler stats_ucommand = { "stats", u_stats, 0, 0, 0, NULL };
@@ -44,11 +46,36 @@ struct ucommand_handler stats_ucommand = { "stats", u_stats, 0, 0, 0, NULL };
 struct _stats_table
 {
         const char *type;
-        void (*func)(struct lconn *);
+        void (*func)(struct lconn *, const char **, int);
 };
 
 static void
-stats_opers(struct lconn *conn_p)
+stats_database(struct lconn *conn_p, const char *parv[], int parc)
+{
+	struct rsdb_stats stats;
+
+	rsdb_get_stats(&stats);
+
+	if(!stats.write_behind)
+	{
+		sendto_one(conn_p, "Database write behind: disabled");
+		return;
+	}
+
+	sendto_one(conn_p, "Database write behind: queue %lu/%lu (peak %lu) "
+		   "queued %lu executed %lu",
+		   stats.queue_len, stats.queue_max, stats.queue_peak,
+		   stats.queued, stats.executed);
+	sendto_one(conn_p, "Database drain latency: avg %lums max %lums, "
+		   "full queue stalls %lu, read syncs %lu, busy retries %lu",
+		   stats.executed ? 
+			(unsigned long) (stats.latency_total / stats.executed / 1000) : 0,
+		   stats.latency_max / 1000,
+		   stats.stalls, stats.syncs, stats.busy_retries);
+}
+
+static void
+stats_opers(struct lconn *conn_p, const char *parv[], int parc)
 {
         struct conf_oper *conf_p;
         rb_dlink_node *ptr;
@@ -66,7 +93,7 @@ stats_opers(struct lconn *conn_p)
 }
 
 static void
-stats_servers(struct lconn *conn_p)
+stats_servers(struct lconn *conn_p, const char *parv[], int parc)
 {
         struct conf_server *conf_p;
         rb_dlink_node *ptr;
@@ -82,7 +109,7 @@ stats_servers(struct lconn *conn_p)
 }
 
 static void
-stats_uplink(struct lconn *conn_p)
+stats_uplink(struct lconn *conn_p, const char *parv[], int parc)
 {
         if(server_p != NULL)
                 sendto_one(conn_p, "Currently connected to %s Idle: %ld "
@@ -96,15 +123,36 @@ stats_uplink(struct lconn *conn_p)
 }
 
 static void
-stats_uptime(struct lconn *conn_p)
+stats_uptime(struct lconn *conn_p, const char *parv[], int parc)
 {
         sendto_one(conn_p, "%s up %s",
                    MYNAME,
                    get_duration(rb_time() - first_time));
 }
 
+static void
+stats_latency(struct lconn *conn_p, const char *parv[], int parc)
+{
+	if(parc > 1 && !strcasecmp(parv[1], "reset"))
+	{
+		if(!(conn_p->privs & CONF_OPER_ADMIN))
+		{
+			sendto_one(conn_p, "Insufficient access");
+			return;
+		}
+
+		latency_reset();
+		sendto_one(conn_p, "Latency stats reset");
+		return;
+	}
+
+	latency_show(NULL, conn_p);
+}
+
 static struct _stats_table stats_table[] =
 {
+        { "database",   &stats_database, },
+        { "latency",    &stats_latency, },
         { "opers",      &stats_opers,   },
         { "servers",    &stats_servers, },
         { "uplink",     &stats_uplink,  },
@@ -138,7 +186,7 @@ u_stats(struct client *unused, struct lconn *conn_p, const char *parv[], int par
         {
                 if(!strcasecmp(stats_table[i].type, parv[0]))
                 {
-                        (stats_table[i].func)(conn_p);
+                        (stats_table[i].func)(conn_p, parv, parc);
                         return 0;
                 }
         }
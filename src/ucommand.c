@@ -47,9 +47,12 @@
 #include "hook.h"
 #include "watch.h"
 #include "c_init.h"
+#include "latency.h"
 
 #define MAX_HELP_ROW 8
 
+/* as with server commands, looked up by command_slot() first */
+static struct ucommand_handler *ucommand_direct[COMMAND_SLOTS];
 static rb_dlink_list ucommand_table[MAX_UCOMMAND_HASH];
 rb_dlink_list ucommand_list;
 
@@ -106,7 +109,14 @@ find_ucommand(const char *command)
 {
         struct ucommand_handler *handler;
         rb_dlink_node *ptr;
-	unsigned int hashv = hash_command(command);
+	unsigned int hashv;
+
+	handler = ucommand_direct[command_slot(command)];
+
+	if(handler != NULL && !strcasecmp(command, handler->cmd))
+		return handler;
+
+	hashv = hash_command(command);
 
 	RB_DLINK_FOREACH(ptr, ucommand_table[hashv].head)
 	{
@@ -124,6 +134,7 @@ handle_ucommand(struct lconn *conn_p, const char *command,
 		const char *parv[], int parc)
 {
 	struct ucommand_handler *handler;
+	struct timespec start;
 
         /* people who arent logged in, can only do .login */
         if(!UserAuth(conn_p))
@@ -153,7 +164,9 @@ handle_ucommand(struct lconn *conn_p, const char *command,
 			return;
 		}
 
+		latency_start(&start);
 		handler->func(NULL, conn_p, parv, parc);
+		latency_stop(handler->latency, &start);
 	}
         else
                 sendto_one(conn_p, "Invalid command: %s", command);
@@ -163,13 +176,23 @@ void
 add_ucommand_handler(struct client *service_p, 
 			struct ucommand_handler *chandler)
 {
+	unsigned int slot;
 	unsigned int hashv;
 
 	if(chandler == NULL || EmptyString(chandler->cmd))
 		return;
 
-	hashv = hash_command(chandler->cmd);
-	rb_dlinkAddAlloc(chandler, &ucommand_table[hashv]);
+	chandler->latency = latency_find(LATENCY_UCOMMAND, chandler->cmd);
+
+	slot = command_slot(chandler->cmd);
+
+	if(ucommand_direct[slot] == NULL)
+		ucommand_direct[slot] = chandler;
+	else
+	{
+		hashv = hash_command(chandler->cmd);
+		rb_dlinkAddAlloc(chandler, &ucommand_table[hashv]);
+	}
 
 	/* command not associated with any service */
         if(service_p == NULL)
@@ -453,6 +476,13 @@ u_status(struct client *unused, struct lconn *conn_p, const char *parv[], int pa
         else
                 sendto_one(conn_p, "Currently disconnected");
 
+	sendto_one(conn_p, "Server output: %lu lines in %lu writes "
+			"(%lu saved), %lu bytes/write",
+			server_write_lines, server_write_calls,
+			server_write_lines > server_write_calls ?
+			 server_write_lines - server_write_calls : 0,
+			server_write_calls ? server_write_bytes / server_write_calls : 0);
+
 	sendto_one(conn_p, "Services: %lu",
 			rb_dlink_list_length(&service_list));
 	sendto_one(conn_p, "Clients: DCC: %lu IRC: %lu",
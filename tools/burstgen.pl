@@ -0,0 +1,764 @@
+#!/usr/bin/perl -w
+#
+# burstgen.pl
+# Stands in for a TS6 ircd-ratbox uplink on a local socket.  Waits for
+# services to connect, does the PASS/CAPAB/SERVER handshake, bursts a
+# synthetic network of servers, users and channels, then keeps up a
+# steady churn of joins, parts, nick changes, quits and netsplits.
+#
+# Point a connect {} block in the services config at the address and
+# port given here, with the same name and password, and autoconn.  If
+# the services pid is given, their cpu usage is reported as it goes.
+#
+# Copyright (C) 2003-2012 ircd-ratbox development team
+#
+# $Id$
+
+use strict;
+
+use Getopt::Long;
+use IO::Socket::INET;
+use IO::Select;
+use POSIX qw(sysconf _SC_CLK_TCK);
+use Time::HiRes qw(time);
+
+my %opt = (
+	bind		=> "127.0.0.1",
+	port		=> 6667,
+	name		=> "hub.burstgen",
+	sid		=> "0BG",
+	password	=> "password",
+	servers		=> 10,
+	users		=> 10000,
+	channels	=> 2000,
+	dist		=> "zipf",
+	members		=> 10,
+	maxmembers	=> 2000,
+	bans		=> 2,
+	churn		=> 100,
+	mix		=> "join=40,part=20,nick=25,quit=15",
+	splitevery	=> 0,
+	splittime	=> 10,
+	duration	=> 60,
+	report		=> 10,
+	pid		=> 0,
+);
+
+sub usage
+{
+	print <<EOF;
+Usage: ./burstgen.pl [options]
+
+ --bind <addr>        address to listen on [$opt{bind}]
+ --port <port>        port to listen on [$opt{port}]
+ --name <name>        our server name [$opt{name}]
+ --sid <sid>          our SID [$opt{sid}]
+ --password <pass>    link password [$opt{password}]
+ --servers <n>        leaf servers to burst [$opt{servers}]
+ --users <n>          users to burst [$opt{users}]
+ --channels <n>       channels to burst [$opt{channels}]
+ --dist <zipf|uniform> channel size distribution [$opt{dist}]
+ --members <n>        average channel size, uniform [$opt{members}]
+ --maxmembers <n>     largest channel size, zipf [$opt{maxmembers}]
+ --bans <n>           bans per channel [$opt{bans}]
+ --churn <n>          churn operations per second after the burst [$opt{churn}]
+ --mix <spec>         relative weights of churn operations [$opt{mix}]
+ --splitevery <secs>  split a leaf server this often, 0 for never [$opt{splitevery}]
+ --splittime <secs>   how long a split server stays away [$opt{splittime}]
+ --duration <secs>    how long to churn for after the burst [$opt{duration}]
+ --report <secs>      how often to report [$opt{report}]
+ --pid <pid>          services pid, to report cpu usage
+ --seed <n>           random seed, for repeatable runs
+EOF
+	exit;
+}
+
+GetOptions(\%opt, "bind=s", "port=i", "name=s", "sid=s", "password=s",
+		"servers=i", "users=i", "channels=i", "dist=s", "members=i",
+		"maxmembers=i", "bans=i", "churn=f", "mix=s", "splitevery=i",
+		"splittime=i", "duration=i", "report=i", "pid=i", "seed=i",
+		"help") or usage();
+
+usage() if($opt{help});
+srand($opt{seed}) if(defined($opt{seed}));
+
+my @idchars = ('A'..'Z', '0'..'9');
+
+# leaf servers, [0] is us
+my (@sname, @ssid, @ssplit);
+
+# users, by index
+my (@uid, @unick, @userver, @uchans, @ulive);
+my %byuid;
+my $livecount = 0;
+
+# channels, by index, members are user index => prefix
+my (@cname, @cts, @cmembers);
+
+my @mixtable;
+
+my $conn;
+my $select;
+my $inbuf = "";
+my $outbuf = "";
+my $flushing = 0;
+
+my $services_sid = "";
+my $services_name = "";
+my %pending_pong;
+my %bursting;
+my %seen;
+
+my $nickcount = 0;
+my $eob_start = 0;
+my $eob_time = 0;
+
+my $clk_tck = sysconf(_SC_CLK_TCK) || 100;
+
+# id_string()
+#   turns a number into an id of the given length, the first character
+#   must be a letter
+sub id_string
+{
+	my ($num, $len) = @_;
+	my $id = "";
+
+	for(my $i = 1; $i < $len; $i++)
+	{
+		$id = $idchars[$num % 36] . $id;
+		$num = int($num / 36);
+	}
+
+	return $idchars[$num % 26] . $id;
+}
+
+sub out
+{
+	$outbuf .= $_[0] . "\r\n";
+	flush_out() if(!$flushing && length($outbuf) >= 65536);
+}
+
+# flush_out()
+#   writes everything queued, reading whilst it waits so services
+#   never block writing to us
+sub flush_out
+{
+	$flushing = 1;
+
+	while(length($outbuf))
+	{
+		read_input(0);
+
+		my $len = syswrite($conn, $outbuf, length($outbuf));
+
+		die("Write error: $!\n") unless(defined($len));
+		substr($outbuf, 0, $len, "");
+	}
+
+	$flushing = 0;
+}
+
+sub read_input
+{
+	my ($timeout) = @_;
+	my $buf;
+
+	return unless($select->can_read($timeout));
+
+	my $len = sysread($conn, $buf, 65536);
+
+	if(!$len)
+	{
+		print "Services closed the connection\n";
+		report_final();
+		exit;
+	}
+
+	$inbuf .= $buf;
+
+	while($inbuf =~ s/^([^\n]*)\n//)
+	{
+		handle_line($1);
+	}
+}
+
+sub server_by_name
+{
+	my ($name) = @_;
+
+	for(my $i = 0; $i <= $#sname; $i++)
+	{
+		return $i if(lc($sname[$i]) eq lc($name));
+	}
+
+	return -1;
+}
+
+# handle_line()
+#   deals with a line from services, replying to pings and keeping our
+#   idea of the network in step with their kills and kicks
+sub handle_line
+{
+	my ($line) = @_;
+	my $source = "";
+	my $trail;
+
+	$line =~ s/\r$//;
+
+	$source = $1 if($line =~ s/^:(\S+)\s+//);
+	$trail = $1 if($line =~ s/(?:^|\s):(.*)$//);
+
+	my @parv = split(/\s+/, $line);
+	push(@parv, $trail) if(defined($trail));
+
+	my $command = uc(shift(@parv) || "");
+
+	$seen{$command}++;
+
+	if($command eq "PASS")
+	{
+		die("Link password mismatch\n") if($parv[0] ne $opt{password});
+		$services_sid = $parv[3] || "";
+	}
+	elsif($command eq "SERVER")
+	{
+		$services_name = $parv[0];
+	}
+	elsif($command eq "PING")
+	{
+		# PING :<origin>
+		if(@parv < 2)
+		{
+			out(":$opt{sid} PONG $opt{name} :$parv[0]");
+			return;
+		}
+
+		# PING <server> <sid>, the server answers once its burst is done
+		my $server = server_by_name($parv[0]);
+		return if($server < 0);
+
+		if($bursting{$server})
+		{
+			$pending_pong{$server} = $source;
+			return;
+		}
+
+		out(":$ssid[$server] PONG $sname[$server] :$source");
+	}
+	elsif($command eq "PONG")
+	{
+		if($eob_start && !$eob_time && $parv[$#parv] eq $opt{sid})
+		{
+			$eob_time = time();
+			printf("Burst processed in %.3f seconds\n", $eob_time - $eob_start);
+		}
+	}
+	elsif($command eq "KILL")
+	{
+		my $target = $byuid{$parv[0]};
+		remove_user($target) if(defined($target));
+	}
+	elsif($command eq "KICK")
+	{
+		my $target = $byuid{$parv[1]};
+		my $chan = channel_by_name($parv[0]);
+
+		if(defined($target) && defined($chan))
+		{
+			delete($cmembers[$chan]{$target});
+			delete($uchans[$target]{$chan});
+		}
+	}
+}
+
+my %chanindex;
+
+sub channel_by_name
+{
+	return $chanindex{lc($_[0])};
+}
+
+sub new_user
+{
+	my ($server) = @_;
+	my $i = scalar(@uid);
+	my $uid = $ssid[$server] . id_string($i, 6);
+
+	$uid[$i] = $uid;
+	$unick[$i] = "bg" . id_string($nickcount++, 6);
+	$userver[$i] = $server;
+	$uchans[$i] = {};
+	$ulive[$i] = 1;
+	$byuid{$uid} = $i;
+	$livecount++;
+
+	return $i;
+}
+
+sub send_user
+{
+	my ($i) = @_;
+	my $n = $i % 250 + 1;
+
+	out(":$ssid[$userver[$i]] UID $unick[$i] 1 " . int(time()) .
+		" +i bg$i host$n.burstgen.example 10.0." . int($i / 250 % 250) .
+		".$n $uid[$i] :burstgen user");
+}
+
+sub remove_user
+{
+	my ($i) = @_;
+
+	foreach my $chan (keys %{$uchans[$i]})
+	{
+		delete($cmembers[$chan]{$i});
+	}
+
+	$uchans[$i] = {};
+	delete($byuid{$uid[$i]});
+	$ulive[$i] = 0;
+	$livecount--;
+}
+
+# send_sjoin()
+#   sends the given members of a channel, split over as many lines as
+#   it takes
+sub send_sjoin
+{
+	my ($chan, $server, @members) = @_;
+	my $prefix = ":$ssid[$server] SJOIN $cts[$chan] $cname[$chan] +nt :";
+	my $line = "";
+
+	foreach my $i (@members)
+	{
+		my $entry = $cmembers[$chan]{$i} . $uid[$i];
+
+		if(length($prefix) + length($line) + length($entry) + 1 > 500)
+		{
+			out($prefix . $line);
+			$line = "";
+		}
+
+		$line .= ($line eq "" ? "" : " ") . $entry;
+	}
+
+	out($prefix . $line) if($line ne "");
+}
+
+sub channel_size
+{
+	my ($chan) = @_;
+	my $size;
+
+	if($opt{dist} eq "uniform")
+	{
+		$size = 1 + int(rand(2 * $opt{members} - 1));
+	}
+	else
+	{
+		$size = int($opt{maxmembers} / ($chan + 1));
+		$size = 1 if($size < 1);
+	}
+
+	return ($size > $opt{users}) ? $opt{users} : $size;
+}
+
+sub burst
+{
+	my $ts = int(time()) - 86400;
+
+	$sname[0] = $opt{name};
+	$ssid[0] = $opt{sid};
+	$ssplit[0] = 0;
+
+	for(my $i = 1; $i <= $opt{servers}; $i++)
+	{
+		my $sid;
+
+		die("Too many servers\n") if($i > 9000);
+
+		# skip anything that clashes with us or services
+		do
+		{
+			$sid = ($i % 10) . id_string(int(rand(936)), 2);
+		}
+		while($sid eq $opt{sid} || $sid eq $services_sid || grep { $_ eq $sid } @ssid);
+
+		$sname[$i] = "leaf$i.burstgen";
+		$ssid[$i] = $sid;
+		$ssplit[$i] = 0;
+	}
+
+	printf("Bursting %d servers, %d users, %d channels\n",
+		$opt{servers}, $opt{users}, $opt{channels});
+
+	$eob_start = time();
+	$bursting{0} = 1;
+
+	out("PASS $opt{password} TS 6 :$opt{sid}");
+	out("CAPAB :QS EX IE KLN UNKLN ENCAP TB SERVICES");
+	out("SERVER $opt{name} 1 :burstgen uplink");
+	out("SVINFO 6 6 0 :" . int(time()));
+
+	for(my $i = 1; $i <= $opt{servers}; $i++)
+	{
+		out(":$opt{sid} SID $sname[$i] 2 $ssid[$i] :burstgen leaf");
+		$bursting{$i} = 1;
+	}
+
+	for(my $i = 0; $i < $opt{users}; $i++)
+	{
+		send_user(new_user($i % ($opt{servers} + 1)));
+	}
+
+	for(my $chan = 0; $chan < $opt{channels}; $chan++)
+	{
+		my $size = channel_size($chan);
+		my %members;
+
+		$cname[$chan] = "#bg" . id_string($chan, 5);
+		$cts[$chan] = $ts;
+		$cmembers[$chan] = {};
+		$chanindex{lc($cname[$chan])} = $chan;
+
+		while(scalar(keys %members) < $size)
+		{
+			$members{int(rand($opt{users}))} = 1;
+		}
+
+		my $first = 1;
+
+		foreach my $i (keys %members)
+		{
+			# the first member and one in ten after are opped
+			$cmembers[$chan]{$i} = ($first || rand(10) < 1) ? "@" :
+						(rand(10) < 1) ? "+" : "";
+			$uchans[$i]{$chan} = 1;
+			$first = 0;
+		}
+
+		send_sjoin($chan, 0, keys %members);
+
+		if($opt{bans} > 0)
+		{
+			out(":$opt{sid} BMASK $ts $cname[$chan] b :" .
+				join(" ", map { "*!*\@ban$_.$chan.burstgen.example" } (1 .. $opt{bans})));
+		}
+	}
+
+	finish_burst(0 .. $opt{servers});
+
+	# services answer this once they've got through everything before it
+	out(":$opt{sid} PING $opt{name} :$services_sid");
+	flush_out();
+
+	printf("Burst sent in %.3f seconds\n", time() - $eob_start);
+}
+
+sub finish_burst
+{
+	foreach my $server (@_)
+	{
+		delete($bursting{$server});
+
+		if(defined($pending_pong{$server}))
+		{
+			out(":$ssid[$server] PONG $sname[$server] :$pending_pong{$server}");
+			delete($pending_pong{$server});
+		}
+	}
+}
+
+sub random_live_user
+{
+	return undef unless($livecount);
+
+	for(my $tries = 0; $tries < 100; $tries++)
+	{
+		my $i = int(rand(scalar(@uid)));
+
+		return $i if($ulive[$i] && !$ssplit[$userver[$i]]);
+	}
+
+	return undef;
+}
+
+sub churn_join
+{
+	my $i = random_live_user();
+	my $chan = int(rand($opt{channels}));
+
+	return unless(defined($i) && !$uchans[$i]{$chan});
+
+	# an empty channel is created afresh, with them opped.  Members on
+	# split servers don't count, the channel went with them.
+	if(!grep { !$ssplit[$userver[$_]] } keys %{$cmembers[$chan]})
+	{
+		$cts[$chan] = int(time());
+		$cmembers[$chan]{$i} = "@";
+		$uchans[$i]{$chan} = 1;
+		send_sjoin($chan, $userver[$i], $i);
+		return;
+	}
+
+	$cmembers[$chan]{$i} = "";
+	$uchans[$i]{$chan} = 1;
+	out(":$uid[$i] JOIN $cts[$chan] $cname[$chan] +");
+}
+
+sub churn_part
+{
+	my $i = random_live_user();
+
+	return unless(defined($i));
+
+	my @chans = keys %{$uchans[$i]};
+
+	return unless(@chans);
+
+	my $chan = $chans[int(rand(scalar(@chans)))];
+
+	delete($cmembers[$chan]{$i});
+	delete($uchans[$i]{$chan});
+	out(":$uid[$i] PART $cname[$chan]");
+}
+
+sub churn_nick
+{
+	my $i = random_live_user();
+
+	return unless(defined($i));
+
+	$unick[$i] = "bg" . id_string($nickcount++, 6);
+	out(":$uid[$i] NICK $unick[$i] :" . int(time()));
+}
+
+# churn_quit()
+#   quits a user and connects a new one in their place, so the network
+#   stays the same size
+sub churn_quit
+{
+	my $i = random_live_user();
+
+	return unless(defined($i));
+
+	out(":$uid[$i] QUIT :burstgen churn");
+	remove_user($i);
+
+	my $new = new_user($userver[$i]);
+	send_user($new);
+}
+
+sub split_server
+{
+	my @candidates = grep { !$ssplit[$_] } (1 .. $opt{servers});
+
+	return unless(@candidates);
+
+	my $server = $candidates[int(rand(scalar(@candidates)))];
+	my $count = 0;
+
+	$ssplit[$server] = time();
+	out(":$opt{sid} SQUIT $ssid[$server] :burstgen split");
+
+	for(my $i = 0; $i <= $#uid; $i++)
+	{
+		$count++ if($ulive[$i] && $userver[$i] == $server);
+	}
+
+	printf("Split %s (%d users)\n", $sname[$server], $count);
+}
+
+# rejoin_server()
+#   bursts a split server back, with its users in the channels they
+#   were in before
+sub rejoin_server
+{
+	my ($server) = @_;
+	my %bychan;
+	my $count = 0;
+
+	$ssplit[$server] = 0;
+	$bursting{$server} = 1;
+
+	out(":$opt{sid} SID $sname[$server] 2 $ssid[$server] :burstgen leaf");
+
+	for(my $i = 0; $i <= $#uid; $i++)
+	{
+		next unless($ulive[$i] && $userver[$i] == $server);
+
+		send_user($i);
+		$count++;
+
+		foreach my $chan (keys %{$uchans[$i]})
+		{
+			push(@{$bychan{$chan}}, $i);
+		}
+	}
+
+	foreach my $chan (keys %bychan)
+	{
+		send_sjoin($chan, $server, @{$bychan{$chan}});
+	}
+
+	finish_burst($server);
+
+	printf("Rejoined %s (%d users)\n", $sname[$server], $count);
+}
+
+sub services_cpu
+{
+	return undef unless($opt{pid});
+
+	open(my $fh, "<", "/proc/$opt{pid}/stat") or return undef;
+	my $stat = <$fh>;
+	close($fh);
+
+	# skip past the command name, it may contain spaces
+	$stat =~ s/^.*\)\s+//;
+	my @fields = split(/\s+/, $stat);
+
+	return ($fields[11] + $fields[12]) / $clk_tck;
+}
+
+my $churn_start;
+my $churn_ops = 0;
+my $cpu_start;
+
+sub report_final
+{
+	return unless($churn_start);
+
+	my $elapsed = time() - $churn_start;
+	my $cpu = services_cpu();
+
+	printf("Churned %d operations in %.1f seconds (%.1f/sec)\n",
+		$churn_ops, $elapsed, $elapsed > 0 ? $churn_ops / $elapsed : 0);
+
+	if(defined($cpu) && defined($cpu_start) && $elapsed > 0)
+	{
+		printf("Steady state services cpu %.1f%%\n",
+			100 * ($cpu - $cpu_start) / $elapsed);
+	}
+
+	print "Lines from services:";
+	foreach my $command (sort { $seen{$b} <=> $seen{$a} } keys %seen)
+	{
+		print " $command=$seen{$command}";
+	}
+	print "\n";
+}
+
+foreach my $entry (split(/,/, $opt{mix}))
+{
+	my ($op, $weight) = split(/=/, $entry);
+
+	die("Unknown churn operation $op\n")
+		unless($op =~ /^(join|part|nick|quit)$/);
+
+	push(@mixtable, $op) for(1 .. $weight);
+}
+
+my %churnfunc = (
+	join	=> \&churn_join,
+	part	=> \&churn_part,
+	nick	=> \&churn_nick,
+	quit	=> \&churn_quit,
+);
+
+my $listen = IO::Socket::INET->new(LocalAddr => $opt{bind},
+				LocalPort => $opt{port},
+				Proto => "tcp",
+				Listen => 1,
+				ReuseAddr => 1)
+	or die("Unable to listen on $opt{bind}/$opt{port}: $!\n");
+
+print "Waiting for services on $opt{bind}/$opt{port}\n";
+
+$conn = $listen->accept() or die("accept() failed: $!\n");
+close($listen);
+
+$select = IO::Select->new($conn);
+
+# wait for their side of the handshake
+while($services_name eq "")
+{
+	read_input(undef);
+}
+
+print "Services $services_name ($services_sid) connected\n";
+
+burst();
+
+# wait for them to get through it
+while(!$eob_time)
+{
+	read_input(undef);
+	flush_out();
+}
+
+my $tick = 0.1;
+my $owed = 0;
+my $last_report;
+my $last_split;
+my $report_ops = 0;
+my $report_cpu;
+
+$churn_start = $last_report = $last_split = time();
+$cpu_start = $report_cpu = services_cpu();
+
+while(time() - $churn_start < $opt{duration})
+{
+	my $now = time();
+
+	read_input($tick);
+
+	$owed += $opt{churn} * (time() - $now);
+
+	while($owed >= 1 && @mixtable)
+	{
+		$churnfunc{$mixtable[int(rand(scalar(@mixtable)))]}->();
+		$churn_ops++;
+		$report_ops++;
+		$owed--;
+	}
+
+	$now = time();
+
+	if($opt{splitevery} && $now - $last_split >= $opt{splitevery})
+	{
+		split_server();
+		$last_split = $now;
+	}
+
+	for(my $server = 1; $server <= $opt{servers}; $server++)
+	{
+		rejoin_server($server)
+			if($ssplit[$server] && $now - $ssplit[$server] >= $opt{splittime});
+	}
+
+	flush_out();
+
+	if($now - $last_report >= $opt{report})
+	{
+		my $cpu = services_cpu();
+
+		printf("[%5.0fs] %d ops (%.1f/sec), %d users",
+			$now - $churn_start, $report_ops,
+			$report_ops / ($now - $last_report), $livecount);
+
+		if(defined($cpu))
+		{
+			printf(", services cpu %.1f%%",
+				100 * ($cpu - $report_cpu) / ($now - $last_report));
+			$report_cpu = $cpu;
+		}
+
+		print "\n";
+
+		$last_report = $now;
+		$report_ops = 0;
+	}
+}
+
+report_final();
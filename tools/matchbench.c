@@ -0,0 +1,278 @@
+/* tools/matchbench.c
+ *   Checks compile_mask()/match_mask() give the same answers as match(),
+ *   and times them against each other.
+ *
+ * Copyright (C) 2003-2012 ircd-ratbox development team
+ *
+ * Build it from here once services itself has been built:
+ *   cc -I../include -I../libratbox/include -o matchbench matchbench.c \
+ *	../src/match.o -L../libratbox/src/.libs -lratbox
+ *
+ * Usage: matchbench [-m masks] [-n names] [-r rounds] [-s seed]
+ *
+ * The masks are built from the names in each of the shapes compile_mask()
+ * handles, with ?'s and mismatches thrown in, so a good share match.  Any
+ * mask and name that match() and match_mask() disagree on are printed,
+ * and the exit status is 1.
+ *
+ * $Id$
+ */
+#include "stdinc.h"
+#include "rserv.h"
+#include "tools.h"
+
+#include <sys/time.h>
+
+static unsigned long rand_state = 1;
+
+static unsigned long
+rand_next(void)
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 7;
+	rand_state ^= rand_state << 17;
+	return rand_state;
+}
+
+static void
+rand_word(char *buf, int minlen, int maxlen)
+{
+	static const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-";
+	int len = minlen + rand_next() % (maxlen - minlen + 1);
+	int i;
+
+	for(i = 0; i < len; i++)
+		buf[i] = chars[rand_next() % (sizeof(chars) - 1)];
+
+	buf[len] = '\0';
+}
+
+static char *
+make_name(void)
+{
+	char nick[16], user[12], host[64], label[16];
+	char buf[BUFSIZE];
+	int i, labels;
+
+	rand_word(nick, 3, 9);
+	rand_word(user, 1, 10);
+
+	if(rand_next() % 4 == 0)
+		snprintf(host, sizeof(host), "%lu.%lu.%lu.%lu",
+			rand_next() % 256, rand_next() % 256,
+			rand_next() % 256, rand_next() % 256);
+	else
+	{
+		host[0] = '\0';
+		labels = 2 + rand_next() % 3;
+
+		for(i = 0; i < labels; i++)
+		{
+			rand_word(label, 2, 8);
+			rb_strlcat(host, label, sizeof(host));
+			rb_strlcat(host, i == labels - 1 ? "" : ".", sizeof(host));
+		}
+	}
+
+	snprintf(buf, sizeof(buf), "%s!%s@%s", nick, user, host);
+	return rb_strdup(buf);
+}
+
+/* make_mask()
+ *   turns a name into a mask of some shape, which may or may not still
+ *   match it
+ */
+static char *
+make_mask(const char *name)
+{
+	char buf[BUFSIZE];
+	char *at;
+	size_t len;
+	int i;
+
+	rb_strlcpy(buf, name, sizeof(buf));
+	len = strlen(buf);
+	at = strchr(buf, '@');
+
+	switch(rand_next() % 7)
+	{
+	case 0:		/* exact */
+		break;
+	case 1:		/* *@host */
+		memmove(buf + 2, at + 1, strlen(at + 1) + 1);
+		buf[0] = '*';
+		buf[1] = '@';
+		break;
+	case 2:		/* nick!* */
+		rb_strlcpy(strchr(buf, '!') + 1, "*", 2);
+		break;
+	case 3:		/* *!*@*.domain */
+		if((at = strchr(at, '.')) != NULL)
+		{
+			snprintf(buf, sizeof(buf), "*!*@*%s", at);
+			break;
+		}
+		/* fall through */
+	case 4:		/* *infix* */
+		snprintf(buf, sizeof(buf), "*%.*s*", 4, name + rand_next() % (len - 4));
+		break;
+	case 5:		/* *!user@* */
+		snprintf(buf, sizeof(buf), "*!%.*s@*",
+			(int) (strchr(name, '@') - strchr(name, '!') - 1),
+			strchr(name, '!') + 1);
+		break;
+	default:	/* general, with the stars in the middle */
+		snprintf(buf, sizeof(buf), "%.*s*%s", 2, name, strchr(name, '@'));
+		break;
+	}
+
+	/* some ?'s, case changes and mismatches */
+	for(i = 0; buf[i]; i++)
+	{
+		if(buf[i] == '*' || buf[i] == '!' || buf[i] == '@')
+			continue;
+
+		switch(rand_next() % 40)
+		{
+		case 0:
+			buf[i] = '?';
+			break;
+		case 1:
+			buf[i] = ToUpper(buf[i]);
+			break;
+		case 2:
+			buf[i] = 'X';
+			break;
+		}
+	}
+
+	return rb_strdup(buf);
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct match_mask **cmasks;
+	struct match_name *mnames;
+	char **masks;
+	char **names;
+	unsigned long hits = 0, hits_mask = 0, hits_name = 0;
+	unsigned long bad = 0;
+	unsigned long count;
+	int nmasks = 200;
+	int nnames = 5000;
+	int rounds = 5;
+	int i, j, r, c;
+	double start, t_match, t_mask, t_name;
+
+	while((c = getopt(argc, argv, "m:n:r:s:")) != -1)
+	{
+		switch(c)
+		{
+		case 'm':
+			nmasks = atoi(optarg);
+			break;
+		case 'n':
+			nnames = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 's':
+			rand_state = strtoul(optarg, NULL, 10) | 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-m masks] [-n names] [-r rounds] [-s seed]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+
+	if(nmasks < 1 || nnames < 1 || rounds < 1)
+		return 2;
+
+	names = malloc(sizeof(char *) * nnames);
+	mnames = malloc(sizeof(struct match_name) * nnames);
+	masks = malloc(sizeof(char *) * nmasks);
+	cmasks = malloc(sizeof(struct match_mask *) * nmasks);
+
+	for(i = 0; i < nnames; i++)
+		names[i] = make_name();
+
+	for(i = 0; i < nmasks; i++)
+	{
+		masks[i] = make_mask(names[rand_next() % nnames]);
+		cmasks[i] = compile_mask(masks[i]);
+	}
+
+	/* equivalence, over every pair */
+	for(i = 0; i < nmasks; i++)
+	{
+		for(j = 0; j < nnames; j++)
+		{
+			int m = match(masks[i], names[j]);
+
+			if(m != match_mask(cmasks[i], names[j]))
+			{
+				if(bad++ < 10)
+					printf("mismatch: match(%s, %s) = %d\n",
+						masks[i], names[j], m);
+			}
+		}
+	}
+
+	count = (unsigned long) nmasks * nnames * rounds;
+
+	start = now();
+	for(r = 0; r < rounds; r++)
+		for(j = 0; j < nnames; j++)
+			for(i = 0; i < nmasks; i++)
+				hits += match(masks[i], names[j]);
+	t_match = now() - start;
+
+	/* as find_ignore() did, folding the name once per lookup */
+	start = now();
+	for(r = 0; r < rounds; r++)
+		for(j = 0; j < nnames; j++)
+		{
+			fold_name(&mnames[j], names[j]);
+
+			for(i = 0; i < nmasks; i++)
+				hits_name += match_mask_name(cmasks[i], &mnames[j]);
+		}
+	t_name = now() - start;
+
+	/* folding the name every time */
+	start = now();
+	for(r = 0; r < rounds; r++)
+		for(j = 0; j < nnames; j++)
+			for(i = 0; i < nmasks; i++)
+				hits_mask += match_mask(cmasks[i], names[j]);
+	t_mask = now() - start;
+
+	printf("%d masks x %d names x %d rounds, %lu matched each\n",
+		nmasks, nnames, rounds, hits / rounds);
+	printf("  match()           %8.1f ns/match\n", t_match * 1e9 / count);
+	printf("  match_mask()      %8.1f ns/match  (%.2fx)\n",
+		t_mask * 1e9 / count, t_match / t_mask);
+	printf("  match_mask_name() %8.1f ns/match  (%.2fx)\n",
+		t_name * 1e9 / count, t_match / t_name);
+
+	if(hits != hits_mask || hits != hits_name || bad)
+	{
+		printf("%lu mismatches\n", bad);
+		return 1;
+	}
+
+	printf("no mismatches\n");
+	return 0;
+}
@@ -0,0 +1,379 @@
+/* tools/regexpbench.c
+ *   Times banserv's regexp check of new clients with the literal
+ *   prefilter, against running every regexp, for 10, 100 and 1000
+ *   regexps.
+ *
+ * Copyright (C) 2003-2012 ircd-ratbox development team
+ *
+ * Build it from here once services itself has been built:
+ *   cc -I../include -I../libratbox/include -o regexpbench regexpbench.c \
+ *	../src/acmatch.o ../src/match.o -L../libratbox/src/.libs -lratbox -lpcre
+ *
+ * (with -DPCRE_BUILD -I../pcre and ../pcre/.libs/libpcre.a instead of
+ * -lpcre if services was built with the bundled pcre)
+ *
+ * Usage: regexpbench [-c clients] [-h hitrate] [-r rounds] [-s seed]
+ *
+ * The regexps are in the shapes regexp bans usually take, a tenth of them
+ * without a literal the prefilter can use.  hitrate is the percentage of
+ * clients built to match one of them.  Both ways of checking must find
+ * the same first matching regexp for every client, or the exit status
+ * is 1.
+ *
+ * $Id$
+ */
+#include "stdinc.h"
+
+#ifdef PCRE_BUILD
+#include "pcre.h"
+#else
+#include <pcre.h>
+#endif
+
+#include "rserv.h"
+#include "tools.h"
+#include "acmatch.h"
+
+#include <sys/time.h>
+
+/* as REGEXP_LITERAL_MIN in s_banserv.h */
+#define LITERAL_MIN	3
+
+struct bench_regexp
+{
+	char word[16];
+	int shape;
+	char *literal;
+	pcre *regexp;
+	pcre_extra *extra;
+};
+
+static unsigned long rand_state = 1;
+
+static unsigned long
+rand_next(void)
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 7;
+	rand_state ^= rand_state << 17;
+	return rand_state;
+}
+
+static void
+rand_word(char *buf, const char *chars, int minlen, int maxlen)
+{
+	int len = minlen + rand_next() % (maxlen - minlen + 1);
+	int nchars = strlen(chars);
+	int i;
+
+	for(i = 0; i < len; i++)
+		buf[i] = chars[rand_next() % nchars];
+
+	buf[len] = '\0';
+}
+
+#define LOWER	"abcdefghijklmnopqrstuvwxyz"
+#define ALNUM	"abcdefghijklmnopqrstuvwxyz0123456789"
+
+/* make_regexp()
+ *   builds a regexp of one of the usual shapes around a random word
+ */
+static void
+make_regexp(struct bench_regexp *rp)
+{
+	char buf[BUFSIZE];
+	const char *re_error;
+	int re_erroff;
+
+	rand_word(rp->word, LOWER, 5, 8);
+	rp->shape = rand_next() % 10;
+
+	switch(rp->shape)
+	{
+	case 0:		/* no literal */
+		snprintf(buf, sizeof(buf), "^[a-z]{3}[0-9]{5,}![^@]+@[^#]+#[0-9]+$");
+		break;
+	case 1:
+	case 2:		/* nick */
+		snprintf(buf, sizeof(buf), "^%s[0-9]{2,4}!", rp->word);
+		break;
+	case 3:
+	case 4:		/* user */
+		snprintf(buf, sizeof(buf), "^[^!]+!~?%s[0-9]*@", rp->word);
+		break;
+	case 5:
+	case 6:
+	case 7:		/* host */
+		snprintf(buf, sizeof(buf), "@([^.#]+\\.)*%s\\.(com|net|org)#", rp->word);
+		break;
+	default:	/* gecos */
+		snprintf(buf, sizeof(buf), "#.*\\b%s\\b.*$", rp->word);
+		break;
+	}
+
+	rp->literal = regexp_literal(buf, LITERAL_MIN);
+
+	if((rp->regexp = pcre_compile(buf, PCRE_CASELESS, &re_error, &re_erroff, NULL)) == NULL)
+	{
+		fprintf(stderr, "cannot compile %s: %s\n", buf, re_error);
+		exit(2);
+	}
+
+	rp->extra = pcre_study(rp->regexp, 0, &re_error);
+}
+
+/* make_client()
+ *   builds a client's nick!user@host#gecos, made to match rp if its
+ *   given
+ */
+static char *
+make_client(struct bench_regexp *rp)
+{
+	char nick[32], user[32], host[64], gecos[64];
+	char label[16], tld[4];
+	char buf[BUFSIZE];
+
+	rand_word(nick, ALNUM, 3, 9);
+	nick[0] = 'a' + rand_next() % 26;
+	rand_word(user, ALNUM, 1, 10);
+	rand_word(label, LOWER, 2, 8);
+	rand_word(tld, LOWER, 2, 3);
+	snprintf(host, sizeof(host), "%s.%s", label, tld);
+	rand_word(gecos, LOWER " ", 5, 30);
+
+	if(rp != NULL)
+	{
+		switch(rp->shape)
+		{
+		case 0:
+			snprintf(nick, sizeof(nick), "abc%lu", 10000 + rand_next() % 90000);
+			snprintf(gecos, sizeof(gecos), "%lu", rand_next() % 100000);
+			break;
+		case 1:
+		case 2:
+			snprintf(nick, sizeof(nick), "%s%lu", rp->word, 10 + rand_next() % 9990);
+			break;
+		case 3:
+		case 4:
+			snprintf(user, sizeof(user), "~%s", rp->word);
+			break;
+		case 5:
+		case 6:
+		case 7:
+			snprintf(host, sizeof(host), "%s.%s.net", label, rp->word);
+			break;
+		default:
+			snprintf(gecos, sizeof(gecos), "get %s now", rp->word);
+			break;
+		}
+	}
+
+	snprintf(buf, sizeof(buf), "%s!%s@%s#%s", nick, user, host, gecos);
+	return strdup(buf);
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* check_all()
+ *   runs every regexp against a client, as banserv did
+ *
+ * outputs	- the first that matched, or -1
+ */
+static int
+check_all(struct bench_regexp *regexps, int count, const char *buf, int buflen)
+{
+	int i;
+
+	for(i = 0; i < count; i++)
+	{
+		if(pcre_exec(regexps[i].regexp, regexps[i].extra, buf, buflen, 0, 0, NULL, 0) >= 0)
+			return i;
+	}
+
+	return -1;
+}
+
+/* check_prefilter()
+ *   runs the regexps whose literal the client contains, and those
+ *   without one, as h_banserv_new_client() does
+ */
+static int
+check_prefilter(struct bench_regexp *regexps, int count, struct acmatch *ac,
+		unsigned int *marks, unsigned int *mark,
+		const char *buf, int buflen)
+{
+	int i;
+
+	if(++(*mark) == 0)
+	{
+		memset(marks, 0, sizeof(unsigned int) * count);
+		*mark = 1;
+	}
+
+	acmatch_scan(ac, buf, buflen, marks, *mark);
+
+	for(i = 0; i < count; i++)
+	{
+		if(regexps[i].literal != NULL && marks[i] != *mark)
+			continue;
+
+		if(pcre_exec(regexps[i].regexp, regexps[i].extra, buf, buflen, 0, 0, NULL, 0) >= 0)
+			return i;
+	}
+
+	return -1;
+}
+
+static int
+run(int count, int nclients, int hitrate, int rounds)
+{
+	struct bench_regexp *regexps;
+	struct acmatch *ac;
+	unsigned int *marks;
+	unsigned int mark = 0;
+	char **clients;
+	int *lens;
+	int literals = 0;
+	int hits = 0;
+	int bad = 0;
+	int i, r, a, b;
+	double start, t_all, t_pre;
+
+	regexps = calloc(count, sizeof(struct bench_regexp));
+	marks = calloc(count, sizeof(unsigned int));
+	clients = malloc(sizeof(char *) * nclients);
+	lens = malloc(sizeof(int) * nclients);
+
+	ac = acmatch_create();
+
+	for(i = 0; i < count; i++)
+	{
+		make_regexp(&regexps[i]);
+
+		if(regexps[i].literal != NULL)
+		{
+			acmatch_add(ac, regexps[i].literal, i);
+			literals++;
+		}
+	}
+
+	acmatch_build(ac);
+
+	for(i = 0; i < nclients; i++)
+	{
+		if((int) (rand_next() % 100) < hitrate)
+			clients[i] = make_client(&regexps[rand_next() % count]);
+		else
+			clients[i] = make_client(NULL);
+
+		lens[i] = strlen(clients[i]);
+	}
+
+	/* both must find the same first match */
+	for(i = 0; i < nclients; i++)
+	{
+		a = check_all(regexps, count, clients[i], lens[i]);
+		b = check_prefilter(regexps, count, ac, marks, &mark,
+				clients[i], lens[i]);
+
+		if(a >= 0)
+			hits++;
+
+		if(a != b && bad++ < 10)
+			printf("mismatch: %s: all %d, prefilter %d\n", clients[i], a, b);
+	}
+
+	start = now();
+	for(r = 0; r < rounds; r++)
+		for(i = 0; i < nclients; i++)
+			check_all(regexps, count, clients[i], lens[i]);
+	t_all = now() - start;
+
+	start = now();
+	for(r = 0; r < rounds; r++)
+		for(i = 0; i < nclients; i++)
+			check_prefilter(regexps, count, ac, marks, &mark,
+					clients[i], lens[i]);
+	t_pre = now() - start;
+
+	printf("%5d regexps (%d with literals), %d of %d clients match\n",
+		count, literals, hits, nclients);
+	printf("  every regexp  %12.0f connects/sec\n", nclients * rounds / t_all);
+	printf("  prefilter     %12.0f connects/sec  (%.1fx)\n",
+		nclients * rounds / t_pre, t_all / t_pre);
+
+	acmatch_free(ac);
+
+	for(i = 0; i < count; i++)
+	{
+		rb_free(regexps[i].literal);
+		pcre_free(regexps[i].extra);
+		pcre_free(regexps[i].regexp);
+	}
+
+	for(i = 0; i < nclients; i++)
+		free(clients[i]);
+
+	free(regexps);
+	free(marks);
+	free(clients);
+	free(lens);
+
+	return bad;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const int sizes[] = { 10, 100, 1000 };
+	int nclients = 20000;
+	int hitrate = 5;
+	int rounds = 3;
+	int bad = 0;
+	int i, c;
+
+	while((c = getopt(argc, argv, "c:h:r:s:")) != -1)
+	{
+		switch(c)
+		{
+		case 'c':
+			nclients = atoi(optarg);
+			break;
+		case 'h':
+			hitrate = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 's':
+			rand_state = strtoul(optarg, NULL, 10) | 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-c clients] [-h hitrate] [-r rounds] [-s seed]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+
+	if(nclients < 1 || rounds < 1)
+		return 2;
+
+	for(i = 0; i < (int) (sizeof(sizes) / sizeof(sizes[0])); i++)
+		bad += run(sizes[i], nclients, hitrate, rounds);
+
+	if(bad)
+	{
+		printf("%d mismatches\n", bad);
+		return 1;
+	}
+
+	printf("no mismatches\n");
+	return 0;
+}